@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include "response.h"
+
+/*
+    响应头部拼装的微基准: 原来每个字段一次vsnprintf(add_response), 现在是编译期生成的状态行/错误页面
+    加上定长memcpy和u64_to_dec。两种方式生成完全相同的字节, 先比较一次输出再计时
+    1. 文件响应: 状态行、Content-Length、Content-Type、Connection、空行
+    2. 404错误页面: 同样的头部加上错误页面
+    用法: header_bench [次数]
+*/
+
+static const int BUFFER_SIZE = 2048;
+static const char error_404_form[] = "The requested file was not found on this server.\n";
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct printf_writer // 基线版本的add_response系列
+{
+    char buf[BUFFER_SIZE];
+    int idx;
+
+    bool add_response(const char *format, ...)
+    {
+        if (idx >= BUFFER_SIZE)
+        {
+            return false;
+        }
+        va_list arg_list;
+        va_start(arg_list, format);
+        int len = vsnprintf(buf + idx, BUFFER_SIZE - 1 - idx, format, arg_list);
+        va_end(arg_list);
+        if (len >= BUFFER_SIZE - 1 - idx)
+        {
+            return false;
+        }
+        idx += len;
+        return true;
+    }
+
+    bool file_header(long size, bool linger)
+    {
+        return add_response("%s %d %s\r\n", "HTTP/1.1", 200, "OK") && add_response("Content-Length: %ld\r\n", size) &&
+               add_response("Content-Type:%s\r\n", "text/html") &&
+               add_response("Connection: %s\r\n", linger ? "keep-alive" : "close") && add_response("%s", "\r\n");
+    }
+
+    bool not_found(bool linger)
+    {
+        return add_response("%s %d %s\r\n", "HTTP/1.1", 404, "Not Found") &&
+               add_response("Content-Length: %d\r\n", (int)strlen(error_404_form)) &&
+               add_response("Content-Type:%s\r\n", "text/html") &&
+               add_response("Connection: %s\r\n", linger ? "keep-alive" : "close") && add_response("%s", "\r\n") &&
+               add_response("%s", error_404_form);
+    }
+};
+
+struct span_writer // 现在http_conn的add_span系列
+{
+    char buf[BUFFER_SIZE];
+    int idx;
+
+    bool add_span(const byte_span &span)
+    {
+        if (idx + span.len > (size_t)BUFFER_SIZE)
+        {
+            return false;
+        }
+        memcpy(buf + idx, span.data, span.len);
+        idx += span.len;
+        return true;
+    }
+
+    bool add_content_length(unsigned long long size)
+    {
+        if (idx + 40 > BUFFER_SIZE)
+        {
+            return false;
+        }
+        idx += append_span(buf + idx, header_span::content_length());
+        idx += u64_to_dec(buf + idx, size);
+        idx += append_span(buf + idx, header_span::crlf());
+        return true;
+    }
+
+    bool file_header(long size, bool linger)
+    {
+        return add_span(http_status<200>::line()) && add_content_length(size) &&
+               add_span(header_span::content_type_html()) &&
+               add_span(linger ? header_span::keep_alive() : header_span::close()) && add_span(header_span::crlf());
+    }
+
+    bool not_found(bool linger)
+    {
+        return add_span(http_status<404>::line()) && add_span(header_span::content_length()) &&
+               add_span(http_status<404>::body_length()) && add_span(header_span::crlf()) &&
+               add_span(header_span::content_type_html()) &&
+               add_span(linger ? header_span::keep_alive() : header_span::close()) && add_span(header_span::crlf()) &&
+               add_span(http_status<404>::body());
+    }
+};
+
+template <typename W>
+static double bench(W &w, bool file, long rounds)
+{
+    long long start = now_ns();
+    for (long i = 0; i < rounds; ++i)
+    {
+        w.idx = 0;
+        bool ok = file ? w.file_header(1000 + (i & 0xffff), i & 1) : w.not_found(i & 1);
+        if (!ok)
+        {
+            abort();
+        }
+        __asm__ __volatile__("" : : "r"(w.buf) : "memory"); // 不让编译器省掉写入
+    }
+    return (double)(now_ns() - start) / rounds;
+}
+
+int main(int argc, char *argv[])
+{
+    long rounds = argc > 1 ? atol(argv[1]) : 5000000;
+    static printf_writer p;
+    static span_writer s;
+    for (int file = 0; file < 2; ++file)
+    {
+        p.idx = s.idx = 0;
+        bool ok = file ? p.file_header(123456, true) && s.file_header(123456, true) : p.not_found(false) && s.not_found(false);
+        if (!ok || p.idx != s.idx || memcmp(p.buf, s.buf, p.idx) != 0)
+        {
+            fprintf(stderr, "output differs for the %s response\n", file ? "file" : "404");
+            return 1;
+        }
+    }
+
+    printf("%ld rounds (ns per response)\n", rounds);
+    printf("  file header   vsnprintf %7.1f   spans %7.1f\n", bench(p, true, rounds), bench(s, true, rounds));
+    printf("  404 page      vsnprintf %7.1f   spans %7.1f\n", bench(p, false, rounds), bench(s, false, rounds));
+    return 0;
+}
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/*
+    长连接压测客户端: webbench每个请求都新建连接(Connection: close), 测不到keep-alive下各个后端的差别。
+    每个客户端线程用自己的epoll管理一组长连接, 每个连接发一个请求、收完整个响应(按Content-Length)后再发下一个,
+    输出每秒完成的请求数。服务器中途关闭连接时重新连接并记为失败。
+    客户端和服务器最好用taskset绑到不同的CPU上, 否则测到的是两者争抢同一个CPU
+    用法: keepalive_bench [连接数] [秒数] [客户端线程数] [端口] [路径]
+*/
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static const int BUF_SIZE = 64 * 1024;
+
+struct client_conn
+{
+    int fd;
+    int len;    // 缓冲区中已经收到的字节数
+    long need;  // 当前响应的总长度(头部加正文), 头部还没有收完时为-1
+    bool ok;    // 当前响应的状态码是200
+    char buf[BUF_SIZE];
+};
+
+struct client_thread
+{
+    int conns;
+    int port;
+    long long deadline;
+    const char *request;
+    int request_len;
+    long done;   // 完成的请求数
+    long failed; // 非200响应、连接被关闭或者出错的次数
+};
+
+static int open_conn(int epollfd, int port, client_conn *c)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)
+    {
+        close(fd);
+        return -1;
+    }
+    c->fd = fd;
+    c->len = 0;
+    c->need = -1;
+    epoll_event ev;
+    ev.events = EPOLLOUT; // 连接建立后发第一个请求
+    ev.data.ptr = c;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev);
+    return fd;
+}
+
+static void restart(int epollfd, client_thread *t, client_conn *c)
+{
+    t->failed++;
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    open_conn(epollfd, t->port, c);
+}
+
+/* 解析缓冲区开头的响应头部, 返回整个响应的长度, 头部不完整时返回-1 */
+static long response_length(const client_conn *c)
+{
+    const char *end = (const char *)memmem(c->buf, c->len, "\r\n\r\n", 4);
+    if (!end)
+    {
+        return -1;
+    }
+    long header = end + 4 - c->buf;
+    for (const char *p = c->buf; p < end; ++p)
+    {
+        if (strncasecmp(p, "\r\nContent-Length:", 17) == 0)
+        {
+            return header + atol(p + 17);
+        }
+    }
+    return header;
+}
+
+static void *run(void *arg)
+{
+    client_thread *t = (client_thread *)arg;
+    int epollfd = epoll_create1(EPOLL_CLOEXEC);
+    client_conn *conns = new client_conn[t->conns];
+    for (int i = 0; i < t->conns; ++i)
+    {
+        open_conn(epollfd, t->port, &conns[i]);
+    }
+    epoll_event events[256];
+    while (now_ns() < t->deadline)
+    {
+        int n = epoll_wait(epollfd, events, 256, 100);
+        for (int i = 0; i < n; ++i)
+        {
+            client_conn *c = (client_conn *)events[i].data.ptr;
+            if (events[i].events & EPOLLOUT) // 连接已经建立
+            {
+                epoll_event ev;
+                ev.events = EPOLLIN;
+                ev.data.ptr = c;
+                epoll_ctl(epollfd, EPOLL_CTL_MOD, c->fd, &ev);
+                if (send(c->fd, t->request, t->request_len, MSG_NOSIGNAL) != t->request_len)
+                {
+                    restart(epollfd, t, c);
+                }
+                continue;
+            }
+            ssize_t got = recv(c->fd, c->buf + c->len, BUF_SIZE - c->len, 0);
+            if (got <= 0)
+            {
+                if (got < 0 && errno == EAGAIN)
+                {
+                    continue;
+                }
+                restart(epollfd, t, c);
+                continue;
+            }
+            c->len += got;
+            if (c->need < 0)
+            {
+                c->need = response_length(c);
+                c->ok = strncmp(c->buf, "HTTP/1.1 200", 12) == 0;
+            }
+            if (c->need < 0 || c->len < c->need)
+            {
+                if (c->len == BUF_SIZE) // 正文比缓冲区大时只保留计数
+                {
+                    c->need -= c->len;
+                    c->len = 0;
+                }
+                continue;
+            }
+            if (c->ok)
+            {
+                t->done++;
+            }
+            else
+            {
+                t->failed++;
+            }
+            c->len = 0;
+            c->need = -1;
+            if (send(c->fd, t->request, t->request_len, MSG_NOSIGNAL) != t->request_len)
+            {
+                restart(epollfd, t, c);
+            }
+        }
+    }
+    for (int i = 0; i < t->conns; ++i)
+    {
+        close(conns[i].fd);
+    }
+    delete[] conns;
+    close(epollfd);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int conns = argc > 1 ? atoi(argv[1]) : 50;
+    int seconds = argc > 2 ? atoi(argv[2]) : 5;
+    int threads = argc > 3 ? atoi(argv[3]) : 1;
+    int port = argc > 4 ? atoi(argv[4]) : 9006;
+    const char *path = argc > 5 ? argv[5] : "/index.html";
+    if (conns <= 0 || seconds <= 0 || threads <= 0 || threads > conns)
+    {
+        fprintf(stderr, "usage: %s [connections] [seconds] [threads] [port] [path]\n", argv[0]);
+        return 1;
+    }
+
+    char request[512];
+    int request_len = snprintf(request, sizeof(request),
+                               "GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: keep-alive\r\n\r\n", path);
+    long long start = now_ns();
+    client_thread *ts = new client_thread[threads];
+    pthread_t *tids = new pthread_t[threads];
+    for (int i = 0; i < threads; ++i)
+    {
+        ts[i].conns = conns / threads + (i < conns % threads ? 1 : 0);
+        ts[i].port = port;
+        ts[i].deadline = start + seconds * 1000000000LL;
+        ts[i].request = request;
+        ts[i].request_len = request_len;
+        ts[i].done = 0;
+        ts[i].failed = 0;
+        pthread_create(&tids[i], NULL, run, &ts[i]);
+    }
+    long done = 0, failed = 0;
+    for (int i = 0; i < threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+        done += ts[i].done;
+        failed += ts[i].failed;
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+    printf("%d connections, %d threads, %.1f s: %.0f requests/s (%.0f pages/min), %ld done, %ld failed\n", conns,
+           threads, elapsed, done / elapsed, done / elapsed * 60, done, failed);
+    delete[] tids;
+    delete[] ts;
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include "logger.h"
+
+/*
+    日志热路径的微基准: 与原来直接printf(stdio带锁的缓冲区)对比
+    1. printf: 每个线程往同一个FILE写一行, 相当于改动之前工作线程里的printf
+    2. LOG_INFO: 异步日志, 后台线程把记录写到同一个文件(stderr被重定向到这个文件)
+    3. logger::access: 访问日志的结构化记录
+    每个线程连续写BURST条记录(不超过环形缓冲区的一半)后休眠一段时间, 让后台线程有机会取走记录,
+    这样测到的是缓冲区不满时调用方的耗时, 而不是丢弃记录的耗时; 输出调用方每条记录的平均耗时和丢弃数
+    用法: logger_bench [线程数] [每个线程的记录数] [输出文件]
+*/
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static const int BURST = logger::RING_RECORDS / 2;
+static const long PAUSE_NS = 20 * 1000 * 1000; // 大于后台线程空闲时的检查间隔(10毫秒)
+
+static const char *sample_url = "/images/image1.jpg?width=640&height=480";
+
+enum mode
+{
+    PRINTF,
+    LOG,
+    ACCESS
+};
+
+struct log_run
+{
+    mode how;
+    long records;
+    FILE *out;
+    long long elapsed_ns; // 调用方在写日志上花的时间, 不包括休眠
+};
+
+static void write_one(const log_run *run, const sockaddr_in &addr, long i)
+{
+    switch (run->how)
+    {
+    case PRINTF:
+        fprintf(run->out, "got 1 http line: GET %s HTTP/1.1 %ld\n", sample_url, i);
+        break;
+    case LOG:
+        LOG_INFO("got 1 http line: GET %s HTTP/1.1 %ld", sample_url, i);
+        break;
+    case ACCESS:
+        logger::access(addr, "GET", sample_url, 200, 66766);
+        break;
+    }
+}
+
+static void *produce(void *arg)
+{
+    log_run *run = (log_run *)arg;
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    write_one(run, addr, -1); // 第一条记录会分配本线程的环形缓冲区, 不计时
+    struct timespec pause = {0, PAUSE_NS};
+    run->elapsed_ns = 0;
+    for (long i = 0; i < run->records; i += BURST)
+    {
+        long end = i + BURST < run->records ? i + BURST : run->records;
+        long long start = now_ns();
+        for (long j = i; j < end; ++j)
+        {
+            write_one(run, addr, j);
+        }
+        run->elapsed_ns += now_ns() - start;
+        nanosleep(&pause, NULL);
+    }
+    return NULL;
+}
+
+/* 返回调用方每条记录的平均耗时, dropped返回丢弃的记录数 */
+static double bench(mode how, int threads, long records, FILE *out, const char *path, unsigned long &dropped)
+{
+    if (how != PRINTF && !logger::start(how == ACCESS ? path : NULL))
+    {
+        printf("logger::start failed\n");
+        exit(1);
+    }
+    unsigned long before = logger::dropped();
+    pthread_t *tids = new pthread_t[threads];
+    log_run *runs = new log_run[threads];
+    for (int i = 0; i < threads; ++i)
+    {
+        runs[i].how = how;
+        runs[i].records = records;
+        runs[i].out = out;
+        pthread_create(&tids[i], NULL, produce, &runs[i]);
+    }
+    long long elapsed = 0;
+    for (int i = 0; i < threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+        elapsed += runs[i].elapsed_ns;
+    }
+    if (how == PRINTF)
+    {
+        fflush(out);
+    }
+    else
+    {
+        logger::stop();
+    }
+    dropped = logger::dropped() - before;
+    delete[] runs;
+    delete[] tids;
+    return (double)elapsed / ((double)threads * records);
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    long records = argc > 2 ? atol(argv[2]) : 20000;
+    const char *path = argc > 3 ? argv[3] : "/tmp/logger_bench.log";
+    if (threads <= 0 || records <= 0)
+    {
+        fprintf(stderr, "usage: %s [threads] [records per thread] [output file]\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        perror(path);
+        return 1;
+    }
+    FILE *out = fdopen(fd, "w");
+    dup2(fd, STDERR_FILENO); // 异步日志的错误日志写到stderr, 和printf写到同一个文件
+
+    unsigned long dropped;
+    printf("%d threads, %ld records each in bursts of %d, output %s (ns per record, dropped)\n", threads, records,
+           BURST, path);
+    double caller = bench(PRINTF, threads, records, out, path, dropped);
+    printf("  printf               %8.1f\n", caller);
+    caller = bench(LOG, threads, records, out, path, dropped);
+    printf("  LOG_INFO             %8.1f %8lu\n", caller, dropped);
+    caller = bench(ACCESS, threads, records, out, path, dropped);
+    printf("  logger::access       %8.1f %8lu\n", caller, dropped);
+
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "http_parser.h"
+
+/*
+    find_line_end的对拍和微基准。
+    1. 对拍: 随机生成包含大量'\r'、'\n'、':'的字节串, 从随机的对齐偏移开始, 与逐字节扫描的参考实现比较
+       行尾和第一个':'的位置; 同时把找到的行交给split_request_line/split_header, 用sanitizer构建时检查越界
+    2. 基准: 按parse_line的方式逐行扫描一个典型的浏览器请求, 比较逐字节循环和向量化扫描每个请求的耗时
+    默认构建使用SSE2, make parser_avx2_bench使用AVX2, make check用ASan/UBSan构建两种版本并只运行对拍
+    用法: parser_bench [对拍次数] [基准轮数]
+*/
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static const char *scalar_line_end(const char *p, const char *end, const char **colon) // 参考实现, 即原来parse_line的逐字节循环
+{
+    const char *first_colon = NULL;
+    for (; p < end; ++p)
+    {
+        if (*p == '\r' || *p == '\n')
+        {
+            break;
+        }
+        if (*p == ':' && !first_colon)
+        {
+            first_colon = p;
+        }
+    }
+    if (colon)
+    {
+        *colon = first_colon;
+    }
+    return p;
+}
+
+static bool cross_check(long rounds)
+{
+    static char buf[1024 + 64];
+    unsigned seed = 12345;
+    for (long i = 0; i < rounds; ++i)
+    {
+        int len = rand_r(&seed) % 1024;
+        int offset = rand_r(&seed) % 64;
+        int density = 1 + rand_r(&seed) % 200; // 特殊字符出现的概率, 从很密到很稀疏
+        char *p = buf + offset;
+        for (int j = 0; j < len; ++j)
+        {
+            int r = rand_r(&seed);
+            static const char special[] = "\r\n:";
+            p[j] = r % density == 0 ? special[(r >> 8) % 3] : (char)(r >> 16);
+        }
+        //  放到一块刚好够大的堆内存中, ASan能发现越过末尾的读
+        char *copy = (char *)malloc(len ? len : 1);
+        memcpy(copy, p, len);
+        const char *end = copy + len;
+
+        const char *want_colon = NULL, *got_colon = (const char *)1;
+        const char *want = scalar_line_end(copy, end, &want_colon);
+        const char *got = find_line_end(copy, end, &got_colon);
+        const char *got_no_colon = find_line_end(copy, end, NULL);
+        if (got != want || got_colon != want_colon || got_no_colon != want)
+        {
+            fprintf(stderr, "mismatch in round %ld: len %d, line end %ld/%ld, colon %ld/%ld\n", i, len,
+                    (long)(got - copy), (long)(want - copy), got_colon ? (long)(got_colon - copy) : -1L,
+                    want_colon ? (long)(want_colon - copy) : -1L);
+            free(copy);
+            return false;
+        }
+
+        size_t line_len = want - copy;
+        request_line line;
+        split_request_line(copy, line_len, line);
+        if (want_colon)
+        {
+            byte_span name, value;
+            split_header(copy, line_len, want_colon, name, value);
+        }
+        free(copy);
+    }
+    return true;
+}
+
+static const char request[] =
+    "GET /images/image1.jpg?size=large HTTP/1.1\r\n"
+    "Host: 192.168.110.129:10000\r\n"
+    "Connection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+    "Referer: http://192.168.110.129:10000/index.html\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "If-None-Match: \"ce8023-158-6ad2df1d\"\r\n"
+    "If-Modified-Since: Sat, 17 Oct 2026 02:45:15 GMT\r\n"
+    "\r\n";
+
+typedef const char *(*scan_fn)(const char *, const char *, const char **);
+
+static double bench(scan_fn scan, long rounds)
+{
+    const char *end = request + sizeof(request) - 1;
+    long lines = 0;
+    long long start = now_ns();
+    for (long i = 0; i < rounds; ++i)
+    {
+        for (const char *p = request; p < end;)
+        {
+            const char *colon;
+            p = scan(p, end, &colon) + 2; // 跳过"\r\n"
+            __asm__ __volatile__("" : : "r"(colon) : "memory");
+            ++lines;
+        }
+    }
+    double ns = (double)(now_ns() - start);
+    return lines ? ns / rounds : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    long checks = argc > 1 ? atol(argv[1]) : 2000000;
+    long rounds = argc > 2 ? atol(argv[2]) : 2000000;
+#if defined(__AVX2__)
+    const char *isa = "AVX2";
+#elif defined(__SSE2__)
+    const char *isa = "SSE2";
+#else
+    const char *isa = "scalar";
+#endif
+    if (!cross_check(checks))
+    {
+        return 1;
+    }
+    printf("find_line_end (%s) matches the scalar loop on %ld random inputs\n", isa, checks);
+    if (rounds > 0)
+    {
+        printf("scan a %zu-byte request, %ld rounds (ns per request)\n", sizeof(request) - 1, rounds);
+        printf("  byte loop      %7.1f\n", bench(scalar_line_end, rounds));
+        printf("  find_line_end  %7.1f\n", bench(find_line_end, rounds));
+    }
+    return 0;
+}
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <list>
+#include <atomic>
+#include "mpmc_queue.h"
+#include "threadpool.h"
+
+/*
+    请求队列的微基准: 与原来用互斥锁保护的std::list(基线版本的threadpool)对比
+    1. 只测队列: P个生产者和C个消费者各自在循环中入队/出队, 输出每个元素一次入队加一次出队的平均耗时
+    2. 测整个线程池: 一个线程(相当于reactor)投递空任务, 输出每个任务从append到process执行完的平均摊销耗时
+    用法: queue_bench [生产者数] [消费者数] [元素数]
+*/
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+class locked_list // 基线版本的请求队列: 互斥锁 + std::list, 有容量上限
+{
+public:
+    explicit locked_list(size_t capacity) : m_capacity(capacity) {}
+
+    bool push(int *item)
+    {
+        m_lock.lock();
+        if (m_list.size() >= m_capacity)
+        {
+            m_lock.unlock();
+            return false;
+        }
+        m_list.push_back(item);
+        m_lock.unlock();
+        return true;
+    }
+
+    bool pop(int *&item)
+    {
+        m_lock.lock();
+        if (m_list.empty())
+        {
+            m_lock.unlock();
+            return false;
+        }
+        item = m_list.front();
+        m_list.pop_front();
+        m_lock.unlock();
+        return true;
+    }
+
+private:
+    size_t m_capacity;
+    std::list<int *> m_list;
+    locker m_lock;
+};
+
+template <typename Q>
+struct queue_run
+{
+    Q *queue;
+    long per_thread;
+    std::atomic<long> *consumed;
+    long total;
+};
+
+template <typename Q>
+static void *produce(void *arg)
+{
+    queue_run<Q> *run = (queue_run<Q> *)arg;
+    static int dummy;
+    for (long i = 0; i < run->per_thread; ++i)
+    {
+        while (!run->queue->push(&dummy)) // 队列满时等消费者
+        {
+            cpu_relax();
+        }
+    }
+    return NULL;
+}
+
+template <typename Q>
+static void *consume(void *arg)
+{
+    queue_run<Q> *run = (queue_run<Q> *)arg;
+    int *item;
+    while (run->consumed->load(std::memory_order_relaxed) < run->total)
+    {
+        if (run->queue->pop(item))
+        {
+            run->consumed->fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            cpu_relax();
+        }
+    }
+    return NULL;
+}
+
+template <typename Q>
+static double bench_queue(int producers, int consumers, long items)
+{
+    Q queue(10000);
+    std::atomic<long> consumed(0);
+    queue_run<Q> run = {&queue, items / producers, &consumed, items / producers * producers};
+    pthread_t threads[128];
+    long long start = now_ns();
+    for (int i = 0; i < consumers; ++i)
+    {
+        pthread_create(&threads[i], NULL, consume<Q>, &run);
+    }
+    for (int i = 0; i < producers; ++i)
+    {
+        pthread_create(&threads[consumers + i], NULL, produce<Q>, &run);
+    }
+    for (int i = 0; i < producers + consumers; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    return (double)(now_ns() - start) / run.total;
+}
+
+struct task // 空任务, 只记录自己被执行过
+{
+    static std::atomic<long> done;
+    void process() { done.fetch_add(1, std::memory_order_relaxed); }
+};
+std::atomic<long> task::done(0);
+
+template <typename T>
+class locked_pool // 基线版本的线程池: 互斥锁保护的std::list, 每个任务post一次信号量
+{
+public:
+    locked_pool(int thread_number, int max_requests) : m_threads(thread_number), m_max(max_requests), m_stop(false)
+    {
+        for (int i = 0; i < m_threads; ++i)
+        {
+            pthread_create(&m_ids[i], NULL, worker, this);
+        }
+    }
+
+    ~locked_pool()
+    {
+        m_stop = true;
+        for (int i = 0; i < m_threads; ++i)
+        {
+            m_stat.post();
+        }
+        for (int i = 0; i < m_threads; ++i)
+        {
+            pthread_join(m_ids[i], NULL);
+        }
+    }
+
+    bool append(T *request)
+    {
+        m_lock.lock();
+        if (m_queue.size() >= (size_t)m_max)
+        {
+            m_lock.unlock();
+            return false;
+        }
+        m_queue.push_back(request);
+        m_lock.unlock();
+        m_stat.post();
+        return true;
+    }
+
+private:
+    static void *worker(void *arg)
+    {
+        locked_pool *pool = (locked_pool *)arg;
+        while (!pool->m_stop)
+        {
+            pool->m_stat.wait();
+            pool->m_lock.lock();
+            if (pool->m_queue.empty())
+            {
+                pool->m_lock.unlock();
+                continue;
+            }
+            T *request = pool->m_queue.front();
+            pool->m_queue.pop_front();
+            pool->m_lock.unlock();
+            request->process();
+        }
+        return NULL;
+    }
+
+    int m_threads;
+    int m_max;
+    pthread_t m_ids[128];
+    std::list<T *> m_queue;
+    locker m_lock;
+    sem m_stat;
+    volatile bool m_stop;
+};
+
+template <typename P>
+static double bench_pool(P &pool, long tasks)
+{
+    static task t;
+    task::done.store(0);
+    long long start = now_ns();
+    for (long i = 0; i < tasks; ++i)
+    {
+        while (!pool.append(&t))
+        {
+            cpu_relax();
+        }
+    }
+    while (task::done.load(std::memory_order_relaxed) < tasks)
+    {
+        cpu_relax();
+    }
+    return (double)(now_ns() - start) / tasks;
+}
+
+int main(int argc, char *argv[])
+{
+    int producers = argc > 1 ? atoi(argv[1]) : 1;
+    int consumers = argc > 2 ? atoi(argv[2]) : 4;
+    long items = argc > 3 ? atol(argv[3]) : 2000000;
+    if (producers < 1 || consumers < 1 || producers + consumers > 128 || items < producers)
+    {
+        fprintf(stderr, "usage: %s [producers] [consumers] [items]\n", argv[0]);
+        return 1;
+    }
+
+    printf("queue only, %d producers, %d consumers, %ld items (ns per push+pop)\n", producers, consumers, items);
+    printf("  locked std::list     %8.1f\n", bench_queue<locked_list>(producers, consumers, items));
+    printf("  mpmc_queue           %8.1f\n", bench_queue<mpmc_queue<int *> >(producers, consumers, items));
+
+    printf("thread pool, 1 submitter, %d workers, %ld tasks (ns per task)\n", consumers, items);
+    {
+        locked_pool<task> pool(consumers, 10000);
+        printf("  locked std::list     %8.1f\n", bench_pool(pool, items));
+    }
+    {
+        threadpool<task> pool(consumers, 10000, false);
+        printf("  threadpool shared    %8.1f\n", bench_pool(pool, items));
+    }
+    {
+        threadpool<task> pool(consumers, 10000, true);
+        printf("  threadpool stealing  %8.1f\n", bench_pool(pool, items));
+    }
+    return 0;
+}
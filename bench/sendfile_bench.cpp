@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/*
+    文件发送路径的微基准, 与http_conn的两种发送方式一致:
+    mmap+writev: 每个响应open/fstat/mmap文件, writev发送头部和映射区, 然后munmap/close
+    sendfile:    每个响应open文件, 头部用sendmsg(MSG_MORE)发送, 文件用sendfile发送, 然后close
+    通过回环TCP连接发送, 另一个线程只管接收丢弃。文件都在页缓存中, 测的是每个响应的CPU开销和吞吐量
+    用法: sendfile_bench [目录] [文件大小...]  (默认在/tmp下测4K 64K 1M 16M)
+*/
+
+static const char header[] = "HTTP/1.1 200 OK\r\nContent-Length: 0000000\r\nContent-Type: application/octet-stream\r\n"
+                             "Connection: keep-alive\r\n\r\n";
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void *drain(void *arg) // 接收并丢弃所有数据, 直到对方关闭
+{
+    int fd = *(int *)arg;
+    static char buf[1 << 20];
+    while (recv(fd, buf, sizeof(buf), 0) > 0)
+    {
+    }
+    return NULL;
+}
+
+static bool connect_pair(int &client, int &server)
+{
+    int listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenfd, 1) < 0 ||
+        getsockname(listenfd, (struct sockaddr *)&addr, &len) < 0)
+    {
+        return false;
+    }
+    client = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(client, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        return false;
+    }
+    server = accept(listenfd, NULL, NULL);
+    close(listenfd);
+    return server >= 0;
+}
+
+static bool send_all_iov(int fd, struct iovec *iv, int count) // 阻塞socket上的writev也可能被信号打断而部分写入
+{
+    while (count > 0)
+    {
+        ssize_t n = writev(fd, iv, count);
+        if (n < 0)
+        {
+            return false;
+        }
+        while (count > 0 && (size_t)n >= iv->iov_len)
+        {
+            n -= iv->iov_len;
+            ++iv;
+            --count;
+        }
+        if (count > 0)
+        {
+            iv->iov_base = (char *)iv->iov_base + n;
+            iv->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+static bool respond_mmap(int sock, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    off_t size = lseek(fd, 0, SEEK_END);
+    void *addr = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        return false;
+    }
+    struct iovec iv[2] = {{(void *)header, sizeof(header) - 1}, {addr, (size_t)size}};
+    bool ok = send_all_iov(sock, iv, 2);
+    munmap(addr, size);
+    return ok;
+}
+
+static bool respond_sendfile(int sock, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    off_t size = lseek(fd, 0, SEEK_END);
+    bool ok = send(sock, header, sizeof(header) - 1, MSG_MORE) == (ssize_t)sizeof(header) - 1;
+    off_t off = 0;
+    while (ok && off < size)
+    {
+        ok = sendfile(sock, fd, &off, size - off) > 0;
+    }
+    close(fd);
+    return ok;
+}
+
+static bool make_file(const char *path, long size)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    char block[65536];
+    memset(block, 'x', sizeof(block));
+    for (long left = size; left > 0; left -= sizeof(block))
+    {
+        if (write(fd, block, left < (long)sizeof(block) ? left : sizeof(block)) < 0)
+        {
+            close(fd);
+            return false;
+        }
+    }
+    close(fd);
+    return true;
+}
+
+static long parse_size(const char *s)
+{
+    char *end;
+    long n = strtol(s, &end, 10);
+    if (*end == 'K' || *end == 'k')
+        n <<= 10;
+    else if (*end == 'M' || *end == 'm')
+        n <<= 20;
+    return n;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dir = argc > 1 ? argv[1] : "/tmp";
+    static const char *defaults[] = {"4K", "64K", "1M", "16M"};
+    int count = argc > 2 ? argc - 2 : 4;
+    const char **sizes = argc > 2 ? (const char **)argv + 2 : defaults;
+
+    int client, server;
+    if (!connect_pair(client, server))
+    {
+        perror("loopback connection");
+        return 1;
+    }
+    pthread_t reader;
+    pthread_create(&reader, NULL, drain, &client);
+
+    printf("%-8s %-12s %12s %12s\n", "size", "method", "us/response", "MB/s");
+    for (int i = 0; i < count; ++i)
+    {
+        long size = parse_size(sizes[i]);
+        char path[256];
+        snprintf(path, sizeof(path), "%s/sendfile_bench.%ld", dir, size);
+        if (size <= 0 || !make_file(path, size))
+        {
+            fprintf(stderr, "cannot create %s\n", path);
+            return 1;
+        }
+        long rounds = (256L << 20) / size; // 每种方式发送约256MB, 小文件至少2000次
+        if (rounds < 2000)
+        {
+            rounds = 2000;
+        }
+        for (int method = 0; method < 2; ++method)
+        {
+            respond_sendfile(server, path); // 预热页缓存和socket缓冲区
+            long long start = now_ns();
+            for (long r = 0; r < rounds; ++r)
+            {
+                if (!(method == 0 ? respond_mmap(server, path) : respond_sendfile(server, path)))
+                {
+                    perror("send");
+                    return 1;
+                }
+            }
+            double ns = (double)(now_ns() - start);
+            printf("%-8s %-12s %12.2f %12.1f\n", sizes[i], method == 0 ? "mmap+writev" : "sendfile",
+                   ns / rounds / 1000, (double)size * rounds / (1 << 20) / (ns / 1e9));
+        }
+        unlink(path);
+    }
+    close(server);
+    pthread_join(reader, NULL);
+    close(client);
+    return 0;
+}
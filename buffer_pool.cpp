@@ -0,0 +1,138 @@
+#include "buffer_pool.h"
+
+buffer_pool::buffer_pool() : m_slab_bytes(0), m_used_bytes(0)
+{
+    for (int n = 0; n < cpu_topology::MAX_NODES; ++n)
+    {
+        for (int i = 0; i < CLASSES; ++i)
+        {
+            m_free[n][i] = NULL;
+        }
+    }
+}
+
+buffer_pool::~buffer_pool()
+{
+    for (size_t i = 0; i < m_slabs.size(); ++i)
+    {
+        cpu_topology::release(m_slabs[i], SLAB_SIZE);
+    }
+}
+
+int buffer_pool::size_class(size_t size) // 能放下size字节的最小级别
+{
+    int cls = 0;
+    while (((size_t)1 << (MIN_SHIFT + cls)) < size)
+    {
+        ++cls;
+    }
+    return cls;
+}
+
+buffer_pool::local_cache &buffer_pool::cache()
+{
+    static thread_local local_cache lc; // 零初始化
+    if (!lc.ready)
+    {
+        lc.node = cpu_topology::current_node();
+        lc.ready = true;
+    }
+    return lc;
+}
+
+char *buffer_pool::alloc(size_t size, size_t &capacity)
+{
+    if (size > MAX_SIZE)
+    {
+        return NULL;
+    }
+    int cls = size_class(size);
+    local_cache &lc = cache();
+    if (!lc.head[cls])
+    {
+        refill(lc, cls);
+        if (!lc.head[cls])
+        {
+            return NULL;
+        }
+    }
+    free_node *node = lc.head[cls];
+    lc.head[cls] = node->next;
+    lc.count[cls]--;
+    capacity = (size_t)1 << (MIN_SHIFT + cls);
+    m_used_bytes.fetch_add(capacity, std::memory_order_relaxed);
+    return (char *)node;
+}
+
+void buffer_pool::free(char *buf, size_t size)
+{
+    if (!buf)
+    {
+        return;
+    }
+    int cls = size_class(size);
+    local_cache &lc = cache();
+    free_node *node = (free_node *)buf;
+    node->next = lc.head[cls];
+    lc.head[cls] = node;
+    if (++lc.count[cls] >= 2 * BATCH)
+    {
+        spill(lc, cls);
+    }
+    m_used_bytes.fetch_sub((size_t)1 << (MIN_SHIFT + cls), std::memory_order_relaxed);
+}
+
+void buffer_pool::refill(local_cache &lc, int cls)
+{
+    size_t size = (size_t)1 << (MIN_SHIFT + cls);
+    locker &lock = m_lock[lc.node][cls];
+    free_node *&list = m_free[lc.node][cls];
+    lock.lock();
+    if (!list) // 本节点的全局链表也空了, 从本节点申请一个新的slab切分后挂到全局链表上
+    {
+        lock.unlock();
+        void *slab = cpu_topology::alloc_on_node(SLAB_SIZE, lc.node);
+        if (!slab)
+        {
+            return;
+        }
+        m_slab_lock.lock();
+        m_slabs.push_back((char *)slab);
+        m_slab_lock.unlock();
+        m_slab_bytes.fetch_add(SLAB_SIZE, std::memory_order_relaxed);
+
+        lock.lock();
+        for (size_t off = 0; off + size <= SLAB_SIZE; off += size)
+        {
+            free_node *node = (free_node *)((char *)slab + off);
+            node->next = list;
+            list = node;
+        }
+    }
+    for (int i = 0; i < BATCH && list; ++i)
+    {
+        free_node *node = list;
+        list = node->next;
+        node->next = lc.head[cls];
+        lc.head[cls] = node;
+        lc.count[cls]++;
+    }
+    lock.unlock();
+}
+
+void buffer_pool::spill(local_cache &lc, int cls)
+{
+    free_node *head = lc.head[cls];
+    free_node *last = head;
+    for (int i = 1; i < BATCH; ++i)
+    {
+        last = last->next;
+    }
+    lc.head[cls] = last->next;
+    lc.count[cls] -= BATCH;
+
+    m_lock[lc.node][cls].lock();
+    last->next = m_free[lc.node][cls];
+    m_free[lc.node][cls] = head;
+    m_lock[lc.node][cls].unlock();
+}
@@ -0,0 +1,66 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+#include "locker.h"
+#include "cpu_topology.h"
+
+/*
+    连接读写缓冲区的分级内存池。缓冲区按2的幂分成若干个大小级别(512B~64KB),
+    每个级别从64KB的slab中切分出来, 释放后挂到空闲链表上复用, 不归还给系统,
+    常驻内存只和同时有I/O进行中的连接数有关, 而不是和最大连接数有关。
+    每个线程为每个级别缓存少量空闲缓冲区, 分配和释放通常不需要加锁,
+    线程缓存空了或者满了才成批地和全局空闲链表交换。
+    线程缓存是线程局部的静态变量, 所以进程中只应该有一个实例。
+    NUMA机器上每个节点有自己的全局空闲链表, slab优先从节点本地的内存中分配,
+    线程只和自己(第一次分配时)所在节点的链表交换缓冲区, 线程绑定CPU后缓冲区基本都是本地内存。
+*/
+class buffer_pool
+{
+public:
+    static const int MIN_SHIFT = 9;                                           // 最小的级别为512字节
+    static const int CLASSES = 8;                                             // 级别数量
+    static const size_t MAX_SIZE = (size_t)1 << (MIN_SHIFT + CLASSES - 1);    // 能分配的最大缓冲区(64KB)
+    static const size_t SLAB_SIZE = 64 * 1024;                                // 每次向系统申请的内存大小
+    static const int BATCH = 16;                                              // 线程缓存与全局链表一次交换的缓冲区数量
+
+    buffer_pool();
+    ~buffer_pool();
+
+    char *alloc(size_t size, size_t &capacity); // 分配至少size字节, 实际容量通过capacity返回, 超过MAX_SIZE时返回NULL
+    void free(char *buf, size_t size);          // 归还alloc得到的缓冲区, size是分配时请求的大小或者返回的容量
+
+    size_t slab_bytes() const { return m_slab_bytes.load(std::memory_order_relaxed); } // 从系统申请的总字节数
+    size_t used_bytes() const { return m_used_bytes.load(std::memory_order_relaxed); } // 正在使用的字节数
+
+private:
+    struct free_node
+    {
+        free_node *next;
+    };
+
+    struct local_cache // 每个线程的空闲缓冲区
+    {
+        free_node *head[CLASSES];
+        int count[CLASSES];
+        int node;   // 线程所在的NUMA节点
+        bool ready; // node是否已经确定
+    };
+
+    static int size_class(size_t size);
+    static local_cache &cache();
+    void refill(local_cache &lc, int cls); // 从全局链表或新的slab中取一批缓冲区
+    void spill(local_cache &lc, int cls);  // 把一半线程缓存归还给全局链表
+
+private:
+    locker m_lock[cpu_topology::MAX_NODES][CLASSES];     // 保护每个节点每个级别的全局空闲链表
+    free_node *m_free[cpu_topology::MAX_NODES][CLASSES]; // 全局空闲链表
+    locker m_slab_lock;                    // 保护m_slabs
+    std::vector<char *> m_slabs;           // 所有slab, 析构时释放
+    std::atomic<size_t> m_slab_bytes;
+    std::atomic<size_t> m_used_bytes;
+};
+
+#endif
@@ -0,0 +1,385 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include "config.h"
+#include "http_conn.h"
+#include "reactor.h"
+#include "overload.h"
+#include "logger.h"
+#include "cpu_topology.h"
+
+extern const char *doc_root;
+
+static const int AUTO_MAX_FD = 262144; // 自动检测时最大文件描述符数的上限, 连接数组按它预先分配
+
+namespace
+{
+    struct int_option
+    {
+        const char *key;
+        int server_config::*field;
+        int min;
+        int max;
+        const char *help;
+    };
+
+    struct bool_option
+    {
+        const char *key;
+        bool server_config::*field;
+        const char *help;
+    };
+
+    struct string_option
+    {
+        const char *key;
+        std::string server_config::*field;
+        const char *help;
+    };
+
+    const int MAX_WRITE_BUFFER = (int)(buffer_pool::MAX_SIZE - sizeof(http_conn::write_block)); // 写缓冲区和发送状态在同一块缓冲区中
+
+    const int_option int_options[] = {
+        {"port", &server_config::port, 1, 65535, "监听端口"},
+        {"reactors", &server_config::reactors, 0, 1024, "事件循环线程数, 0为单epoll+线程池模式"},
+        {"threads", &server_config::threads, 0, 1024, "线程池的工作线程数, 0为在线CPU个数"},
+        {"cache_mb", &server_config::cache_mb, 0, 1 << 20, "热点文件缓存的大小(MB), 0为不缓存"},
+        {"mmap_max_mb", &server_config::mmap_max_mb, 0, 1 << 20, "大于它的文件用sendfile按偏移分段发送, 不整个映射(MB)"},
+        {"max_body_mb", &server_config::max_body_mb, 0, 1 << 20, "请求体的最大长度(MB)"},
+        {"backlog", &server_config::backlog, 1, INT_MAX, "监听套接字的连接等待队列长度"},
+        {"max_fd", &server_config::max_fd, 0, 1 << 24, "最大的文件描述符个数, 0为RLIMIT_NOFILE的硬限制"},
+        {"max_conn", &server_config::max_conn, 0, 1 << 24, "最大连接数, 0为等于max_fd"},
+        {"max_queue", &server_config::max_queue, 1, 1 << 24, "线程池中等待处理的最大请求数"},
+        {"max_delay_ms", &server_config::max_delay_ms, 0, 3600 * 1000, "请求的平均排队时间上限(毫秒), 0为不限制"},
+        {"retry_after", &server_config::retry_after, 0, 86400, "503响应的Retry-After(秒)"},
+        {"max_events", &server_config::max_events, 1, 1 << 20, "每次epoll_wait最多返回的事件数"},
+        {"read_buffer", &server_config::read_buffer, 512, (int)buffer_pool::MAX_SIZE, "读缓冲区的初始大小"},
+        {"max_read_buffer", &server_config::max_read_buffer, 512, (int)buffer_pool::MAX_SIZE, "读缓冲区的最大大小"},
+        {"write_buffer", &server_config::write_buffer, 1024, MAX_WRITE_BUFFER, "每批响应的写缓冲区大小"},
+        {"keep_alive_timeout", &server_config::idle_timeout, 1, 86400, "空闲长连接的超时时间(秒)"},
+        {"header_timeout", &server_config::header_timeout, 1, 86400, "接收完请求头的超时时间(秒)"},
+        {"body_timeout", &server_config::body_timeout, 1, 86400, "请求体或响应两次进展之间的超时时间(秒)"},
+        {"drain_timeout", &server_config::drain_timeout, 0, 86400, "优雅退出时等待已有连接完成的最长时间(秒)"},
+    };
+
+    const bool_option bool_options[] = {
+        {"work_stealing", &server_config::work_stealing, "线程池使用工作窃取模式"},
+        {"sendfile", &server_config::sendfile, "使用sendfile发送文件"},
+        {"precompressed", &server_config::precompressed, "客户端接受压缩时发送预先压缩好的同名.br/.gz文件"},
+    };
+
+    const string_option string_options[] = {
+        {"doc_root", &server_config::doc_root, "网站的资源目录"},
+        {"access_log", &server_config::access_log, "访问日志文件, 为空时不记录"},
+        {"cache_control", &server_config::cache_control, "文件响应的Cache-Control, 为空时不发送"},
+        {"upload_dir", &server_config::upload_dir, "POST/PUT上传文件保存的目录, 为空时不接受上传"},
+        {"cpu_affinity", &server_config::cpu_affinity, "线程绑定CPU的策略 (none/compact/scatter/CPU列表如0-3,8)"},
+    };
+
+    template <typename T, size_t N>
+    size_t count_of(const T (&)[N])
+    {
+        return N;
+    }
+
+    bool parse_int(const char *value, long &out)
+    {
+        char *end;
+        errno = 0;
+        out = strtol(value, &end, 10);
+        return errno == 0 && end != value && *end == '\0';
+    }
+
+    bool parse_bool(const char *value, bool &out)
+    {
+        if (!strcasecmp(value, "on") || !strcasecmp(value, "true") || !strcasecmp(value, "yes") || !strcmp(value, "1"))
+        {
+            out = true;
+            return true;
+        }
+        if (!strcasecmp(value, "off") || !strcasecmp(value, "false") || !strcasecmp(value, "no") || !strcmp(value, "0"))
+        {
+            out = false;
+            return true;
+        }
+        return false;
+    }
+
+    char *trim(char *s)
+    {
+        while (*s == ' ' || *s == '\t')
+        {
+            ++s;
+        }
+        char *end = s + strlen(s);
+        while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n'))
+        {
+            *--end = '\0';
+        }
+        return s;
+    }
+}
+
+const char *const server_config::backend_names[] = {"epoll", "io_uring", "coroutine"};
+
+server_config::server_config()
+    : port(0), doc_root("resources"), reactors(0), threads(0), work_stealing(false),
+      backend(BACKEND_EPOLL), sendfile(false), precompressed(true), cache_mb(0), mmap_max_mb(64), max_body_mb(16), backlog(SOMAXCONN), max_fd(0), max_conn(0), max_queue(10000),
+      max_delay_ms(0), retry_after(1), max_events(10000), read_buffer(2048), max_read_buffer(64 * 1024),
+      write_buffer(2048), idle_timeout(60), header_timeout(10), body_timeout(30), drain_timeout(30),
+      cache_control("no-cache"), cpu_affinity("none")
+{
+}
+
+bool server_config::set(const char *key, const char *value)
+{
+    for (size_t i = 0; i < count_of(int_options); ++i)
+    {
+        const int_option &opt = int_options[i];
+        if (strcmp(key, opt.key) == 0)
+        {
+            long n;
+            if (!parse_int(value, n) || n < opt.min || n > opt.max)
+            {
+                LOG_ERROR("config: %s must be an integer in [%d, %d], got \"%s\"", key, opt.min, opt.max, value);
+                return false;
+            }
+            this->*opt.field = (int)n;
+            return true;
+        }
+    }
+    for (size_t i = 0; i < count_of(bool_options); ++i)
+    {
+        const bool_option &opt = bool_options[i];
+        if (strcmp(key, opt.key) == 0)
+        {
+            if (!parse_bool(value, this->*opt.field))
+            {
+                LOG_ERROR("config: %s must be on or off, got \"%s\"", key, value);
+                return false;
+            }
+            return true;
+        }
+    }
+    for (size_t i = 0; i < count_of(string_options); ++i)
+    {
+        const string_option &opt = string_options[i];
+        if (strcmp(key, opt.key) == 0)
+        {
+            this->*opt.field = value;
+            return true;
+        }
+    }
+    if (strcmp(key, "backend") == 0)
+    {
+        for (size_t i = 0; i < count_of(backend_names); ++i)
+        {
+            if (strcmp(value, backend_names[i]) == 0)
+            {
+                backend = (BACKEND)i;
+                return true;
+            }
+        }
+        LOG_ERROR("config: backend must be epoll, io_uring or coroutine, got \"%s\"", value);
+        return false;
+    }
+    LOG_ERROR("config: unknown key \"%s\"", key);
+    return false;
+}
+
+bool server_config::load(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        LOG_ERROR("config: cannot open %s: %s", path, strerror(errno));
+        return false;
+    }
+    char line[1024];
+    int lineno = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fp))
+    {
+        ++lineno;
+        char *hash = strchr(line, '#');
+        if (hash)
+        {
+            *hash = '\0';
+        }
+        char *text = trim(line);
+        if (*text == '\0')
+        {
+            continue;
+        }
+        char *eq = strchr(text, '=');
+        if (!eq)
+        {
+            LOG_ERROR("config: %s:%d: expected key = value", path, lineno);
+            ok = false;
+            break;
+        }
+        *eq = '\0';
+        if (!set(trim(text), trim(eq + 1)))
+        {
+            LOG_ERROR("config: %s:%d: invalid setting", path, lineno);
+            ok = false;
+        }
+    }
+    fclose(fp);
+    return ok;
+}
+
+/*
+    max_fd为0时取RLIMIT_NOFILE的硬限制(不超过AUTO_MAX_FD); 无论自动还是指定,
+    都把软限制提高到max_fd, 硬限制不够时报错, 避免运行中accept因为EMFILE失败
+*/
+static bool reserve_fds(int &max_fd)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+    {
+        LOG_ERROR("config: getrlimit: %s", strerror(errno));
+        return false;
+    }
+    if (max_fd == 0)
+    {
+        max_fd = rl.rlim_max == RLIM_INFINITY || rl.rlim_max > (rlim_t)AUTO_MAX_FD ? AUTO_MAX_FD : (int)rl.rlim_max;
+    }
+    if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < (rlim_t)max_fd)
+    {
+        if (rl.rlim_max != RLIM_INFINITY && rl.rlim_max < (rlim_t)max_fd)
+        {
+            LOG_ERROR("config: max_fd %d exceeds the RLIMIT_NOFILE hard limit %lu", max_fd,
+                      (unsigned long)rl.rlim_max);
+            return false;
+        }
+        rl.rlim_cur = max_fd;
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+        {
+            LOG_ERROR("config: cannot raise RLIMIT_NOFILE to %d: %s", max_fd, strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+bool server_config::validate()
+{
+    if (cache_control.size() > 128 || cache_control.find_first_of("\r\n") != std::string::npos)
+    {
+        LOG_ERROR("config: cache_control must be a single line of at most 128 characters");
+        return false;
+    }
+    if (!cpu_topology::check(cpu_affinity))
+    {
+        LOG_ERROR("config: cpu_affinity must be none, compact, scatter or a list of usable CPUs, got \"%s\"",
+                  cpu_affinity.c_str());
+        return false;
+    }
+    if (port == 0)
+    {
+        LOG_ERROR("config: port is not set");
+        return false;
+    }
+    if (threads == 0)
+    {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = n > 0 ? (int)n : 1;
+    }
+    if (!reserve_fds(max_fd))
+    {
+        return false;
+    }
+    if (max_conn == 0)
+    {
+        max_conn = max_fd;
+    }
+    if (max_conn > max_fd)
+    {
+        LOG_ERROR("config: max_conn %d exceeds max_fd %d", max_conn, max_fd);
+        return false;
+    }
+    if (read_buffer > max_read_buffer)
+    {
+        LOG_ERROR("config: read_buffer %d exceeds max_read_buffer %d", read_buffer, max_read_buffer);
+        return false;
+    }
+
+    char resolved[PATH_MAX]; // 文件缓存以完整路径为键, 这里统一成规范化的绝对路径
+    struct stat st;
+    if (!realpath(doc_root.c_str(), resolved) || stat(resolved, &st) < 0 || !S_ISDIR(st.st_mode))
+    {
+        LOG_ERROR("config: doc_root %s is not a directory", doc_root.c_str());
+        return false;
+    }
+    if (strlen(resolved) >= (size_t)http_conn::FILENAME_LEN / 2) // 至少给URL留一半的空间
+    {
+        LOG_ERROR("config: doc_root %s is longer than %d bytes", resolved, http_conn::FILENAME_LEN / 2 - 1);
+        return false;
+    }
+    doc_root = resolved;
+
+    if (!upload_dir.empty()) // 上传的临时文件用O_TMPFILE创建在这个目录中, 目录必须可写
+    {
+        if (!realpath(upload_dir.c_str(), resolved) || stat(resolved, &st) < 0 || !S_ISDIR(st.st_mode) ||
+            access(resolved, W_OK) < 0)
+        {
+            LOG_ERROR("config: upload_dir %s is not a writable directory", upload_dir.c_str());
+            return false;
+        }
+        if (strlen(resolved) >= (size_t)http_conn::FILENAME_LEN / 2)
+        {
+            LOG_ERROR("config: upload_dir %s is longer than %d bytes", resolved, http_conn::FILENAME_LEN / 2 - 1);
+            return false;
+        }
+        upload_dir = resolved;
+    }
+    return true;
+}
+
+void server_config::apply() const
+{
+    ::doc_root = doc_root.c_str();
+    http_conn::m_use_sendfile = sendfile;
+    http_conn::m_mmap_max = (off_t)mmap_max_mb << 20;
+    http_conn::m_precompressed = precompressed;
+    http_conn::m_cache_control = cache_control.empty() ? "" : "Cache-Control: " + cache_control + "\r\n";
+    http_conn::m_upload_dir = upload_dir;
+    http_conn::m_max_body = (off_t)max_body_mb << 20;
+    http_conn::m_idle_timeout = idle_timeout;
+    http_conn::m_header_timeout = header_timeout;
+    http_conn::m_body_timeout = body_timeout;
+    http_conn::m_read_buffer_size = read_buffer;
+    http_conn::m_max_read_buffer_size = max_read_buffer;
+    http_conn::m_write_buffer_size = write_buffer;
+    overload_control::m_max_conn = max_conn;
+    overload_control::m_max_queue = max_queue;
+    overload_control::m_max_delay_ms = max_delay_ms;
+    overload_control::m_retry_after = retry_after;
+    reactor::m_max_events = max_events;
+}
+
+void server_config::usage(FILE *out)
+{
+    for (size_t i = 0; i < count_of(int_options); ++i)
+    {
+        fprintf(out, "    %-20s %s [%d, %d]\n", int_options[i].key, int_options[i].help, int_options[i].min,
+                int_options[i].max);
+    }
+    for (size_t i = 0; i < count_of(bool_options); ++i)
+    {
+        fprintf(out, "    %-20s %s (on/off)\n", bool_options[i].key, bool_options[i].help);
+    }
+    for (size_t i = 0; i < count_of(string_options); ++i)
+    {
+        fprintf(out, "    %-20s %s\n", string_options[i].key, string_options[i].help);
+    }
+    fprintf(out, "    %-20s I/O后端 (epoll/io_uring/coroutine), io_uring需要6.0以上的内核, coroutine需要用-std=c++20编译,\n"
+                 "    %-20s 不满足时启动日志中打印一条警告并退回epoll(C++11构建中coroutine不起作用)\n", "backend", "");
+}
@@ -0,0 +1,63 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <cstdio>
+#include <string>
+
+/*
+    服务器的运行参数。启动时依次从默认值、配置文件(-f)和命令行得到, 后面的覆盖前面的。
+    配置文件每行一个"key = value", '#'开始的是注释; 命令行除了原有的短选项,
+    还可以用"-o key=value"设置任意一项。数值为0的几项(threads/max_fd/max_conn)表示自动检测:
+    工作线程数取在线CPU个数, 最大文件描述符数取RLIMIT_NOFILE的硬限制(并把软限制提高到它),
+    最大连接数等于最大文件描述符数。validate在启动时检查所有参数并解析自动值, apply把它们写入各个模块
+*/
+struct server_config
+{
+    enum BACKEND // I/O后端
+    {
+        BACKEND_EPOLL = 0, // epoll就绪通知, 支持线程池模式和多reactor模式
+        BACKEND_URING,     // io_uring直接提交I/O请求(多reactor模式)
+        BACKEND_CORO       // epoll就绪通知, 每个连接一个C++20协程(多reactor模式)
+    };
+    static const char *const backend_names[]; // 以BACKEND为下标的名字
+
+    int port;              // 监听端口
+    std::string doc_root;  // 网站的资源目录, validate后是规范化的绝对路径
+    int reactors;          // 事件循环线程数, 0表示单epoll+线程池模式
+    int threads;           // 线程池的工作线程数
+    bool work_stealing;    // 线程池是否使用工作窃取模式
+    BACKEND backend;       // I/O后端
+    bool sendfile;         // 是否使用sendfile发送文件
+    bool precompressed;    // 客户端接受压缩时是否发送预先压缩好的.br/.gz文件
+    int cache_mb;          // 热点文件缓存的大小(MB), 0表示不缓存
+    int mmap_max_mb;       // 大于它的文件不整个映射, 用sendfile按偏移分段发送(MB)
+    int max_body_mb;       // 请求体的最大长度(MB)
+    int backlog;           // 监听套接字的连接等待队列长度
+    int max_fd;            // 最大的文件描述符个数(连接数组的大小)
+    int max_conn;          // 同时处理的最大连接数
+    int max_queue;         // 线程池中等待处理的最大请求数
+    int max_delay_ms;      // 请求在队列中的平均等待时间上限(毫秒), 0表示不限制
+    int retry_after;       // 503响应中建议客户端重试的秒数
+    int max_events;        // 每次epoll_wait最多返回的事件数
+    int read_buffer;       // 读缓冲区的初始大小
+    int max_read_buffer;   // 读缓冲区最多增长到的大小
+    int write_buffer;      // 每批响应的写缓冲区大小
+    int idle_timeout;      // 空闲长连接的超时时间(秒)
+    int header_timeout;    // 接收完请求头的超时时间(秒)
+    int body_timeout;      // 接收请求体或发送响应时两次进展之间的超时时间(秒)
+    int drain_timeout;     // 优雅退出时等待已有连接完成的最长时间(秒)
+    std::string access_log; // 访问日志文件, 为空时不记录
+    std::string cache_control; // 文件响应的Cache-Control, 为空时不发送
+    std::string upload_dir; // POST/PUT上传文件保存的目录, 为空时不接受上传; validate后是规范化的绝对路径
+    std::string cpu_affinity; // 事件循环线程和工作线程绑定CPU的策略: none/compact/scatter或CPU列表, 见cpu_topology
+
+    server_config();
+
+    bool load(const char *path);                    // 读取配置文件, 出错时输出文件名和行号并返回false
+    bool set(const char *key, const char *value);   // 设置一项, 名字未知或者值不合法时返回false
+    bool validate();                                // 检查参数之间的关系并解析自动值
+    void apply() const;                             // 把参数写入http_conn/overload_control/reactor的静态成员
+    static void usage(FILE *out);                   // 输出所有配置项的名字、取值范围和说明
+};
+
+#endif
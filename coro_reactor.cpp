@@ -0,0 +1,326 @@
+#include <sys/timerfd.h>
+#include <string.h>
+#include <errno.h>
+#include "coro_reactor.h"
+#include "reactor.h"
+#include "syscall_stats.h"
+#include "overload.h"
+#include "logger.h"
+
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<coroutine>)
+#define HAVE_COROUTINES 1
+#endif
+#endif
+
+extern void addfd(int epollfd, int fd, bool one_shot); // 添加文件描述符到epoll实例中
+
+#ifdef HAVE_COROUTINES
+
+#include <coroutine>
+#include <exception>
+
+/*
+    连接协程的返回类型。协程创建后立即运行到第一次挂起, 结束时自动释放协程帧,
+    除了reactor记录的挂起点之外没有别的地方持有协程, 所以不需要保存返回的对象
+*/
+struct coro_task
+{
+    struct promise_type
+    {
+        coro_task get_return_object() { return coro_task(); }
+        std::suspend_never initial_suspend() noexcept { return std::suspend_never(); }
+        std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); } // 处理请求的代码不抛出异常
+    };
+};
+
+struct coro_reactor::readiness
+{
+    coro_reactor *r;
+    int fd;
+    uint32_t want;
+
+    static const uint32_t FAILURE = EPOLLERR | EPOLLHUP | EPOLLRDHUP; // 出错或者对方关闭, 协程恢复后关闭连接
+
+    bool await_ready() const { return r->m_slots[fd].ready & (want | FAILURE); }
+
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        r->m_slots[fd].waiter = h.address();
+        r->m_slots[fd].want = want;
+    }
+
+    bool await_resume() const { return !(r->m_slots[fd].ready & FAILURE); } // 返回false表示需要关闭连接
+};
+
+bool coro_reactor::supported()
+{
+    return true;
+}
+
+coro_reactor::coro_reactor(int listenfd, http_conn *users, int max_fd)
+    : m_listenfd(listenfd), m_users(users), m_slots(nullptr), m_max_fd(max_fd), m_events(nullptr),
+      m_drain_due(false), m_drain_all(false)
+{
+    m_epollfd = epoll_create(5);
+    if (m_epollfd < 0)
+    {
+        throw exception();
+    }
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerfd < 0)
+    {
+        close(m_epollfd);
+        throw exception();
+    }
+    m_events = new epoll_event[reactor::m_max_events];
+    m_slots = new coro_slot[max_fd];
+    memset(m_slots, 0, sizeof(coro_slot) * max_fd);
+
+    epoll_event event;
+    event.data.fd = m_listenfd;
+    event.events = EPOLLIN | EPOLLET;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_listenfd, &event);
+
+    struct itimerspec its;
+    bzero(&its, sizeof(its));
+    its.it_value.tv_sec = TIMESLOT;
+    its.it_interval.tv_sec = TIMESLOT;
+    timerfd_settime(m_timerfd, 0, &its, NULL);
+    addfd(m_epollfd, m_timerfd, false);
+}
+
+coro_reactor::~coro_reactor()
+{
+    if (m_listenfd != -1)
+    {
+        close(m_listenfd);
+    }
+    close(m_timerfd);
+    close(m_epollfd);
+    delete[] m_events;
+    delete[] m_slots;
+}
+
+void coro_reactor::loop()
+{
+    while (!io_loop::draining() || m_listenfd != -1 || m_timers.size() > 0) // 优雅退出时等所有连接关闭
+    {
+        int number = epoll_wait(m_epollfd, m_events, reactor::m_max_events, -1);
+        syscall_stats::count(syscall_stats::SC_EPOLL_WAIT);
+        if (number < 0 && errno != EINTR)
+        {
+            LOG_ERROR("epoll failure: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < number; i++)
+        {
+            int sockfd = m_events[i].data.fd;
+            if (sockfd == m_listenfd)
+            {
+                handle_accept();
+            }
+            else if (sockfd == m_timerfd)
+            {
+                handle_timer();
+            }
+            else
+            {
+                wake(sockfd, m_events[i].events);
+            }
+        }
+        if (m_drain_due)
+        {
+            m_drain_due = false;
+            drain();
+        }
+    }
+}
+
+coro_reactor::readiness coro_reactor::wait(int fd, uint32_t events)
+{
+    readiness r = {this, fd, events};
+    return r;
+}
+
+void coro_reactor::wake(int fd, uint32_t events)
+{
+    coro_slot &slot = m_slots[fd];
+    slot.ready |= events;
+    if (slot.waiter && (slot.ready & (slot.want | readiness::FAILURE)))
+    {
+        std::coroutine_handle<> h = std::coroutine_handle<>::from_address(slot.waiter);
+        slot.waiter = NULL;
+        h.resume();
+    }
+}
+
+/*
+    一个连接从接受到关闭的全过程。read和flush都进行到EAGAIN为止, 之后清掉对应的就绪标志,
+    下一次状态变化一定会产生新的边沿事件。发送期间到达的请求留在socket中, 发完这一批再读,
+    读缓冲区中剩下的流水线请求在每一批发完后接着处理
+*/
+coro_task coro_reactor::serve(http_conn *conn)
+{
+    int fd = conn->sockfd();
+    coro_slot &slot = m_slots[fd];
+    while (co_await wait(fd, EPOLLIN))
+    {
+        if (!conn->read())
+        {
+            break;
+        }
+        slot.ready &= ~EPOLLIN;
+        refresh_timer(conn);
+
+        bool ok = conn->process_batch();
+        while (ok && conn->has_output())
+        {
+            bool blocked;
+            ok = conn->flush(blocked);
+            if (ok && blocked) // TCP写缓冲满, 等待EPOLLOUT
+            {
+                slot.ready &= ~EPOLLOUT;
+                refresh_timer(conn);
+                ok = co_await wait(fd, EPOLLOUT);
+            }
+            else if (ok && !conn->has_output()) // 这一批发完了, 处理读缓冲区中剩下的请求
+            {
+                ok = conn->process_batch();
+            }
+        }
+        if (!ok)
+        {
+            break;
+        }
+        refresh_timer(conn);
+    }
+    close_conn(conn); // 协程正在运行, 不会被销毁
+}
+
+void coro_reactor::handle_accept()
+{
+    while (true)
+    {
+        struct sockaddr_in client_address;
+        socklen_t client_addrlength = sizeof(client_address);
+        int connfd = accept4(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
+        syscall_stats::count(syscall_stats::SC_ACCEPT);
+        if (connfd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                LOG_WARN("accept failure: %s", strerror(errno));
+            }
+            return;
+        }
+        if (http_conn::m_user_count >= overload_control::m_max_conn || connfd >= m_max_fd) // 连接数达到上限
+        {
+            overload_control::reject(connfd, false);
+            close(connfd);
+            continue;
+        }
+        http_conn *conn = m_users + connfd;
+        conn->init(connfd, client_address, m_epollfd, true);
+        memset(&m_slots[connfd], 0, sizeof(coro_slot));
+        refresh_timer(conn);
+        serve(conn); // 运行到第一次等待EPOLLIN时返回
+    }
+}
+
+void coro_reactor::handle_timer()
+{
+    uint64_t expirations = 0;
+    syscall_stats::count(syscall_stats::SC_OTHER);
+    if (::read(m_timerfd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    {
+        return;
+    }
+    while (expirations--)
+    {
+        m_timers.tick(cb_func, this);
+    }
+    m_drain_due = io_loop::draining();
+}
+
+void coro_reactor::refresh_timer(http_conn *conn)
+{
+    int timeout = conn->timer_timeout();
+    if (timeout > 0)
+    {
+        m_timers.adjust_timer(conn->timer(), (timeout + TIMESLOT - 1) / TIMESLOT);
+    }
+}
+
+void coro_reactor::close_conn(http_conn *conn)
+{
+    coro_slot &slot = m_slots[conn->sockfd()];
+    if (slot.waiter) // 定时器或者优雅退出关闭的连接, 协程挂起在某个co_await上
+    {
+        std::coroutine_handle<>::from_address(slot.waiter).destroy();
+    }
+    memset(&slot, 0, sizeof(slot));
+    m_timers.del_timer(conn->timer());
+    conn->close_conn();
+}
+
+void coro_reactor::drain()
+{
+    if (m_listenfd != -1)
+    {
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, NULL);
+        close(m_listenfd);
+        syscall_stats::count(syscall_stats::SC_CLOSE);
+        m_listenfd = -1;
+    }
+    m_drain_all = io_loop::drain_expired();
+    m_timers.for_each(drain_func, this);
+}
+
+void coro_reactor::drain_func(wheel_timer *timer, void *arg)
+{
+    coro_reactor *r = (coro_reactor *)arg;
+    http_conn *conn = (http_conn *)timer->user_data;
+    if (r->m_drain_all || conn->is_idle())
+    {
+        r->close_conn(conn);
+    }
+}
+
+void coro_reactor::cb_func(wheel_timer *timer, void *arg) // 关闭超时的连接
+{
+    coro_reactor *r = (coro_reactor *)arg;
+    r->close_conn((http_conn *)timer->user_data);
+}
+
+#else // 没有协程支持时只提供接口, supported()返回false, 启动时不会创建这个类的对象
+
+bool coro_reactor::supported()
+{
+    return false;
+}
+
+coro_reactor::coro_reactor(int listenfd, http_conn *users, int max_fd)
+    : m_epollfd(-1), m_listenfd(listenfd), m_timerfd(-1), m_users(users), m_slots(nullptr), m_max_fd(max_fd),
+      m_events(nullptr), m_drain_due(false), m_drain_all(false)
+{
+    throw exception();
+}
+
+coro_reactor::~coro_reactor()
+{
+}
+
+void coro_reactor::loop()
+{
+}
+
+#endif
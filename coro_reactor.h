@@ -0,0 +1,68 @@
+#ifndef CORO_REACTOR_H
+#define CORO_REACTOR_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include "http_conn.h"
+#include "timer_wheel.h"
+#include "io_loop.h"
+
+struct coro_task; // 连接协程的返回类型, 只在coro_reactor.cpp中定义
+
+/*
+    基于C++20协程的事件循环, 与多reactor模式的reactor一样每个线程一个实例、各自通过SO_REUSEPORT监听同一端口,
+    连接以边沿触发方式注册EPOLLIN|EPOLLOUT。每个连接是一个协程, 读请求、解析、发送响应、等下一个请求
+    按顺序写成一个循环, 读写到EAGAIN时co_await挂起, 事件到来时由本reactor恢复, 不用在回调之间传递进度。
+    协程只在所属的reactor线程上运行, 没有线程之间的交接; 超时和优雅退出时由reactor销毁挂起的协程。
+    需要用C++20(-std=c++20)编译, 否则supported()返回false, 启动时打印一条警告后退回epoll后端。
+    系统调用与多reactor的epoll后端完全一样(长连接下每个请求两次read一次write), 恢复协程的开销与回调相当,
+    所以吞吐量没有提高(bench/keepalive_bench的结果在误差范围内); 保留它是因为一个连接的处理流程写在一处,
+    新增要跨多次读写的逻辑(例如100-continue、边收边写的请求体)时不需要再拆成回调之间传递的状态
+*/
+class coro_reactor : public io_loop
+{
+public:
+    static const int TIMESLOT = 1; // 时间轮一个tick的长度(秒)
+
+    static bool supported(); // 编译时是否启用了协程
+
+    coro_reactor(int listenfd, http_conn *users, int max_fd);
+    ~coro_reactor();
+
+    void loop(); // 在当前线程中运行事件循环, 优雅退出完成后返回
+
+private:
+    struct readiness; // co_await的对象, 等待连接上的事件
+
+    struct coro_slot // 连接在本reactor上的协程状态
+    {
+        void *waiter;   // 挂起等待事件的协程(coroutine_handle的地址), 为空表示协程正在运行或者已经结束
+        uint32_t want;  // 协程等待的事件
+        uint32_t ready; // 边沿触发收到后还没有读写到EAGAIN的事件
+    };
+
+    coro_task serve(http_conn *conn);       // 连接的协程, 连接关闭时结束
+    readiness wait(int fd, uint32_t events); // 事件已经就绪时不挂起
+    void wake(int fd, uint32_t events);     // 记录收到的事件, 协程在等待它时恢复协程
+    void handle_accept();
+    void handle_timer();
+    void refresh_timer(http_conn *conn);
+    void close_conn(http_conn *conn); // 销毁挂起的协程, 删除定时器并关闭连接
+    void drain();                     // 优雅退出: 关闭监听套接字和空闲的连接, 期限到了关闭所有连接
+    static void cb_func(wheel_timer *timer, void *arg);    // 定时器回调函数
+    static void drain_func(wheel_timer *timer, void *arg); // 优雅退出时对每个连接调用
+
+private:
+    int m_epollfd;
+    int m_listenfd;        // 该reactor的监听文件描述符, 由reactor关闭, 优雅退出开始后为-1
+    int m_timerfd;         // 驱动时间轮的timerfd
+    timer_wheel m_timers;  // 该reactor上所有连接的超时定时器
+    http_conn *m_users;    // 任务对象数组(以文件描述符为下标, 所有reactor共享)
+    coro_slot *m_slots;    // 连接在本reactor上的协程状态, 以文件描述符为下标
+    int m_max_fd;
+    epoll_event *m_events; // 事件数组
+    bool m_drain_due;      // 优雅退出期间每个tick在处理完这一批事件后检查一次连接
+    bool m_drain_all;      // 优雅退出的期限已到, 不论是否空闲都关闭
+};
+
+#endif
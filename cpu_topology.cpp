@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include "cpu_topology.h"
+
+#ifndef MPOL_PREFERRED // <numaif.h>属于libnuma, 这里只需要两个常量
+#define MPOL_PREFERRED 1
+#define MPOL_INTERLEAVE 3
+#endif
+
+std::vector<cpu_topology::cpu_info> cpu_topology::s_cpus;
+std::vector<int> cpu_topology::s_node_of;
+int cpu_topology::s_node_count = 1;
+
+static int read_int(const char *path, int fallback)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        return fallback;
+    }
+    int value;
+    if (fscanf(fp, "%d", &value) != 1)
+    {
+        value = fallback;
+    }
+    fclose(fp);
+    return value;
+}
+
+bool cpu_topology::parse_list(const char *text, std::vector<int> &cpus) // 解析"0-3,8,10-11"格式的CPU列表
+{
+    const char *p = text;
+    while (true)
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE)
+        {
+            return false;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first || last >= CPU_SETSIZE)
+            {
+                return false;
+            }
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; ++cpu)
+        {
+            cpus.push_back((int)cpu);
+        }
+        if (*p != ',')
+        {
+            return *p == '\0' || *p == '\n';
+        }
+        ++p;
+    }
+}
+
+bool cpu_topology::by_placement(const cpu_info &a, const cpu_info &b)
+{
+    if (a.node != b.node)
+    {
+        return a.node < b.node;
+    }
+    return a.core != b.core ? a.core < b.core : a.cpu < b.cpu;
+}
+
+bool cpu_topology::by_sibling(const cpu_info &a, const cpu_info &b)
+{
+    return a.sibling < b.sibling;
+}
+
+void cpu_topology::init()
+{
+    s_node_of.assign(CPU_SETSIZE, 0);
+    s_node_count = 1;
+    DIR *dir = opendir("/sys/devices/system/node");
+    if (dir) // 没有这个目录的内核(未开启NUMA)把所有CPU看成一个节点
+    {
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL)
+        {
+            int node;
+            if (sscanf(ent->d_name, "node%d", &node) != 1 || node < 0)
+            {
+                continue;
+            }
+            char path[256], list[4096];
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+            FILE *fp = fopen(path, "r");
+            if (!fp)
+            {
+                continue;
+            }
+            std::vector<int> cpus;
+            if (fgets(list, sizeof(list), fp) && parse_list(list, cpus))
+            {
+                for (size_t i = 0; i < cpus.size(); ++i)
+                {
+                    s_node_of[cpus[i]] = node % MAX_NODES;
+                }
+                s_node_count = std::max(s_node_count, std::min(node + 1, (int)MAX_NODES));
+            }
+            fclose(fp);
+        }
+        closedir(dir);
+    }
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+    {
+        for (long i = 0; i < sysconf(_SC_NPROCESSORS_ONLN) && i < CPU_SETSIZE; ++i)
+        {
+            CPU_SET(i, &allowed);
+        }
+    }
+    s_cpus.clear();
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (!CPU_ISSET(cpu, &allowed))
+        {
+            continue;
+        }
+        char path[256];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        int package = read_int(path, 0);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        int core = read_int(path, cpu);
+        cpu_info info = {cpu, s_node_of[cpu], (package << 16) | (core & 0xffff), 0};
+        s_cpus.push_back(info);
+    }
+    std::sort(s_cpus.begin(), s_cpus.end(), by_placement);
+    for (size_t i = 1; i < s_cpus.size(); ++i)
+    {
+        if (s_cpus[i].node == s_cpus[i - 1].node && s_cpus[i].core == s_cpus[i - 1].core)
+        {
+            s_cpus[i].sibling = s_cpus[i - 1].sibling + 1;
+        }
+    }
+}
+
+int cpu_topology::node_of(int cpu)
+{
+    return cpu >= 0 && cpu < (int)s_node_of.size() ? s_node_of[cpu] : 0;
+}
+
+int cpu_topology::current_node()
+{
+    return s_node_count > 1 ? node_of(sched_getcpu()) : 0;
+}
+
+bool cpu_topology::check(const std::string &policy)
+{
+    if (policy == "none" || policy == "compact" || policy == "scatter")
+    {
+        return true;
+    }
+    std::vector<int> cpus;
+    if (!parse_list(policy.c_str(), cpus))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < cpus.size(); ++i)
+    {
+        bool found = false;
+        for (size_t j = 0; j < s_cpus.size() && !found; ++j)
+        {
+            found = s_cpus[j].cpu == cpus[i];
+        }
+        if (!found)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<int> cpu_topology::plan(const std::string &policy, int count)
+{
+    std::vector<int> order;
+    if (policy == "compact")
+    {
+        for (size_t i = 0; i < s_cpus.size(); ++i)
+        {
+            order.push_back(s_cpus[i].cpu);
+        }
+    }
+    else if (policy == "scatter") // 每个节点内先排每个物理核的第一个CPU, 再在节点之间轮流取
+    {
+        std::vector<std::vector<cpu_info> > nodes(s_node_count);
+        for (size_t i = 0; i < s_cpus.size(); ++i)
+        {
+            nodes[s_cpus[i].node].push_back(s_cpus[i]);
+        }
+        size_t longest = 0;
+        for (size_t n = 0; n < nodes.size(); ++n)
+        {
+            std::stable_sort(nodes[n].begin(), nodes[n].end(), by_sibling);
+            longest = std::max(longest, nodes[n].size());
+        }
+        for (size_t i = 0; i < longest; ++i)
+        {
+            for (size_t n = 0; n < nodes.size(); ++n)
+            {
+                if (i < nodes[n].size())
+                {
+                    order.push_back(nodes[n][i].cpu);
+                }
+            }
+        }
+    }
+    else if (policy != "none")
+    {
+        parse_list(policy.c_str(), order);
+    }
+
+    std::vector<int> cpus(count, -1);
+    for (int i = 0; i < count && !order.empty(); ++i)
+    {
+        cpus[i] = order[i % order.size()];
+    }
+    return cpus;
+}
+
+static void *map_anonymous(size_t len)
+{
+    void *addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return addr == MAP_FAILED ? NULL : addr;
+}
+
+/*
+    mbind只设置策略, 页面在第一次被访问时才按策略分配; 设置失败(比如内核没有开启NUMA)时
+    退回默认的本地优先策略, 不影响正确性
+*/
+void *cpu_topology::alloc_interleaved(size_t len)
+{
+    void *addr = map_anonymous(len);
+    if (addr && s_node_count > 1)
+    {
+        unsigned long mask = (1ul << s_node_count) - 1;
+        syscall(SYS_mbind, addr, len, MPOL_INTERLEAVE, &mask, sizeof(mask) * 8, 0);
+    }
+    return addr;
+}
+
+void *cpu_topology::alloc_on_node(size_t len, int node)
+{
+    void *addr = map_anonymous(len);
+    if (addr && s_node_count > 1)
+    {
+        unsigned long mask = 1ul << node;
+        syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+    }
+    return addr;
+}
+
+void cpu_topology::release(void *addr, size_t len)
+{
+    if (addr)
+    {
+        munmap(addr, len);
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/*
+    CPU和NUMA拓扑, 启动时从sysfs读取一次。进程允许使用的CPU(sched_getaffinity)按照
+    所在的NUMA节点、物理核排列, 据此为事件循环线程和工作线程选择CPU:
+    compact  依次占满一个节点的物理核(超线程的兄弟CPU相邻)再用下一个节点, 线程之间共享缓存
+    scatter  在节点之间轮流分配, 每个节点内先给每个物理核一个线程再使用超线程, 内存带宽和缓存最大
+    列表     如"0-3,8,10-11", 第i个线程绑定到列表中的第i个CPU(线程比CPU多时回绕)
+    不使用libnuma, 内存策略直接通过mbind系统调用设置; 单节点的机器上内存相关的函数什么都不做
+*/
+class cpu_topology
+{
+public:
+    static const int MAX_NODES = 16; // 支持的最大NUMA节点数, 更大的节点号按取模合并
+
+    static void init(); // 读取拓扑, 在创建任何线程之前调用
+
+    static int node_count() { return s_node_count; }
+    static int node_of(int cpu); // cpu所在的NUMA节点
+    static int current_node();   // 当前线程所在CPU的NUMA节点
+
+    static bool check(const std::string &policy); // 检查绑定策略的语法和列表中的CPU是否可用
+    //  为count个线程按策略选择CPU, 策略为none时全部为-1
+    static std::vector<int> plan(const std::string &policy, int count);
+
+    static void *alloc_interleaved(size_t len);           // 在所有节点之间交错分配页面, 用于所有线程共享的数组
+    static void *alloc_on_node(size_t len, int node);     // 优先从指定节点分配页面
+    static void release(void *addr, size_t len);          // 释放上面两个函数分配的内存
+
+private:
+    struct cpu_info
+    {
+        int cpu;
+        int node;
+        int core;    // 物理核编号(封装号和核号的组合), 超线程的兄弟CPU相同
+        int sibling; // 在同一物理核中的序号
+    };
+
+    static bool parse_list(const char *text, std::vector<int> &cpus);
+    static bool by_placement(const cpu_info &a, const cpu_info &b); // 按节点、物理核、CPU编号排序
+    static bool by_sibling(const cpu_info &a, const cpu_info &b);   // 先排每个物理核的第一个CPU
+
+    static std::vector<cpu_info> s_cpus; // 进程允许使用的CPU, 按节点、物理核、序号排列
+    static std::vector<int> s_node_of;   // CPU编号到节点的映射
+    static int s_node_count;
+};
+
+#endif
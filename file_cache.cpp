@@ -0,0 +1,347 @@
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include "file_cache.h"
+#include "response.h"
+
+#define WATCH_EVENTS (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+file_cache::file_cache(size_t capacity, size_t max_file_size)
+    : m_capacity(capacity), m_max_file_size(max_file_size), m_bytes(0), m_evict_shard(0), m_watcher(0)
+{
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        memset(m_shards[i].buckets, 0, sizeof(m_shards[i].buckets));
+        m_shards[i].hand = NULL;
+        m_shards[i].hits = 0;
+        m_shards[i].misses = 0;
+    }
+    m_inotifyfd = inotify_init1(IN_CLOEXEC);
+    if (m_inotifyfd < 0)
+    {
+        throw exception();
+    }
+    if (pthread_create(&m_watcher, NULL, watcher, this) != 0)
+    {
+        close(m_inotifyfd);
+        throw exception();
+    }
+    pthread_detach(m_watcher);
+}
+
+file_cache::~file_cache()
+{
+    invalidate_all();
+    close(m_inotifyfd);
+}
+
+unsigned long file_cache::hash_path(const char *path) // FNV-1a哈希
+{
+    unsigned long h = 14695981039346656037UL;
+    for (; *path; ++path)
+    {
+        h ^= (unsigned char)*path;
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+/*
+    生成状态行和只与文件有关的头部, 其他头部与请求有关。ETag不在其中: 文件在最近一秒内被修改过时是弱标签,
+    过了这一秒就变成强标签, 由每个响应按当时的时间生成, 与HEAD、304和206响应中的一致
+*/
+int file_cache::render_header(char *buf, const struct stat &st)
+{
+    int len = append_span(buf, http_status<200>::line());
+    len += append_span(buf + len, header_span::content_length());
+    len += u64_to_dec(buf + len, st.st_size);
+    len += append_span(buf + len, header_span::crlf());
+    len += append_span(buf + len, header_span::last_modified());
+    len += render_http_date(buf + len, st.st_mtime);
+    len += append_span(buf + len, header_span::crlf());
+    return len;
+}
+
+unsigned long file_cache::hits() const
+{
+    unsigned long n = 0;
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        n += m_shards[i].hits.load(std::memory_order_relaxed);
+    }
+    return n;
+}
+
+unsigned long file_cache::misses() const
+{
+    unsigned long n = 0;
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        n += m_shards[i].misses.load(std::memory_order_relaxed);
+    }
+    return n;
+}
+
+file_entry *file_cache::lookup(const char *path)
+{
+    unsigned long h = hash_path(path);
+    shard &s = m_shards[h % SHARDS];
+    s.lock.rdlock();
+    file_entry *entry = s.buckets[(h / SHARDS) % BUCKETS];
+    while (entry && (entry->hash != h || entry->path != path))
+    {
+        entry = entry->hash_next;
+    }
+    if (entry)
+    {
+        entry->refcnt.fetch_add(1, std::memory_order_relaxed); // 持有读锁时文件不会被淘汰, 可以安全地增加引用
+        if (!entry->referenced.load(std::memory_order_relaxed)) // 已经置位时不再写, 避免缓存行来回传递
+        {
+            entry->referenced.store(true, std::memory_order_relaxed);
+        }
+    }
+    s.lock.unlock();
+    (entry ? s.hits : s.misses).fetch_add(1, std::memory_order_relaxed);
+    return entry;
+}
+
+file_entry *file_cache::insert(const char *path, int fd, const struct stat &st)
+{
+    //  只缓存规范的路径, 否则inotify事件中的文件名对不上缓存的键, 文件修改后缓存无法失效
+    if (st.st_size <= 0 || (size_t)st.st_size > m_max_file_size || !S_ISREG(st.st_mode) ||
+        strstr(path, "/./") || strstr(path, "/../") || strstr(path, "//"))
+    {
+        return NULL;
+    }
+
+    std::string full(path);
+    size_t slash = full.rfind('/');
+    if (slash == std::string::npos)
+    {
+        return NULL;
+    }
+    watch_dir(full.substr(0, slash)); // 先开始监听, 再映射文件, 避免错过两者之间的修改
+
+    char *data = (char *)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    file_entry *entry = new file_entry;
+    entry->path = full;
+    entry->hash = hash_path(path);
+    entry->data = data;
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtime;
+    entry->ino = st.st_ino;
+    entry->fd = fd;
+    entry->header_len = render_header(entry->header, st);
+    entry->refcnt = 2; // 缓存一个引用, 调用者一个引用
+    entry->referenced = true;
+    entry->hash_next = entry->clock_prev = entry->clock_next = NULL;
+
+    shard &s = m_shards[entry->hash % SHARDS];
+    file_entry **bucket = &s.buckets[(entry->hash / SHARDS) % BUCKETS];
+    s.lock.wrlock();
+    file_entry *exist = *bucket;
+    while (exist && (exist->hash != entry->hash || exist->path != entry->path))
+    {
+        exist = exist->hash_next;
+    }
+    if (exist) // 其他线程已经缓存了同一个文件, 使用已有的
+    {
+        exist->refcnt.fetch_add(1, std::memory_order_relaxed);
+        s.lock.unlock();
+        destroy(entry);
+        return exist;
+    }
+    entry->hash_next = *bucket;
+    *bucket = entry;
+    if (s.hand) // 插入到CLOCK指针之前, 即最后才会被检查
+    {
+        entry->clock_next = s.hand;
+        entry->clock_prev = s.hand->clock_prev;
+        s.hand->clock_prev->clock_next = entry;
+        s.hand->clock_prev = entry;
+    }
+    else
+    {
+        entry->clock_next = entry->clock_prev = entry;
+        s.hand = entry;
+    }
+    m_bytes += entry->size;
+    s.lock.unlock();
+
+    while (m_bytes.load(std::memory_order_relaxed) > m_capacity && evict_one())
+    {
+    }
+    return entry;
+}
+
+void file_cache::release(file_entry *entry)
+{
+    if (entry && entry->refcnt.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        destroy(entry);
+    }
+}
+
+void file_cache::destroy(file_entry *entry)
+{
+    munmap(entry->data, entry->size);
+    close(entry->fd);
+    delete entry;
+}
+
+void file_cache::unlink_entry(shard &s, file_entry *entry)
+{
+    file_entry **pp = &s.buckets[(entry->hash / SHARDS) % BUCKETS];
+    while (*pp != entry)
+    {
+        pp = &(*pp)->hash_next;
+    }
+    *pp = entry->hash_next;
+
+    if (entry->clock_next == entry)
+    {
+        s.hand = NULL;
+    }
+    else
+    {
+        entry->clock_prev->clock_next = entry->clock_next;
+        entry->clock_next->clock_prev = entry->clock_prev;
+        if (s.hand == entry)
+        {
+            s.hand = entry->clock_next;
+        }
+    }
+    m_bytes -= entry->size;
+}
+
+bool file_cache::evict_one() // 从某个分片中用CLOCK算法淘汰一个文件
+{
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        shard &s = m_shards[m_evict_shard.fetch_add(1, std::memory_order_relaxed) % SHARDS];
+        s.lock.wrlock();
+        file_entry *victim = s.hand;
+        if (!victim)
+        {
+            s.lock.unlock();
+            continue;
+        }
+        //  持有写锁时没有读者能设置访问位, 所以最多转两圈一定能找到访问位为0的文件
+        while (victim->referenced.exchange(false, std::memory_order_relaxed))
+        {
+            victim = victim->clock_next;
+        }
+        s.hand = victim->clock_next;
+        unlink_entry(s, victim);
+        s.lock.unlock();
+        release(victim);
+        return true;
+    }
+    return false;
+}
+
+void file_cache::invalidate(const char *path)
+{
+    unsigned long h = hash_path(path);
+    shard &s = m_shards[h % SHARDS];
+    s.lock.wrlock();
+    file_entry *entry = s.buckets[(h / SHARDS) % BUCKETS];
+    while (entry && (entry->hash != h || entry->path != path))
+    {
+        entry = entry->hash_next;
+    }
+    if (entry)
+    {
+        unlink_entry(s, entry);
+    }
+    s.lock.unlock();
+    release(entry);
+}
+
+void file_cache::invalidate_all()
+{
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        shard &s = m_shards[i];
+        s.lock.wrlock();
+        while (s.hand)
+        {
+            file_entry *entry = s.hand;
+            unlink_entry(s, entry);
+            release(entry); // 缓存自己的引用, 正在使用它的连接仍然持有各自的引用
+        }
+        s.lock.unlock();
+    }
+}
+
+void file_cache::watch_dir(const std::string &dir)
+{
+    m_watch_lock.lock();
+    if (m_watched.find(dir) == m_watched.end())
+    {
+        int wd = inotify_add_watch(m_inotifyfd, dir.c_str(), WATCH_EVENTS);
+        if (wd >= 0)
+        {
+            m_watched[dir] = wd;
+            m_watches[wd] = dir;
+        }
+    }
+    m_watch_lock.unlock();
+}
+
+void *file_cache::watcher(void *arg) // 读取inotify事件使被修改的文件的缓存失效
+{
+    file_cache *cache = (file_cache *)arg;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true)
+    {
+        ssize_t len = read(cache->m_inotifyfd, buf, sizeof(buf));
+        if (len <= 0)
+        {
+            if (len < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        for (char *p = buf; p < buf + len;)
+        {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF)) // 丢失了事件或者目录本身变化了
+            {
+                cache->invalidate_all();
+                continue;
+            }
+
+            std::string dir;
+            cache->m_watch_lock.lock();
+            std::map<int, std::string>::iterator it = cache->m_watches.find(ev->wd);
+            if (it != cache->m_watches.end())
+            {
+                dir = it->second;
+                if (ev->mask & IN_IGNORED) // 监听已被内核移除
+                {
+                    cache->m_watched.erase(dir);
+                    cache->m_watches.erase(it);
+                }
+            }
+            cache->m_watch_lock.unlock();
+
+            if (!dir.empty() && ev->len > 0)
+            {
+                cache->invalidate((dir + "/" + ev->name).c_str());
+            }
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,92 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include "locker.h"
+
+// 缓存的文件, 多个连接共享同一份映射和文件描述符
+class file_entry
+{
+public:
+    static const int HEADER_SIZE = 256;
+
+    std::string path;             // 文件的完整路径
+    unsigned long hash;           // 路径的哈希值
+    char *data;                   // 文件被mmap到内存中的起始位置
+    off_t size;                   // 文件大小
+    time_t mtime;                 // 文件的修改时间
+    int fd;                       // 文件描述符(sendfile模式使用, 偏移量由调用者自己维护)
+    ino_t ino;                    // 文件的inode, 与大小和修改时间一起生成ETag
+    char header[HEADER_SIZE];     // 预先生成的状态行和Content-Length/Last-Modified头部
+    int header_len;               // 预先生成的头部长度
+    std::atomic<int> refcnt;      // 引用计数, 缓存本身持有一个引用, 每个正在发送的连接各持有一个
+    std::atomic<bool> referenced; // CLOCK淘汰算法的访问位
+    file_entry *hash_next;        // 同一个哈希桶中的下一个文件
+    file_entry *clock_prev;       // CLOCK环形链表中的前一个文件
+    file_entry *clock_next;       // CLOCK环形链表中的后一个文件
+};
+
+/*
+    进程级的热点文件缓存, 以文件路径为键保存文件的映射、大小、修改时间和预先生成的响应头。
+    缓存分为多个分片, 每个分片用自己的读写锁保护, 命中时只加分片的读锁并原子地增加引用计数,
+    工作线程之间没有全局锁。按字节数限制缓存总大小, 超出时用CLOCK算法(近似LRU)淘汰,
+    命中时只设置访问位而不需要移动链表。文件被淘汰或失效后, 正在发送它的连接仍然持有引用,
+    最后一个引用释放时才解除映射。一个后台线程通过inotify监听被缓存文件所在的目录,
+    文件被修改、删除或改名时使对应的缓存失效。
+*/
+class file_cache
+{
+public:
+    static const int SHARDS = 16;  // 分片数量
+    static const int BUCKETS = 64; // 每个分片的哈希桶数量
+
+    file_cache(size_t capacity, size_t max_file_size);
+    ~file_cache();
+
+    file_entry *lookup(const char *path);                                // 查找文件, 命中时增加引用计数
+    file_entry *insert(const char *path, int fd, const struct stat &st); // 加入缓存并增加引用计数, 成功时fd归缓存所有
+    void release(file_entry *entry);                                     // 释放一个引用
+    void invalidate(const char *path);                                   // 使一个文件的缓存失效
+    void invalidate_all();                                               // 清空缓存
+
+    size_t bytes() const { return m_bytes.load(std::memory_order_relaxed); }
+    unsigned long hits() const;   // 命中次数
+    unsigned long misses() const; // 未命中次数
+
+private:
+    struct shard
+    {
+        rwlocker lock;
+        file_entry *buckets[BUCKETS];
+        file_entry *hand;                  // CLOCK指针
+        std::atomic<unsigned long> hits;   // 命中次数(按分片统计, 减少计数器上的竞争)
+        std::atomic<unsigned long> misses; // 未命中次数
+    };
+
+    static unsigned long hash_path(const char *path);
+    static int render_header(char *buf, const struct stat &st);
+    static void *watcher(void *arg); // inotify监听线程
+    void watch_dir(const std::string &path);
+    void unlink_entry(shard &s, file_entry *entry); // 调用者持有分片的写锁
+    bool evict_one();
+    void destroy(file_entry *entry);
+
+private:
+    shard m_shards[SHARDS];
+    size_t m_capacity;                       // 缓存的字节数上限
+    size_t m_max_file_size;                  // 能被缓存的单个文件的大小上限
+    std::atomic<size_t> m_bytes;             // 当前缓存的字节数
+    std::atomic<unsigned int> m_evict_shard; // 下一次淘汰从哪个分片开始
+    int m_inotifyfd;                         // inotify实例
+    locker m_watch_lock;                     // 保护m_watches和m_watched
+    std::map<int, std::string> m_watches;    // inotify监听描述符到目录的映射
+    std::map<std::string, int> m_watched;    // 已经监听的目录
+    pthread_t m_watcher;                     // inotify监听线程
+};
+
+#endif
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include "handoff.h"
+#include "logger.h"
+
+extern char **environ;
+
+const char *const handoff::HANDOFF_ENV = "WEBSERVER_HANDOFF_FD";
+int handoff::s_channel = -1;
+
+static const int FDS_PER_MESSAGE = 200; // 一条消息最多携带的文件描述符数(内核上限SCM_MAX_FD为253)
+
+/*
+    每条消息的数据是1个字节, 值为随附的文件描述符个数; 值为0的消息表示全部发送完毕。
+    流式套接字上辅助数据附着在它所随的那个字节上, 每次只读1个字节就不会把两条消息混在一起
+*/
+static bool send_fds(int sock, const int *fds, int n)
+{
+    char data = (char)n;
+    struct iovec iov = {&data, 1};
+    char control[CMSG_SPACE(sizeof(int) * FDS_PER_MESSAGE)];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (n > 0)
+    {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * n);
+    }
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+}
+
+static int recv_fds(int sock, std::vector<int> &fds) // 返回这条消息携带的文件描述符个数, 出错时返回-1
+{
+    char data;
+    struct iovec iov = {&data, 1};
+    char control[CMSG_SPACE(sizeof(int) * FDS_PER_MESSAGE)];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1)
+    {
+        return -1;
+    }
+    int count = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (int i = 0; i < n; ++i)
+            {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                fds.push_back(fd);
+            }
+            count += n;
+        }
+    }
+    return data == 0 ? 0 : count;
+}
+
+static bool listens_on(int fd, int port) // fd是否是监听port的TCP套接字
+{
+    int listening = 0;
+    socklen_t len = sizeof(listening);
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    return getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) == 0 && listening &&
+           getsockname(fd, (struct sockaddr *)&addr, &addrlen) == 0 && addr.sin_family == AF_INET &&
+           ntohs(addr.sin_port) == port;
+}
+
+std::vector<int> handoff::inherit(int port)
+{
+    std::vector<int> fds;
+    const char *env = getenv(HANDOFF_ENV);
+    if (!env)
+    {
+        return fds;
+    }
+    int channel = atoi(env);
+    unsetenv(HANDOFF_ENV); // 不再传给以后启动的进程
+    if (fcntl(channel, F_SETFD, FD_CLOEXEC) < 0)
+    {
+        LOG_WARN("handoff channel %s is not open", env);
+        return fds;
+    }
+    s_channel = channel;
+
+    std::vector<int> received;
+    int n;
+    while ((n = recv_fds(channel, received)) > 0)
+    {
+    }
+    if (n < 0)
+    {
+        LOG_WARN("handoff: cannot receive listening sockets: %s", strerror(errno));
+    }
+    for (size_t i = 0; i < received.size(); ++i)
+    {
+        if (listens_on(received[i], port))
+        {
+            fds.push_back(received[i]);
+        }
+        else
+        {
+            close(received[i]);
+        }
+    }
+    LOG_INFO("handoff: inherited %zu listening sockets", fds.size());
+    return fds;
+}
+
+void handoff::ready()
+{
+    if (s_channel == -1)
+    {
+        return;
+    }
+    char byte = 'R';
+    if (write(s_channel, &byte, 1) != 1)
+    {
+        LOG_WARN("handoff: cannot notify the previous process: %s", strerror(errno));
+    }
+    close(s_channel);
+    s_channel = -1;
+}
+
+bool handoff::spawn(const char *exe, char *const argv[], const std::vector<int> &listenfds)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+    {
+        LOG_ERROR("handoff: socketpair: %s", strerror(errno));
+        return false;
+    }
+
+    //  fork之后的子进程在exec之前只能调用异步信号安全的函数, 环境变量在这里准备好
+    char channel[64];
+    snprintf(channel, sizeof(channel), "%s=%d", HANDOFF_ENV, sv[1]);
+    size_t len = strlen(HANDOFF_ENV);
+    std::vector<char *> envp;
+    for (char **e = environ; *e; ++e)
+    {
+        if (strncmp(*e, HANDOFF_ENV, len) != 0 || (*e)[len] != '=')
+        {
+            envp.push_back(*e);
+        }
+    }
+    envp.push_back(channel);
+    envp.push_back(NULL);
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        LOG_ERROR("handoff: fork: %s", strerror(errno));
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+    if (pid == 0)
+    {
+        sigset_t none; // 调用者(信号线程)屏蔽了所有要处理的信号, 屏蔽字会被exec继承
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        fcntl(sv[1], F_SETFD, 0); // 通道要保留到exec之后
+        execve(exe, argv, envp.data());
+        _exit(127);
+    }
+    close(sv[1]);
+
+    bool ok = true;
+    for (size_t i = 0; ok && i < listenfds.size(); i += FDS_PER_MESSAGE)
+    {
+        size_t n = listenfds.size() - i < (size_t)FDS_PER_MESSAGE ? listenfds.size() - i : FDS_PER_MESSAGE;
+        ok = send_fds(sv[0], &listenfds[i], (int)n);
+    }
+    ok = ok && send_fds(sv[0], NULL, 0);
+
+    char byte = 0;
+    struct pollfd pfd = {sv[0], POLLIN, 0};
+    ok = ok && poll(&pfd, 1, READY_TIMEOUT_MS) == 1 && read(sv[0], &byte, 1) == 1 && byte == 'R';
+    close(sv[0]);
+    if (!ok) // 新进程启动失败或者超时没有就绪, 旧进程继续服务
+    {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        LOG_ERROR("handoff: %s did not become ready", exe);
+        return false;
+    }
+    LOG_INFO("handoff: process %d took over the listening sockets", (int)pid);
+    return true;
+}
@@ -0,0 +1,30 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <vector>
+
+/*
+    不停机升级: 旧进程收到SIGUSR2后fork并exec新的可执行文件, 通过一对Unix域套接字
+    用SCM_RIGHTS把自己的监听套接字交给新进程。新进程启动后直接使用这些套接字(同一个内核对象,
+    等待队列中的连接不会丢失), 创建好事件循环后回复就绪, 旧进程这时才开始优雅退出。
+    整个过程中监听端口一直有套接字在接受连接, 客户端不会遇到连接被拒绝。
+    通道的文件描述符通过环境变量HANDOFF_ENV传给新进程
+*/
+class handoff
+{
+public:
+    static const char *const HANDOFF_ENV;
+    static const int READY_TIMEOUT_MS = 10000; // 等待新进程就绪的最长时间
+
+    //  新进程: 接收旧进程交来的监听套接字, 只保留监听port的那些; 不是由旧进程启动时返回空
+    static std::vector<int> inherit(int port);
+    static void ready(); // 新进程: 监听和事件循环都准备好了, 通知旧进程退出
+
+    //  旧进程: 启动exe并交出监听套接字, 新进程就绪时返回true; 失败时旧进程继续正常服务
+    static bool spawn(const char *exe, char *const argv[], const std::vector<int> &listenfds);
+
+private:
+    static int s_channel; // 新进程中与旧进程通信的套接字, -1表示没有
+};
+
+#endif
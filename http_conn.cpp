@@ -1,25 +1,22 @@
+#include <sys/sendfile.h>
 #include "http_conn.h"
+#include "http_parser.h"
+#include "syscall_stats.h"
+#include "overload.h"
+#include "latency_stats.h"
+#include "server_stats.h"
+#include "logger.h"
+#include "io_loop.h"
 
-// 定义HTTP响应的一些状态信息
-const char *ok_200_title = "OK";
-const char *error_400_title = "Bad Request";
-const char *error_400_form = "Your request has bad syntax or is inherently impossible to satisfy.\n";
-const char *error_403_title = "Forbidden";
-const char *error_403_form = "You do not have permission to get file from this server.\n";
-const char *error_404_title = "Not Found";
-const char *error_404_form = "The requested file was not found on this server.\n";
-const char *error_500_title = "Internal Error";
-const char *error_500_form = "There was an unusual problem serving the requested file.\n";
-const char *doc_root = "/home/lijinqiao/Nowcoder/WebServer/resources"; /* 网站的资源目录 */
-
-int setnonblocking(int fd) // 设置文件描述符非阻塞
-{
-    int old_option = fcntl(fd, F_GETFL);
-    int new_option = old_option | O_NONBLOCK;
-    fcntl(fd, F_SETFL, new_option);
-    return old_option;
-}
+// HTTP响应的状态行和错误页面定义在response.h中, 在编译期生成
+const char *doc_root = NULL; /* 网站的资源目录, 启动时由配置(doc_root)设置为规范化的绝对路径 */
+static const char *method_names[] = {"GET", "HEAD", "POST", "PUT"}; /* 与METHOD的顺序一致, 用于访问日志 */
+const char *stats_path = "/__stats"; /* 内置统计页面的URL, 默认输出JSON, 带?format=prometheus时输出Prometheus文本格式 */
 
+/*
+    监听套接字、连接和timerfd在创建时都已经是非阻塞的(SOCK_NONBLOCK/accept4/TFD_NONBLOCK),
+    注册时不再需要fcntl
+*/
 void addfd(int epollfd, int fd, bool one_shot) // 向epoll中添加需要监听的文件描述符
 {
     epoll_event event;
@@ -30,47 +27,104 @@ void addfd(int epollfd, int fd, bool one_shot) // 向epoll中添加需要监听
         event.events |= EPOLLONESHOT; // 防止同一个通信被不同的线程处理
     }
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+    syscall_stats::count(syscall_stats::SC_EPOLL_CTL);
+}
 
-    setnonblocking(fd); // 设置文件非阻塞
+void addfd_edge(int epollfd, int fd) // 以边沿触发方式一次性注册读写事件, 之后不再修改
+{
+    epoll_event event;
+    event.data.fd = fd;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+    syscall_stats::count(syscall_stats::SC_EPOLL_CTL);
 }
 
-void removefd(int epollfd, int fd) // 从epoll中移除监听的文件描述符
+/*
+    关闭连接的文件描述符。连接的文件描述符没有被复制过(SOCK_CLOEXEC),
+    关闭时内核会自动把它从epoll实例中删除, 不需要单独调用EPOLL_CTL_DEL; io_uring后端不使用epoll, 同样直接关闭
+*/
+void close_sock(int fd)
 {
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
     close(fd);
+    syscall_stats::count(syscall_stats::SC_CLOSE);
 }
 
-void modfd(int epollfd, int fd, int ev) // 修改文件描述符重置socket上的EPOLLONESHOT事件以确保下一次可读时EPOLLIN事件能被触发
+void modfd(int epollfd, int fd, int ev, bool one_shot) // 修改文件描述符重置socket上的EPOLLONESHOT事件以确保下一次可读时EPOLLIN事件能被触发
 {
     epoll_event event;
     event.data.fd = fd;
-    event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+    event.events = ev | EPOLLET | EPOLLRDHUP;
+    if (one_shot)
+    {
+        event.events |= EPOLLONESHOT;
+    }
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
+    syscall_stats::count(syscall_stats::SC_EPOLL_CTL);
 }
 
-int http_conn::m_user_count = 0; // 当前的客户数
-int http_conn::m_epollfd = -1;   // 注册到的epoll文件描述符
+std::atomic<int> http_conn::m_user_count(0); // 当前的客户数
+int http_conn::m_read_buffer_size = 2048;
+int http_conn::m_max_read_buffer_size = 64 * 1024;
+int http_conn::m_write_buffer_size = 2048;
+int http_conn::m_idle_timeout = 60;           // 空闲长连接60秒后关闭
+int http_conn::m_header_timeout = 10;         // 10秒内必须发完请求行和头部
+int http_conn::m_body_timeout = 30;           // 请求体和响应30秒没有进展则关闭
+bool http_conn::m_use_sendfile = false;        // 默认使用mmap+writev发送文件
+off_t http_conn::m_mmap_max = (off_t)64 << 20; // 大于64MB的文件用sendfile发送
+bool http_conn::m_precompressed = true;        // 默认发送预先压缩的文件
+std::string http_conn::m_cache_control = "Cache-Control: no-cache\r\n"; // 默认每次使用前都向服务器验证
+std::string http_conn::m_upload_dir;           // 默认不接受上传
+off_t http_conn::m_max_body = (off_t)16 << 20; // 请求体最大16MB
+file_cache *http_conn::m_file_cache = NULL;    // 默认不缓存文件
+buffer_pool http_conn::m_buffers;
+threadpool<http_conn> *http_conn::m_pool = NULL;
 
 void http_conn::close_conn() // 关闭一个连接
 {
     if (m_sockfd != -1)
     {
-        removefd(m_epollfd, m_sockfd);
+        unmap(); /* 发送到一半时关闭连接也要释放文件 */
+        discard_upload();
+        m_read_idx = 0;
+        m_part_count = 0;
+        bytes_to_send = 0;
+        release_buffers();
+        /*
+            最后才关闭文件描述符: 线程池模式下关闭之后reactor马上就可能accept到同一个描述符号的新连接并调用init,
+            在这之后再写m_sockfd会把新连接的状态改掉, 新连接的请求再也不会被读取
+        */
+        int sockfd = m_sockfd;
         m_sockfd = -1;
         m_user_count--;
+        server_stats::add(server_stats::ST_CLOSED);
+        close_sock(sockfd);
     }
 }
 
-void http_conn::init(int sockfd, const sockaddr_in &addr) // 初始化一个任务的外部信息
+void http_conn::init(int sockfd, const sockaddr_in &addr, int epollfd, bool inline_mode) // 初始化一个任务的外部信息
 {
     m_sockfd = sockfd;
     m_address = addr;
+    m_epollfd = epollfd;
+    m_inline = inline_mode;
+    m_timer.user_data = this;
+    m_timer_phase = PHASE_IDLE;
+    m_file_address = 0;
+    m_file_fd = -1;
+    m_cache_entry = NULL;
+    m_aux_buffer = NULL;
+    m_body_fd = -1;
 
-    int reuse = 1;
-    setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)); // 端口复用
-
-    addfd(m_epollfd, sockfd, true);
+    if (m_epollfd != -1 && m_inline) /* io_uring后端不使用epoll */
+    {
+        addfd_edge(m_epollfd, sockfd);
+    }
+    else if (m_epollfd != -1)
+    {
+        addfd(m_epollfd, sockfd, true);
+    }
     m_user_count++;
+    server_stats::add(server_stats::ST_ACCEPTED);
     init();
 }
 
@@ -86,27 +140,101 @@ void http_conn::init() // 初始化一些读写参数
     m_url = 0;
     m_version = 0;
     m_content_length = 0;
+    m_chunked = false;
+    m_expect_continue = false;
     m_host = 0;
+    m_accept_encoding = 0;
+    m_if_none_match = NULL;
+    m_if_modified_since = -1;
+    m_range = NULL;
+    m_if_range = NULL;
+    m_range_count = 0;
     m_start_line = 0;
+    m_request_start = 0;
     m_checked_idx = 0;
+    m_line_len = 0;
+    m_line_colon = NULL;
     m_read_idx = 0;
+    m_read_stalled = false;
     m_write_idx = 0;
+    m_keep_alive = false;
+    m_part_count = 0;
+    m_part_idx = 0;
+    m_file_count = 0;
+    m_batch_requests = 0;
+    m_read_at = 0;
+    m_batch_start = 0;
+    m_parse_ns = 0;
+    m_lookup_ns = 0;
+}
 
-    bzero(m_read_buf, READ_BUFFER_SIZE);
-    bzero(m_write_buf, READ_BUFFER_SIZE);
-    bzero(m_real_file, FILENAME_LEN);
+/*
+    线程池模式下每次都要重置EPOLLONESHOT事件, 防止两个线程同时处理一个连接;
+    多reactor模式下连接始终只由接受它的线程处理, 接受时已经以边沿触发方式注册了EPOLLIN|EPOLLOUT,
+    读写都进行到EAGAIN为止, 下一次状态变化一定会产生新的事件, 所以不需要再调用epoll_ctl
+*/
+void http_conn::rearm(int ev)
+{
+    if (!m_inline)
+    {
+        modfd(m_epollfd, m_sockfd, ev, true);
+    }
 }
 
-bool http_conn::read() // 循环读取客户数据直到无数据可读或者对方关闭连接
+/*
+    由所属reactor线程在每次处理完连接上的事件后调用, 返回0表示保持原来的到期时间。
+    请求头的超时从请求的第一个字节开始计算, 之后的数据不会延长它, 这样慢速发送头部
+    (slowloris)的客户端无法一直占用连接; 其他阶段每次有进展都会重新计时。
+*/
+int http_conn::timer_timeout()
 {
-    if (m_read_idx >= READ_BUFFER_SIZE)
+    TIMER_PHASE phase;
+    if (bytes_to_send > 0)
     {
-        return false;
+        phase = PHASE_WRITE;
+    }
+    else if (m_read_idx == 0)
+    {
+        phase = PHASE_IDLE;
     }
+    else if (m_check_state == CHECK_STATE_CONTENT)
+    {
+        phase = PHASE_BODY;
+    }
+    else
+    {
+        phase = PHASE_HEADER;
+    }
+
+    if (phase == PHASE_HEADER && m_timer_phase == PHASE_HEADER && m_timer.linked)
+    {
+        return 0;
+    }
+    m_timer_phase = phase;
+    switch (phase)
+    {
+    case PHASE_HEADER:
+        return m_header_timeout;
+    case PHASE_BODY:
+    case PHASE_WRITE:
+        return m_body_timeout;
+    default:
+        return m_idle_timeout;
+    }
+}
+
+bool http_conn::read() // 循环读取客户数据直到无数据可读或者对方关闭连接
+{
     int bytes_read = 0;
     while (true)
     {
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        if (m_read_idx >= m_read_size && !grow_read_buf()) // 读缓冲区已经是上限大小, 先处理读到的数据(请求体边读边消费), 腾出空间后再读
+        {
+            m_read_stalled = true;
+            break;
+        }
+        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_size - m_read_idx, 0);
+        syscall_stats::count(syscall_stats::SC_READ);
         if (bytes_read == -1)
         {
             if (errno == EAGAIN || errno == EWOULDBLOCK) // 没有数据
@@ -120,71 +248,156 @@ bool http_conn::read() // 循环读取客户数据直到无数据可读或者对
             return false;
         }
         m_read_idx += bytes_read;
+        m_read_at = latency_stats::now_ns();
+    }
+    release_buffers(); // 没有读到数据时不必占着缓冲区
+    return true;
+}
+
+bool http_conn::grow_read_buf()
+{
+    size_t want = m_read_buf ? (size_t)m_read_size * 2 : (size_t)m_read_buffer_size;
+    if (want > (size_t)m_max_read_buffer_size)
+    {
+        return false;
+    }
+    size_t capacity = 0;
+    char *buf = m_buffers.alloc(want, capacity);
+    if (!buf)
+    {
+        return false;
     }
+    if (m_read_buf)
+    {
+        memcpy(buf, m_read_buf, m_read_idx);
+        move_read_ptrs(m_read_buf, buf);
+        m_buffers.free(m_read_buf, m_read_size);
+    }
+    m_read_buf = buf;
+    m_read_size = capacity;
     return true;
 }
 
-http_conn::LINE_STATUS http_conn::parse_line() // 分析一行内容是否完整
+static char *move_ptr(char *p, char *from, char *to)
+{
+    return p ? to + (p - from) : p;
+}
+
+void http_conn::move_read_ptrs(char *from, char *to) /* 正在解析的请求已经记录的指针跟着数据一起移动 */
+{
+    m_url = move_ptr(m_url, from, to);
+    m_version = move_ptr(m_version, from, to);
+    m_host = move_ptr(m_host, from, to);
+    m_if_none_match = move_ptr(m_if_none_match, from, to);
+    m_range = move_ptr(m_range, from, to);
+    m_if_range = move_ptr(m_if_range, from, to);
+    m_line_colon = move_ptr(m_line_colon, from, to);
+}
+
+void http_conn::resume_read() /* 边沿触发下socket中剩下的数据不会再产生事件, 用EPOLL_CTL_MOD让内核重新检查一次就绪状态 */
+{
+    m_read_stalled = false;
+    if (m_inline && m_epollfd != -1) /* 线程池模式之后总会重新注册EPOLLONESHOT事件, io_uring后端不会提前返回 */
+    {
+        modfd(m_epollfd, m_sockfd, EPOLLIN | EPOLLOUT, false);
+    }
+}
+
+bool http_conn::acquire_write_block()
+{
+    if (m_wblock)
+    {
+        return true;
+    }
+    size_t capacity = 0;
+    m_wblock = (write_block *)m_buffers.alloc(write_block_size(), capacity);
+    return m_wblock != NULL;
+}
+
+/*
+    空闲的长连接不占用缓冲区: 读入的数据都处理完后归还读缓冲区,
+    一批响应发送完后归还发送状态, 下次有数据时再从缓冲池中取
+*/
+void http_conn::release_buffers()
+{
+    if (m_read_buf && m_read_idx == 0)
+    {
+        m_buffers.free(m_read_buf, m_read_size);
+        m_read_buf = NULL;
+        m_read_size = 0;
+    }
+    if (m_wblock && m_part_count == 0)
+    {
+        m_buffers.free((char *)m_wblock, write_block_size());
+        m_wblock = NULL;
+    }
+}
+
+/*
+    分析一行内容是否完整。用向量化的find_line_end一次找到行尾和行内第一个':',
+    行没有读完整时记住已经扫描到的位置和':', 下次从这里继续, 每个字节只扫描一次
+*/
+http_conn::LINE_STATUS http_conn::parse_line()
 {
-    char temp;
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx)
+    char *end = m_read_buf + m_read_idx;
+    const char *colon = NULL;
+    char *p = (char *)find_line_end(m_read_buf + m_checked_idx, end, &colon);
+    if (!m_line_colon)
+    {
+        m_line_colon = (char *)colon;
+    }
+    m_checked_idx = p - m_read_buf;
+    if (p == end)
     {
-        temp = m_read_buf[m_checked_idx]; // 获取当前要分析的字符
+        return LINE_OPEN;
+    }
 
-    //  连续的'\r''\n'两个字符是一个完整行的结束标记
+//  连续的'\r''\n'两个字符是一个完整行的结束标记
 
-        if (temp == '\r')
+    if (*p == '\r')
+    {
+        if ((m_checked_idx + 1) == m_read_idx) // '\r'是最后一个字节, 下次从'\r'处重新检查
         {
-            if ((m_checked_idx + 1) == m_read_idx)
-            {
-                return LINE_OPEN;
-            }
-            else if (m_read_buf[m_checked_idx + 1] == '\n')
-            {
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
+            return LINE_OPEN;
         }
-        else if (temp == '\n')
+        else if (p[1] == '\n')
         {
-            if ((m_checked_idx > 1) && (m_read_buf[m_checked_idx - 1] == '\r'))
-            {
-                m_read_buf[m_checked_idx - 1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
+            m_line_len = m_checked_idx - m_start_line;
+            m_read_buf[m_checked_idx++] = '\0';
+            m_read_buf[m_checked_idx++] = '\0';
+            return LINE_OK;
         }
     }
-    return LINE_OPEN;
+    return LINE_BAD; /* 单独的'\r'或者'\n' */
 }
 
 http_conn::HTTP_CODE http_conn::parse_request_line(char *text) // 解析HTTP请求行内容
 {
-    m_url = strpbrk(text, " \t"); // ==> GET IP/index.html HTTP/1.1
-    if (!m_url)
+    request_line line; // ==> GET IP/index.html HTTP/1.1, 三个部分都直接指向读缓冲区
+    if (!split_request_line(text, m_line_len, line))
+    {
         return BAD_REQUEST;
-    *m_url++ = '\0'; // ==> GET\0IP/index.html HTTP/1.1, 此时m_url指向IP
+    }
 
-    char *method = text; // 起始位置,即 char *method = "GET"
-    if (strcasecmp(method, "GET") == 0)
+    if (span_iequals(line.method, "GET"))
         m_method = GET;
+    else if (span_iequals(line.method, "HEAD"))
+        m_method = HEAD;
+    else if (span_iequals(line.method, "POST"))
+        m_method = POST;
+    else if (span_iequals(line.method, "PUT"))
+        m_method = PUT;
     else
         return BAD_REQUEST;
 
-    m_version = strpbrk(m_url, " \t"); // ==> IP/index.html HTTP/1.1
-    if (!m_version)
+    if (!span_iequals(line.version, "HTTP/1.1"))
     {
         return BAD_REQUEST;
     }
-    *m_version++ = '\0'; // ==> IP/index.html\0HTTP/1.1, 此时m_version指向'H'
+    m_version = (char *)line.version.data; // 请求行末尾已经被parse_line置为'\0'
 
-    if (strcasecmp(m_version, "HTTP/1.1") != 0)
-    {
-        return BAD_REQUEST;
-    }
+    m_url = (char *)line.url.data;
+    m_url[line.url.len] = '\0'; // ==> IP/index.html\0HTTP/1.1, URL后面是空白字符, 直接改成'\0'
 
 //  http://192.168.110.129:10000/index.html
 
@@ -205,51 +418,330 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text) // 解析HTTP请求的
 {
     if (text[0] == '\0') // 遇到空行表示头部字段解析完毕
     {
-        if (m_content_length != 0) /* 如果HTTP请求有消息体则还需要读取m_content_length字节的消息体 */
+        return begin_body();
+    }
+
+    byte_span name, value; /* 按parse_line扫描时找到的':'切分, 不再重新扫描这一行 */
+    if (!split_header(text, m_line_len, m_line_colon, name, value))
+    {
+        LOG_DEBUG("oop! unknow header %s", text);
+        return NO_REQUEST;
+    }
+    ((char *)value.data)[value.len] = '\0'; /* 去掉值末尾的空白, 该位置不会超出本行 */
+
+    if (span_iequals(name, "Connection")) /* 处理Connection头部字段 */
+    {
+        if (span_iequals(value, "keep-alive"))
         {
-            m_check_state = CHECK_STATE_CONTENT; /* 状态机转移到CHECK_STATE_CONTENT状态 */
-            return NO_REQUEST;
+            m_linger = true;
         }
-        return GET_REQUEST; /* 否则说明我们已经得到了一个完整的HTTP请求 */
     }
-    else if (strncasecmp(text, "Connection:", 11) == 0) /* 处理Connection头部字段 */
+    else if (span_iequals(name, "Content-Length")) /* 处理Content-Length头部字段, 只接受十进制数字 */
     {
-        text += 11;
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0)
+        char *end;
+        m_content_length = strtoll(value.data, &end, 10);
+        if (value.data[0] < '0' || value.data[0] > '9' || *end != '\0')
         {
-            m_linger = true;
+            return BAD_REQUEST;
+        }
+    }
+    else if (span_iequals(name, "Transfer-Encoding")) /* 只支持分块编码, 无法确定请求体的边界时拒绝 */
+    {
+        if (!span_iequals(value, "chunked"))
+        {
+            return BAD_REQUEST;
         }
+        m_chunked = true;
+    }
+    else if (span_iequals(name, "Expect"))
+    {
+        m_expect_continue = span_iequals(value, "100-continue");
+    }
+    else if (span_iequals(name, "Host")) /* 处理Host头部字段 */
+    {
+        m_host = (char *)value.data;
+    }
+    else if (span_iequals(name, "Accept-Encoding")) /* 有多个Accept-Encoding时合并 */
+    {
+        m_accept_encoding |= parse_accept_encoding(value);
+    }
+    else if (span_iequals(name, "If-None-Match"))
+    {
+        m_if_none_match = (char *)value.data;
+    }
+    else if (span_iequals(name, "If-Modified-Since"))
+    {
+        m_if_modified_since = parse_http_date(value.data);
     }
-    else if (strncasecmp(text, "Content-Length:", 15) == 0) /* 处理Content-Length头部字段 */
+    else if (span_iequals(name, "Range"))
     {
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
+        m_range = (char *)value.data;
     }
-    else if (strncasecmp(text, "Host:", 5) == 0) /* 处理Host头部字段 */
+    else if (span_iequals(name, "If-Range"))
     {
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
+        m_if_range = (char *)value.data;
     }
     else /* 暂时无法处理的头部字段 */
     {
-        printf("oop! unknow header %s\n", text);
+        LOG_DEBUG("oop! unknow header %s", text);
     }
     return NO_REQUEST;
 }
 
-http_conn::HTTP_CODE http_conn::parse_content(char *text) /* 我们没有真正解析HTTP请求的消息体只是判断它是否被完整的读入 */
+/*
+    请求头解析完毕, 按Content-Length或者分块编码准备接收请求体。上传(POST/PUT)的请求体写入上传目录中的
+    匿名临时文件, 其他方法的请求体读到就丢弃。拒绝的请求不再读请求体, 回复后关闭连接;
+    客户端发送了Expect: 100-continue并且还没有开始发送请求体时, 先在这一批响应中放入100 Continue
+*/
+http_conn::HTTP_CODE http_conn::begin_body()
 {
-    if (m_read_idx >= (m_content_length + m_checked_idx))
+    bool upload = m_method == POST || m_method == PUT;
+    if (!upload && !m_chunked && m_content_length == 0)
     {
-        text[m_content_length] = '\0';
         return GET_REQUEST;
     }
+
+    char target[FILENAME_LEN];
+    HTTP_CODE ret = NO_REQUEST;
+    if (m_chunked && m_content_length > 0) /* 两者同时出现时前后的服务器可能对请求的边界理解不同(请求走私) */
+    {
+        ret = BAD_REQUEST;
+    }
+    else if (upload && m_upload_dir.empty())
+    {
+        ret = METHOD_NOT_ALLOWED;
+    }
+    else if (m_content_length > m_max_body)
+    {
+        ret = BODY_TOO_LARGE;
+    }
+    else if (upload && !upload_target(target))
+    {
+        ret = FORBIDDEN_REQUEST;
+    }
+    else if (upload)
+    {
+        m_body_fd = open(m_upload_dir.c_str(), O_TMPFILE | O_WRONLY | O_CLOEXEC, 0644);
+        if (m_body_fd < 0)
+        {
+            LOG_ERROR("upload: cannot create a temporary file in %s: %s", m_upload_dir.c_str(), strerror(errno));
+            ret = INTERNAL_ERROR;
+        }
+    }
+    if (ret != NO_REQUEST)
+    {
+        m_linger = false;
+        return ret;
+    }
+
+    m_check_state = CHECK_STATE_CONTENT;
+    m_chunk_state = CHUNK_SIZE;
+    m_body_left = m_chunked ? 0 : m_content_length;
+    m_body_received = 0;
+    if (m_expect_continue && (m_chunked || m_content_length > 0) && m_read_idx == m_checked_idx && !add_continue())
+    {
+        return INTERNAL_ERROR;
+    }
     return NO_REQUEST;
 }
 
+/*
+    消费读缓冲区中已经收到的请求体。分块编码在原地解码: 块数据向前移动覆盖块大小行和CRLF,
+    解码后的数据一次写出, 之后剩下的字节(下一个请求或者不完整的行)移到m_checked_idx处,
+    请求体不在读缓冲区中累积, 不论多大都只占用一个读缓冲区
+*/
+http_conn::HTTP_CODE http_conn::parse_content()
+{
+    int src = m_checked_idx; /* 下一个要解析的字节 */
+    int dst = m_checked_idx; /* 解码后的数据写到这里 */
+    HTTP_CODE ret = NO_REQUEST;
+    while (ret == NO_REQUEST)
+    {
+        if (!m_chunked || m_chunk_state == CHUNK_DATA)
+        {
+            int n = m_read_idx - src < m_body_left ? m_read_idx - src : (int)m_body_left;
+            if (dst != src)
+            {
+                memmove(m_read_buf + dst, m_read_buf + src, n);
+            }
+            src += n;
+            dst += n;
+            m_body_left -= n;
+            if (m_body_left > 0)
+            {
+                break;
+            }
+            if (!m_chunked)
+            {
+                ret = GET_REQUEST;
+            }
+            m_chunk_state = CHUNK_DATA_END;
+            continue;
+        }
+        char *eol = (char *)memchr(m_read_buf + src, '\n', m_read_idx - src);
+        if (!eol)
+        {
+            if (m_read_idx - src > MAX_CHUNK_LINE)
+            {
+                ret = BAD_REQUEST;
+            }
+            break;
+        }
+        ret = parse_chunk_line(m_read_buf + src, eol);
+        src = eol + 1 - m_read_buf;
+    }
+
+    if (dst > m_checked_idx && !store_body(m_read_buf + m_checked_idx, dst - m_checked_idx))
+    {
+        ret = INTERNAL_ERROR;
+    }
+    memmove(m_read_buf + m_checked_idx, m_read_buf + src, m_read_idx - src);
+    m_read_idx -= src - m_checked_idx;
+    if (ret != NO_REQUEST && ret != GET_REQUEST) /* 请求体没有读完, 无法确定下一个请求从哪里开始 */
+    {
+        m_linger = false;
+    }
+    return ret;
+}
+
+http_conn::HTTP_CODE http_conn::parse_chunk_line(const char *line, const char *eol) /* 块大小(忽略块扩展)、块数据后的CRLF或者一个尾部字段 */
+{
+    const char *end = eol > line && eol[-1] == '\r' ? eol - 1 : eol;
+    switch (m_chunk_state)
+    {
+    case CHUNK_SIZE:
+    {
+        off_t size = 0;
+        const char *p = line;
+        for (; p < end; ++p)
+        {
+            char c = *p;
+            int digit = c >= '0' && c <= '9' ? c - '0' : (c | 0x20) >= 'a' && (c | 0x20) <= 'f' ? (c | 0x20) - 'a' + 10 : -1;
+            if (digit < 0)
+            {
+                break;
+            }
+            if (p - line >= 15)
+            {
+                return BAD_REQUEST;
+            }
+            size = size * 16 + digit;
+        }
+        if (p == line || (p < end && *p != ';' && *p != ' ' && *p != '\t'))
+        {
+            return BAD_REQUEST;
+        }
+        if (size == 0)
+        {
+            m_chunk_state = CHUNK_TRAILER;
+            return NO_REQUEST;
+        }
+        if (size > m_max_body - m_body_received)
+        {
+            return BODY_TOO_LARGE;
+        }
+        m_body_received += size;
+        m_body_left = size;
+        m_chunk_state = CHUNK_DATA;
+        return NO_REQUEST;
+    }
+    case CHUNK_DATA_END:
+        if (end != line)
+        {
+            return BAD_REQUEST;
+        }
+        m_chunk_state = CHUNK_SIZE;
+        return NO_REQUEST;
+    default: /* 尾部字段都忽略, 空行表示请求体结束 */
+        return end == line ? GET_REQUEST : NO_REQUEST;
+    }
+}
+
+bool http_conn::store_body(const char *data, size_t len)
+{
+    while (m_body_fd != -1 && len > 0)
+    {
+        ssize_t n = ::write(m_body_fd, data, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            LOG_ERROR("upload: write failed: %s", strerror(errno));
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+/*
+    URL的最后一段(不含查询串)就是上传目录中的文件名, 只允许字母、数字和"._-"并且不能以'.'开头,
+    不会跳出上传目录, 也不会与提交时使用的隐藏临时名字冲突
+*/
+bool http_conn::upload_target(char *path) const
+{
+    const char *end = m_url + strcspn(m_url, "?");
+    const char *name = end;
+    while (name > m_url && name[-1] != '/')
+    {
+        --name;
+    }
+    size_t len = end - name;
+    if (len == 0 || name[0] == '.' || m_upload_dir.size() + 1 + len >= (size_t)FILENAME_LEN)
+    {
+        return false;
+    }
+    for (const char *p = name; p < end; ++p)
+    {
+        char c = *p;
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '.' || c == '_' || c == '-'))
+        {
+            return false;
+        }
+    }
+    memcpy(path, m_upload_dir.data(), m_upload_dir.size());
+    path[m_upload_dir.size()] = '/';
+    memcpy(path + m_upload_dir.size() + 1, name, len);
+    path[m_upload_dir.size() + 1 + len] = '\0';
+    return true;
+}
+
+/*
+    请求体完整之后才让文件出现在上传目录中: 匿名临时文件先以隐藏的临时名字链接进目录, 再改名覆盖目标文件,
+    读者看到的要么是原来的文件要么是完整的新文件。上传中途断开时临时文件随文件描述符关闭而消失
+*/
+http_conn::HTTP_CODE http_conn::commit_upload()
+{
+    char target[FILENAME_LEN], temp[FILENAME_LEN], proc[32];
+    upload_target(target); /* begin_body已经检查过 */
+    /* 平滑重启(SIGUSR2)期间新旧两个进程同时写同一个上传目录, 同一个描述符号可能同时在用, 所以名字里带上进程号 */
+    snprintf(temp, sizeof(temp), "%s/.upload-%d-%d", m_upload_dir.c_str(), (int)getpid(), m_body_fd);
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", m_body_fd);
+    struct stat st;
+    bool existed = stat(target, &st) == 0;
+    unlink(temp); /* 上次异常退出时可能留下 */
+    bool ok = linkat(AT_FDCWD, proc, AT_FDCWD, temp, AT_SYMLINK_FOLLOW) == 0 && rename(temp, target) == 0;
+    if (!ok)
+    {
+        LOG_ERROR("upload: cannot store %s: %s", target, strerror(errno));
+        unlink(temp);
+    }
+    discard_upload();
+    return !ok ? INTERNAL_ERROR : existed ? UPLOAD_REPLACED : UPLOAD_CREATED;
+}
+
+void http_conn::discard_upload()
+{
+    if (m_body_fd != -1)
+    {
+        close(m_body_fd);
+        m_body_fd = -1;
+    }
+}
+
 http_conn::HTTP_CODE http_conn::process_read() /* 主状态机解析请求 */
 {
     LINE_STATUS line_status = LINE_OK;
@@ -259,7 +751,7 @@ http_conn::HTTP_CODE http_conn::process_read() /* 主状态机解析请求 */
     {
         text = get_line();
         m_start_line = m_checked_idx;
-        printf("got 1 http line: %s\n", text);
+        LOG_DEBUG("got 1 http line: %s", text);
 
         switch (m_check_state)
         {
@@ -275,31 +767,31 @@ http_conn::HTTP_CODE http_conn::process_read() /* 主状态机解析请求 */
         case CHECK_STATE_HEADER:
         {
             ret = parse_headers(text);
-            if (ret == BAD_REQUEST)
+            if (ret == GET_REQUEST)
             {
-                return BAD_REQUEST;
+                return do_request();
             }
-            else if (ret == GET_REQUEST)
+            else if (ret != NO_REQUEST) /* 语法错误或者begin_body拒绝了请求 */
             {
-                return do_request();
+                return ret;
             }
             break;
         }
         case CHECK_STATE_CONTENT:
         {
-            ret = parse_content(text);
+            ret = parse_content();
             if (ret == GET_REQUEST)
             {
                 return do_request();
             }
-            line_status = LINE_OPEN;
-            break;
+            return ret; /* 请求体没有收完时不能再调用parse_line, 它会越过不完整的块大小行 */
         }
         default:
         {
             return INTERNAL_ERROR;
         }
         }
+        m_line_colon = NULL; /* 下一行重新记录':'的位置 */
     }
     return NO_REQUEST;
 }
@@ -308,116 +800,511 @@ http_conn::HTTP_CODE http_conn::process_read() /* 主状态机解析请求 */
     当得到一个完整正确的HTTP请求时我们就分析目标文件的属性,如果目标文件存在对所有用户可读
     且不是目录,则使用mmap将其映射到内存地址m_file_address处并告诉调用者获取文件成功
 */
-http_conn::HTTP_CODE http_conn::do_request()
+http_conn::HTTP_CODE http_conn::do_request() /* 记录查找文件的耗时, 它不计入解析时间 */
 {
-    strcpy(m_real_file, doc_root); /* "/home/leejinqiao/LinuxStudy/Nowcoder/05--WebServer/resources" */
-    int len = strlen(doc_root);
-    strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
-
-    if (stat(m_real_file, &m_file_stat) < 0) /* 获取m_real_file文件的相关的状态信息 */
-    {
-        return NO_RESOURCE;
-    }
-
-    if (!(m_file_stat.st_mode & S_IROTH)) /* 判断访问权限 */
+    if (m_method == POST || m_method == PUT) /* 请求体已经全部写入临时文件 */
     {
-        return FORBIDDEN_REQUEST;
+        return commit_upload();
     }
-
-    if (S_ISDIR(m_file_stat.st_mode)) /* 判断是否是目录 */
+    size_t stats_len = strlen(stats_path);
+    if (strncmp(m_url, stats_path, stats_len) == 0 && (m_url[stats_len] == '\0' || m_url[stats_len] == '?'))
     {
-        return BAD_REQUEST;
+        return STATS_REQUEST; /* 统计页面不经过文件系统 */
     }
 
-    int fd = open(m_real_file, O_RDONLY); /* 以只读方式打开文件 */
-
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0); /* 创建内存映射 */
+    uint64_t start = latency_stats::now_ns();
+    HTTP_CODE ret = open_file();
+    m_lookup_ns = latency_stats::now_ns() - start;
+    latency_stats::record(latency_stats::LAT_FILE_LOOKUP, m_lookup_ns);
+    return ret == FILE_REQUEST && m_range_count > 0 ? PARTIAL_CONTENT : ret;
+}
+
+/*
+    客户端接受压缩编码并且请求的是文本类型时, 优先发送预先压缩好的同名文件(foo.js.br或foo.js.gz),
+    压缩文件比原文件旧(原文件更新后还没有重新压缩)时不使用。压缩文件和原文件一样经过缓存、
+    sendfile或mmap发送, Content-Type仍然按原文件名确定, 原文件不存在或不可读时也不发送压缩文件。
+    范围请求按原文件回答, 续传的字节偏移不会因为客户端这次的Accept-Encoding不同而错位
+*/
+http_conn::HTTP_CODE http_conn::open_file()
+{
+    char real_file[FILENAME_LEN]; /* 客户请求的目标文件的完整路径, 只在这里用到, 不必占用连接的空间 */
+    strcpy(real_file, doc_root);
+    int len = strlen(doc_root);
+    strncpy(real_file + len, m_url, FILENAME_LEN - len - 1);
+    real_file[FILENAME_LEN - 1] = '\0';
+    m_mime = &mime_of(real_file + len);
+    m_encoding = 0;
+
+    if (!m_precompressed || !m_mime->compressible || !m_accept_encoding || m_range)
+    {
+        return open_path(real_file, 0);
+    }
+
+    file_entry *entry = m_file_cache ? m_file_cache->lookup(real_file) : NULL;
+    time_t mtime;
+    if (entry)
+    {
+        mtime = entry->mtime;
+    }
+    else
+    {
+        struct stat file_stat;
+        if (stat(real_file, &file_stat) < 0 || !(file_stat.st_mode & S_IROTH) || S_ISDIR(file_stat.st_mode))
+        {
+            return open_path(real_file, 0); /* 按原来的流程返回相应的错误 */
+        }
+        mtime = file_stat.st_mtime;
+    }
+
+    static const struct
+    {
+        int encoding;
+        const char *suffix;
+    } variants[] = {{ENCODING_BR, ".br"}, {ENCODING_GZIP, ".gz"}}; /* 同时接受时br压缩率更高 */
+    size_t path_len = strlen(real_file);
+    for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); ++i)
+    {
+        if (!(m_accept_encoding & variants[i].encoding) || path_len + 4 > FILENAME_LEN)
+        {
+            continue;
+        }
+        char variant[FILENAME_LEN];
+        memcpy(variant, real_file, path_len);
+        strcpy(variant + path_len, variants[i].suffix);
+        m_encoding = variants[i].encoding;
+        HTTP_CODE ret = open_path(variant, mtime);
+        if (ret == FILE_REQUEST || ret == NOT_MODIFIED)
+        {
+            if (entry)
+            {
+                m_file_cache->release(entry);
+            }
+            return ret;
+        }
+        m_encoding = 0;
+    }
+    return entry ? attach_cache_entry(entry) : open_path(real_file, 0);
+}
+
+http_conn::HTTP_CODE http_conn::open_path(const char *real_file, time_t min_mtime)
+{
+    struct stat file_stat; /* 目标文件的状态(我们可以判断文件是否存在/为目录/可读并获取文件大小等信息) */
+    if (m_file_cache) /* 命中缓存时不需要stat/open/mmap */
+    {
+        file_entry *entry = m_file_cache->lookup(real_file);
+        if (entry && entry->mtime < min_mtime)
+        {
+            m_file_cache->release(entry);
+            return NO_RESOURCE;
+        }
+        if (entry)
+        {
+            return attach_cache_entry(entry);
+        }
+    }
+
+    if (stat(real_file, &file_stat) < 0 || file_stat.st_mtime < min_mtime) /* 获取real_file文件的相关的状态信息 */
+    {
+        return NO_RESOURCE;
+    }
+
+    if (!(file_stat.st_mode & S_IROTH)) /* 判断访问权限 */
+    {
+        return FORBIDDEN_REQUEST;
+    }
+
+    if (S_ISDIR(file_stat.st_mode)) /* 判断是否是目录 */
+    {
+        return BAD_REQUEST;
+    }
+
+    m_file_size = file_stat.st_size;
+    m_file_ino = file_stat.st_ino;
+    m_file_mtime = file_stat.st_mtime;
+    if (not_modified()) /* 客户端的副本仍然有效, 不需要打开文件 */
+    {
+        return NOT_MODIFIED;
+    }
+    if (m_method == HEAD) /* 只发送头部, 不需要打开和映射文件 */
+    {
+        return FILE_REQUEST;
+    }
+    if (!select_ranges())
+    {
+        return RANGE_NOT_SATISFIABLE;
+    }
+    int fd = open(real_file, O_RDONLY); /* 以只读方式打开文件 */
+    if (fd < 0)
+    {
+        return INTERNAL_ERROR;
+    }
+
+    if (m_file_cache) /* 加入缓存成功后文件描述符归缓存所有 */
+    {
+        file_entry *entry = m_file_cache->insert(real_file, fd, file_stat);
+        if (entry)
+        {
+            return attach_cache_entry(entry);
+        }
+    }
+
+    if (m_use_sendfile || m_file_size > m_mmap_max) /* 保留文件描述符, 由内核直接把页缓存中的数据发送到socket; 大文件不占用地址空间, 每次只发送socket缓冲区放得下的部分 */
+    {
+        m_file_fd = fd;
+        return FILE_REQUEST;
+    }
+
+    m_file_address = (char *)mmap(0, m_file_size, PROT_READ, MAP_PRIVATE, fd, 0); /* 创建内存映射 */
 
     close(fd);
     return FILE_REQUEST;
 }
 
-void http_conn::unmap() /* 对内存映射区执行munmap操作 */
+http_conn::HTTP_CODE http_conn::attach_cache_entry(file_entry *entry) /* 使用缓存中共享的映射和文件描述符发送文件 */
 {
-    if (m_file_address)
+    m_file_size = entry->size;
+    m_file_ino = entry->ino;
+    m_file_mtime = entry->mtime;
+    if (not_modified())
     {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+        m_file_cache->release(entry);
+        return NOT_MODIFIED;
+    }
+    if (m_method == HEAD)
+    {
+        m_file_cache->release(entry);
+        return FILE_REQUEST;
+    }
+    if (!select_ranges())
+    {
+        m_file_cache->release(entry);
+        return RANGE_NOT_SATISFIABLE;
+    }
+    m_cache_entry = entry;
+    if (m_use_sendfile)
+    {
+        m_file_fd = entry->fd;
+    }
+    else
+    {
+        m_file_address = entry->data;
     }
+    return FILE_REQUEST;
 }
 
-bool http_conn::write() /* 写HTTP响应 */
+/*
+    If-None-Match优先, 按弱比较匹配当前的ETag(包括"*"); 没有If-None-Match时按If-Modified-Since比较修改时间。
+    只用已经取得的inode、大小和修改时间, 不需要打开文件
+*/
+bool http_conn::not_modified() const
 {
-    int temp = 0;
+    if (m_if_none_match)
+    {
+        char etag[64];
+        int len = render_etag(etag, m_file_ino, m_file_size, m_file_mtime, time(NULL));
+        return etag_list_matches(byte_span{m_if_none_match, strlen(m_if_none_match)}, byte_span{etag, (size_t)len});
+    }
+    return m_if_modified_since != -1 && m_file_mtime <= m_if_modified_since;
+}
 
-    if (bytes_to_send == 0) // 将要发送的字节为0这一次响应结束
+/*
+    If-Range中的实体标签按强比较, 弱标签永远不匹配; HTTP日期必须与Last-Modified完全相同,
+    并且文件不是在最近一秒内修改的(否则Last-Modified不是强验证器)。不匹配时发送整个文件
+*/
+bool http_conn::if_range_matches() const
+{
+    if (!m_if_range)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        init();
         return true;
     }
+    time_t now = time(NULL);
+    if (m_if_range[0] == '"')
+    {
+        char etag[64];
+        int len = render_etag(etag, m_file_ino, m_file_size, m_file_mtime, now);
+        return etag[0] == '"' && strlen(m_if_range) == (size_t)len && memcmp(m_if_range, etag, len) == 0;
+    }
+    return m_file_mtime < now && parse_http_date(m_if_range) == m_file_mtime;
+}
+
+/*
+    在决定发送文件之后、打开文件之前按文件大小解析Range, 条件请求已经先判断过。
+    范围放在这一批响应的发送状态中, 紧接着由process_write使用
+*/
+bool http_conn::select_ranges()
+{
+    m_range_count = 0;
+    if (!m_range || !if_range_matches() || !acquire_write_block())
+    {
+        return true;
+    }
+    int count = parse_range(byte_span{m_range, strlen(m_range)}, m_file_size, m_wblock->ranges, MAX_RANGES);
+    if (count < 0)
+    {
+        return false;
+    }
+    m_range_count = count;
+    return true;
+}
+
+void http_conn::hold_file() /* 把当前请求的文件交给这一批响应, 整批发送完后统一释放 */
+{
+    if (!m_file_address && m_file_fd == -1 && !m_cache_entry && !m_aux_buffer)
+    {
+        return;
+    }
+    file_ref &file = m_wblock->files[m_file_count++];
+    file.address = m_file_address;
+    file.size = m_file_size;
+    file.fd = m_file_fd;
+    file.entry = m_cache_entry;
+    file.aux = m_aux_buffer;
+    m_file_address = 0;
+    m_file_fd = -1;
+    m_cache_entry = NULL;
+    m_aux_buffer = NULL;
+}
+
+void http_conn::release_file(const file_ref &file)
+{
+    if (file.aux)
+    {
+        m_buffers.free(file.aux, AUX_BUFFER_SIZE);
+    }
+    if (file.entry) /* 缓存的映射和文件描述符是共享的, 只释放引用 */
+    {
+        m_file_cache->release(file.entry);
+        return;
+    }
+    if (file.address)
+    {
+        munmap(file.address, file.size);
+    }
+    if (file.fd != -1)
+    {
+        close(file.fd);
+    }
+}
+
+void http_conn::unmap() /* 对这一批响应的内存映射区执行munmap操作, sendfile模式下关闭文件 */
+{
+    if (m_file_address || m_file_fd != -1 || m_cache_entry || m_aux_buffer) /* 生成响应失败时当前请求的文件还没有交给这一批响应 */
+    {
+        file_ref file = {m_file_address, m_file_size, m_file_fd, m_cache_entry, m_aux_buffer};
+        release_file(file);
+        m_file_address = 0;
+        m_file_fd = -1;
+        m_cache_entry = NULL;
+        m_aux_buffer = NULL;
+    }
+    for (int i = 0; i < m_file_count; ++i)
+    {
+        release_file(m_wblock->files[i]);
+    }
+    m_file_count = 0;
+}
+
+void http_conn::add_part(const char *addr, off_t off, size_t len, int fd) /* 在这一批响应末尾追加一个数据块 */
+{
+    if (len == 0)
+    {
+        return;
+    }
+    bytes_to_send += len;
+    if (m_part_count > 0 && !addr && fd == -1) /* 写缓冲区中相邻的数据合并成一块 */
+    {
+        out_part &last = m_wblock->parts[m_part_count - 1];
+        if (!last.addr && last.fd == -1 && last.off + (off_t)last.len == off)
+        {
+            last.len += len;
+            return;
+        }
+    }
+    out_part &part = m_wblock->parts[m_part_count++];
+    part.addr = addr;
+    part.off = off;
+    part.len = len;
+    part.fd = fd;
+}
 
-    while (1)
+void http_conn::add_file_part(off_t off, off_t len) /* sendfile发送时按偏移读文件, 否则指向映射中的对应位置 */
+{
+    if (m_file_fd != -1)
+    {
+        add_part(NULL, off, len, m_file_fd);
+    }
+    else
+    {
+        add_part(m_file_address, off, len, -1);
+    }
+}
+
+/*
+    从m_part_idx开始发送一次: 文件块用sendfile发送; 连续的内存块合并成一次分散写,
+    后面紧跟文件块时用sendmsg带上MSG_MORE, 让内核把响应头和随后的文件数据合并成满的TCP报文段
+*/
+ssize_t http_conn::send_parts()
+{
+    syscall_stats::count(syscall_stats::SC_WRITE);
+    const out_part &first = current_part();
+    if (first.fd != -1)
+    {
+        off_t off = first.off; /* 进度统一由advance推进 */
+        return sendfile(m_sockfd, first.fd, &off, first.len);
+    }
+
+    struct iovec iv[MAX_PARTS];
+    bool file_follows = false;
+    int count = gather_parts(iv, MAX_PARTS, file_follows);
+    if (!file_follows)
+    {
+        return writev(m_sockfd, iv, count);
+    }
+    struct msghdr msg;
+    bzero(&msg, sizeof(msg));
+    msg.msg_iov = iv;
+    msg.msg_iovlen = count;
+    return sendmsg(m_sockfd, &msg, MSG_MORE);
+}
+
+int http_conn::gather_parts(struct iovec *iv, int max, bool &file_follows)
+{
+    int count = 0;
+    int i = m_part_idx;
+    for (; i < m_part_count && count < max && m_wblock->parts[i].fd == -1; ++i, ++count)
+    {
+        const char *base = m_wblock->parts[i].addr ? m_wblock->parts[i].addr : write_buf();
+        iv[count].iov_base = (char *)base + m_wblock->parts[i].off;
+        iv[count].iov_len = m_wblock->parts[i].len;
+    }
+    file_follows = i < m_part_count && m_wblock->parts[i].fd != -1;
+    return count;
+}
+
+bool http_conn::advance(size_t n) /* 按实际发送的字节数推进数据块 */
+{
+    server_stats::add(server_stats::ST_BYTES_SENT, n);
+    bytes_have_send += n;
+    bytes_to_send -= n;
+    while (n > 0 && m_part_idx < m_part_count)
+    {
+        out_part &part = m_wblock->parts[m_part_idx];
+        size_t done = n < part.len ? n : part.len;
+        part.off += done;
+        part.len -= done;
+        n -= done;
+        if (part.len == 0)
+        {
+            m_part_idx++;
+        }
+    }
+    return bytes_to_send <= 0;
+}
+
+bool http_conn::end_batch() /* 释放这一批响应引用的文件, 返回false表示需要关闭连接 */
+{
+    if (m_batch_requests > 0) /* 只有100 Continue的一批不计入响应时间 */
+    {
+        latency_stats::record(latency_stats::LAT_TTLB, latency_stats::now_ns() - m_batch_start, m_batch_requests);
+    }
+    unmap();
+    if (!m_keep_alive)
+    {
+        return false;
+    }
+    finish_batch();
+    return true;
+}
+
+bool http_conn::flush(bool &blocked) /* 发送这一批响应直到全部发完或者TCP写缓冲满 */
+{
+    blocked = false;
+    while (bytes_to_send > 0)
     {
-        temp = writev(m_sockfd, m_iv, m_iv_count); // 分散写
+        ssize_t temp = send_parts(); // 分散写或sendfile
         if (temp <= -1)
         {
-            /*
-                如果TCP写缓冲没有空间则等待下一轮EPOLLOUT事件,虽然在此期间
-                服务器无法立即接收到同一客户的下一个请求但可以保证连接的完整性
-            */
             if (errno == EAGAIN)
             {
-                modfd(m_epollfd, m_sockfd, EPOLLOUT);
+                blocked = true;
                 return true;
             }
             unmap();
             return false;
         }
-
-        bytes_have_send += temp;
-        bytes_to_send -= temp;
-
-        if (bytes_have_send >= m_iv[0].iov_len)
+        if (temp == 0) // 文件在发送过程中被截断
         {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
+            unmap();
+            return false;
         }
-        else
+        if (advance(temp)) // 这一批响应全部发送完毕
         {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - temp;
+            return end_batch();
         }
+    }
+    return true;
+}
 
-        if (bytes_to_send <= 0) // 没有数据要发送
-        {
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
+bool http_conn::write() /* 写HTTP响应 */
+{
+    bool rearmed;
+    return send_batch(rearmed);
+}
 
-            if (m_linger)
-            {
-                init();
-                return true;
-            }
-            else
-            {
-                return false;
-            }
-        }
+/*
+    线程池模式下重新注册EPOLLONESHOT事件之后, reactor随时可能读这个连接或者把它交给另一个工作线程,
+    所以rearmed为true时调用者不能再访问连接的任何状态; 只有读缓冲区中还有流水线请求时不注册事件
+*/
+bool http_conn::send_batch(bool &rearmed)
+{
+    rearmed = true;
+    if (bytes_to_send == 0) // 将要发送的字节为0这一次响应结束
+    {
+        rearm(EPOLLIN);
+        return true;
+    }
+
+    bool blocked;
+    if (!flush(blocked))
+    {
+        rearmed = false;
+        return false;
     }
+    /*
+        如果TCP写缓冲没有空间则等待下一轮EPOLLOUT事件,虽然在此期间
+        服务器无法立即接收到同一客户的下一个请求但可以保证连接的完整性
+    */
+    if (blocked)
+    {
+        rearm(EPOLLOUT);
+        return true;
+    }
+    if (m_read_idx == 0)
+    {
+        rearm(EPOLLIN);
+        return true;
+    }
+
+    // 读缓冲区中还有流水线请求, 不必等新数据到来就继续处理
+    if (m_inline)
+    {
+        rearm(EPOLLIN);
+        return process_inline();
+    }
+    rearmed = false; // 线程池模式下由调用者(工作线程或者reactor)继续处理, 此时不能注册EPOLLIN, 否则会有两个线程同时处理这个连接
+    return true;
 }
 
 bool http_conn::add_response(const char *format, ...) /* 往写缓冲中写入待发送的数据 */
 {
-    if (m_write_idx >= WRITE_BUFFER_SIZE)
+    if (m_write_idx >= m_write_buffer_size)
     {
         return false;
     }
     va_list arg_list;
     va_start(arg_list, format);
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
-    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx))
+    int len = vsnprintf(write_buf() + m_write_idx, m_write_buffer_size - 1 - m_write_idx, format, arg_list);
+    if (len >= (m_write_buffer_size - 1 - m_write_idx))
     {
         return false;
     }
@@ -426,115 +1313,606 @@ bool http_conn::add_response(const char *format, ...) /* 往写缓冲中写入
     return true;
 }
 
-bool http_conn::add_status_line(int status, const char *title) /* 填入响应报文行 */
+bool http_conn::add_span(const byte_span &span) /* 往写缓冲中追加一段预先生成的字节 */
+{
+    if (m_write_idx + (int)span.len >= m_write_buffer_size)
+    {
+        return false;
+    }
+    memcpy(write_buf() + m_write_idx, span.data, span.len);
+    m_write_idx += span.len;
+    return true;
+}
+
+bool http_conn::add_status_line(const byte_span &line) /* 填入响应报文行 */
+{
+    return add_span(line);
+}
+
+bool http_conn::add_headers(off_t content_len) /* 填入文件响应的头部字段 */
+{
+    return add_content_length(content_len) && add_validators() && add_file_headers(&m_mime->header);
+}
+
+bool http_conn::add_validators()
+{
+    if (m_write_idx + 15 + 29 + 2 >= m_write_buffer_size) /* 日期固定29字节 */
+    {
+        return false;
+    }
+    char *buf = write_buf();
+    m_write_idx += append_span(buf + m_write_idx, header_span::last_modified());
+    m_write_idx += render_http_date(buf + m_write_idx, m_file_mtime);
+    m_write_idx += append_span(buf + m_write_idx, header_span::crlf());
+    return add_etag();
+}
+
+bool http_conn::add_etag()
+{
+    if (m_write_idx + 6 + 64 + 2 >= m_write_buffer_size) /* ETag不超过64字节 */
+    {
+        return false;
+    }
+    char *buf = write_buf();
+    m_write_idx += append_span(buf + m_write_idx, header_span::etag());
+    m_write_idx += render_etag(buf + m_write_idx, m_file_ino, m_file_size, m_file_mtime, time(NULL));
+    m_write_idx += append_span(buf + m_write_idx, header_span::crlf());
+    return true;
+}
+
+bool http_conn::add_file_headers(const byte_span *type) /* 304只带验证和缓存相关的头部, 没有Content-Type */
 {
-    return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
+    if (type && (!add_span(*type) || !add_span(header_span::accept_ranges())))
+    {
+        return false;
+    }
+    if (type && m_encoding &&
+        !add_span(m_encoding == ENCODING_BR ? header_span::encoding_br() : header_span::encoding_gzip()))
+    {
+        return false;
+    }
+    if (!m_cache_control.empty() && !add_span(byte_span{m_cache_control.data(), m_cache_control.size()}))
+    {
+        return false;
+    }
+    if (m_precompressed && m_mime->compressible && !add_span(header_span::vary_encoding())) /* 不压缩的响应也要告诉缓存它随Accept-Encoding变化 */
+    {
+        return false;
+    }
+    return add_linger() && add_blank_line();
 }
 
-bool http_conn::add_headers(int content_len) /* 填入响应报文的头部字段 */
+bool http_conn::add_content_length(off_t content_len)
 {
-    add_content_length(content_len);
-    add_content_type();
-    add_linger();
-    add_blank_line();
+    byte_span name = header_span::content_length();
+    if (m_write_idx + (int)name.len + 20 + 2 >= m_write_buffer_size) /* 20位足够放下任何64位整数 */
+    {
+        return false;
+    }
+    memcpy(write_buf() + m_write_idx, name.data, name.len);
+    m_write_idx += name.len;
+    m_write_idx += u64_to_dec(write_buf() + m_write_idx, content_len);
+    write_buf()[m_write_idx++] = '\r';
+    write_buf()[m_write_idx++] = '\n';
     return true;
 }
 
-bool http_conn::add_content_length(int content_len)
+bool http_conn::add_content_range(const byte_range *range)
 {
-    return add_response("Content-Length: %d\r\n", content_len);
+    if (m_write_idx + 85 >= m_write_buffer_size)
+    {
+        return false;
+    }
+    m_write_idx += render_content_range(write_buf() + m_write_idx, range ? range->first : -1, range ? range->last : 0,
+                                        m_file_size);
+    return true;
 }
 
 bool http_conn::add_linger()
 {
-    return add_response("Connection: %s\r\n", (m_linger == true) ? "keep-alive" : "close");
+    return add_span(m_linger ? header_span::keep_alive() : header_span::close());
 }
 
 bool http_conn::add_blank_line()
 {
-    return add_response("%s", "\r\n");
+    return add_span(header_span::crlf());
 }
 
 bool http_conn::add_content(const char *content)
 {
-    return add_response("%s", content);
+    return add_span(byte_span{content, strlen(content)});
 }
 
 bool http_conn::add_content_type()
 {
-    return add_response("Content-Type:%s\r\n", "text/html");
+    return add_span(header_span::content_type_html());
+}
+
+/*
+    常见错误响应除了Connection头部以外全部在编译期确定,
+    按顺序拷贝状态行、Content-Length、Content-Type、Connection、空行和错误页面(HEAD请求不发送)
+*/
+template <int STATUS>
+bool http_conn::add_canned_response(const byte_span *extra)
+{
+    server_stats::count_status(STATUS);
+    return add_status_line(http_status<STATUS>::line()) && add_span(header_span::content_length()) &&
+           add_span(http_status<STATUS>::body_length()) && add_span(header_span::crlf()) &&
+           add_content_type() && (!extra || add_span(*extra)) && add_linger() && add_blank_line() &&
+           (m_method == HEAD || add_span(http_status<STATUS>::body()));
+}
+
+bool http_conn::add_continue() /* 临时响应不计入请求数, 最终响应在请求体收完后生成 */
+{
+    if (!acquire_write_block())
+    {
+        return false;
+    }
+    int start = m_write_idx;
+    if (!add_status_line(http_status<100>::line()) || !add_blank_line())
+    {
+        return false;
+    }
+    add_part(NULL, start, m_write_idx - start, -1);
+    m_keep_alive = true; /* 这一批只有临时响应, 发完后不能关闭连接 */
+    return true;
+}
+
+/*
+    统计页面的长度不固定, 可能放不进写缓冲区, 所以从缓冲池取一块缓冲区放响应体,
+    像文件映射一样交给这一批响应, 发送完后归还
+*/
+bool http_conn::add_stats_response()
+{
+    bool prometheus = strstr(m_url, "format=prometheus") != NULL;
+    size_t capacity;
+    char *body = m_buffers.alloc(AUX_BUFFER_SIZE, capacity);
+    if (!body)
+    {
+        return false;
+    }
+    m_aux_buffer = body; /* 失败时由unmap归还 */
+    int len = server_stats::render(body, AUX_BUFFER_SIZE, prometheus);
+    if (len < 0)
+    {
+        return false;
+    }
+    m_file_size = len;
+    server_stats::count_status(200);
+    return add_status_line(http_status<200>::line()) && add_content_length(len) &&
+           add_span(prometheus ? header_span::content_type_prometheus() : header_span::content_type_json()) &&
+           add_span(header_span::no_store()) && add_linger() && add_blank_line();
+}
+
+/*
+    一个范围时和200响应一样是头部加文件中的一段。多个范围时响应体是multipart/byteranges,
+    每段数据之前是分隔线和这一段的Content-Type/Content-Range, 最后是结束分隔线; 这些分段头部放在从缓冲池
+    取得的缓冲区中, 全部生成之后才能算出Content-Length。分隔符取生成响应时的纳秒时间, 不需要线程之间共享状态
+*/
+bool http_conn::add_partial_response(int header_start)
+{
+    const byte_range *ranges = m_wblock->ranges;
+    if (m_range_count == 1)
+    {
+        off_t len = ranges[0].last - ranges[0].first + 1;
+        if (!add_status_line(http_status<206>::line()) || !add_content_range(&ranges[0]) || !add_headers(len))
+        {
+            return false;
+        }
+        add_part(NULL, header_start, m_write_idx - header_start, -1);
+        add_file_part(ranges[0].first, len);
+        return true;
+    }
+
+    size_t capacity;
+    char *aux = m_buffers.alloc(AUX_BUFFER_SIZE, capacity);
+    if (!aux)
+    {
+        return false;
+    }
+    m_aux_buffer = aux; /* 失败时由unmap归还 */
+    char boundary[16];
+    int boundary_len = u64_to_hex(boundary, latency_stats::now_ns());
+    int segment_end[MAX_RANGES + 1]; /* 每个分段头部在缓冲区中的结束位置, 最后一个是结束分隔线 */
+    int pos = 0;
+    off_t body_len = 0;
+    for (int i = 0; i <= m_range_count; ++i)
+    {
+        if (pos + 8 + boundary_len + (int)m_mime->header.len + 85 + 2 > AUX_BUFFER_SIZE)
+        {
+            return false;
+        }
+        char *p = aux + pos;
+        if (i > 0)
+        {
+            p += append_span(p, header_span::crlf());
+        }
+        *p++ = '-';
+        *p++ = '-';
+        memcpy(p, boundary, boundary_len);
+        p += boundary_len;
+        if (i == m_range_count)
+        {
+            memcpy(p, "--\r\n", 4);
+            p += 4;
+        }
+        else
+        {
+            p += append_span(p, header_span::crlf());
+            p += append_span(p, m_mime->header);
+            p += render_content_range(p, ranges[i].first, ranges[i].last, m_file_size);
+            p += append_span(p, header_span::crlf());
+            body_len += ranges[i].last - ranges[i].first + 1;
+        }
+        pos = p - aux;
+        segment_end[i] = pos;
+    }
+    body_len += pos;
+
+    char type[96];
+    byte_span prefix = header_span::multipart_byteranges();
+    size_t type_len = append_span(type, prefix);
+    memcpy(type + type_len, boundary, boundary_len);
+    type_len += boundary_len;
+    type_len += append_span(type + type_len, header_span::crlf());
+    byte_span type_span = {type, type_len};
+    if (!add_status_line(http_status<206>::line()) || !add_content_length(body_len) || !add_validators() ||
+        !add_file_headers(&type_span))
+    {
+        return false;
+    }
+    add_part(NULL, header_start, m_write_idx - header_start, -1);
+    int segment_start = 0;
+    for (int i = 0; i < m_range_count; ++i)
+    {
+        add_part(aux, segment_start, segment_end[i] - segment_start, -1);
+        add_file_part(ranges[i].first, ranges[i].last - ranges[i].first + 1);
+        segment_start = segment_end[i];
+    }
+    add_part(aux, segment_start, segment_end[m_range_count] - segment_start, -1);
+    return true;
 }
 
 bool http_conn::process_write(HTTP_CODE ret) /* 根据服务器处理HTTP请求的结果决定返回给客户端的内容 */
 {
+    if (!acquire_write_block())
+    {
+        return false;
+    }
+    int header_start = m_write_idx; /* 同一批中前面响应的头部还在写缓冲区中 */
     switch (ret)
     {
     case INTERNAL_ERROR:
-        add_status_line(500, error_500_title);
-        add_headers(strlen(error_500_form));
-        if (!add_content(error_500_form))
+        if (!add_canned_response<500>())
         {
             return false;
         }
         break;
     case BAD_REQUEST:
-        add_status_line(400, error_400_title);
-        add_headers(strlen(error_400_form));
-        if (!add_content(error_400_form))
+        if (!add_canned_response<400>())
         {
             return false;
         }
         break;
     case NO_RESOURCE:
-        add_status_line(404, error_404_title);
-        add_headers(strlen(error_404_form));
-        if (!add_content(error_404_form))
+        if (!add_canned_response<404>())
         {
             return false;
         }
         break;
     case FORBIDDEN_REQUEST:
-        add_status_line(403, error_403_title);
-        add_headers(strlen(error_403_form));
-        if (!add_content(error_403_form))
+        if (!add_canned_response<403>())
         {
             return false;
         }
         break;
+    case STATS_REQUEST:
+        if (!add_stats_response())
+        {
+            return false;
+        }
+        add_part(NULL, header_start, m_write_idx - header_start, -1);
+        if (m_method != HEAD)
+        {
+            add_part(m_aux_buffer, 0, m_file_size, -1);
+        }
+        hold_file();
+        return true;
     case FILE_REQUEST:
-        add_status_line(200, ok_200_title);
-        add_headers(m_file_stat.st_size);
-        m_iv[0].iov_base = m_write_buf;
-        m_iv[0].iov_len = m_write_idx;
-        m_iv[1].iov_base = m_file_address;
-        m_iv[1].iov_len = m_file_stat.st_size;
-        m_iv_count = 2;
-        bytes_to_send = m_write_idx + m_file_stat.st_size;
+        server_stats::count_status(200);
+        if (m_cache_entry) /* 缓存中已经有生成好的状态行、Content-Length和Last-Modified */
+        {
+            if (!add_span(byte_span{m_cache_entry->header, (size_t)m_cache_entry->header_len}) || !add_etag() ||
+                !add_file_headers(&m_mime->header))
+            {
+                return false;
+            }
+        }
+        else if (!add_status_line(http_status<200>::line()) || !add_headers(m_file_size))
+        {
+            return false;
+        }
+        add_part(NULL, header_start, m_write_idx - header_start, -1);
+        if (m_method != HEAD) /* HEAD没有打开文件 */
+        {
+            add_file_part(0, m_file_size);
+        }
+        hold_file();
         return true;
+    case PARTIAL_CONTENT:
+        server_stats::count_status(206);
+        if (!add_partial_response(header_start))
+        {
+            return false;
+        }
+        hold_file();
+        return true;
+    case NOT_MODIFIED:
+        server_stats::count_status(304);
+        if (!add_status_line(http_status<304>::line()) || !add_validators() || !add_file_headers(NULL))
+        {
+            return false;
+        }
+        break;
+    case METHOD_NOT_ALLOWED:
+    {
+        byte_span allow = header_span::allow();
+        if (!add_canned_response<405>(&allow))
+        {
+            return false;
+        }
+        break;
+    }
+    case BODY_TOO_LARGE:
+        if (!add_canned_response<413>())
+        {
+            return false;
+        }
+        break;
+    case UPLOAD_CREATED:
+        server_stats::count_status(201);
+        if (!add_status_line(http_status<201>::line()) || !add_content_length(0) || !add_linger() || !add_blank_line())
+        {
+            return false;
+        }
+        break;
+    case UPLOAD_REPLACED: /* 204响应不能带Content-Length */
+        server_stats::count_status(204);
+        if (!add_status_line(http_status<204>::line()) || !add_linger() || !add_blank_line())
+        {
+            return false;
+        }
+        break;
+    case RANGE_NOT_SATISFIABLE:
+        server_stats::count_status(416);
+        if (!add_status_line(http_status<416>::line()) || !add_content_range(NULL) || !add_content_length(0) ||
+            !add_linger() || !add_blank_line())
+        {
+            return false;
+        }
+        break;
     default:
         return false;
     }
 
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    add_part(NULL, header_start, m_write_idx - header_start, -1);
     return true;
 }
 
-void http_conn::process() /* 由线程池中的工作线程调用这是处理HTTP请求的入口函数 */
+int http_conn::status_of(HTTP_CODE ret) /* 处理结果对应的状态码 */
 {
-    HTTP_CODE read_ret = process_read(); /* 解析HTTP请求 */
-    if (read_ret == NO_REQUEST)
+    switch (ret)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        return;
+    case BAD_REQUEST:
+        return 400;
+    case NO_RESOURCE:
+        return 404;
+    case FORBIDDEN_REQUEST:
+        return 403;
+    case FILE_REQUEST:
+    case STATS_REQUEST:
+        return 200;
+    case PARTIAL_CONTENT:
+        return 206;
+    case NOT_MODIFIED:
+        return 304;
+    case RANGE_NOT_SATISFIABLE:
+        return 416;
+    case UPLOAD_CREATED:
+        return 201;
+    case UPLOAD_REPLACED:
+        return 204;
+    case METHOD_NOT_ALLOWED:
+        return 405;
+    case BODY_TOO_LARGE:
+        return 413;
+    default:
+        return 500;
+    }
+}
+
+bool http_conn::batch_full() const /* 每个响应最多占一个文件和两个数据块(多段范围响应占2 + 2 * MAX_RANGES块), 写缓冲区还要放得下一个文件响应的全部头部或者一个错误页面 */
+{
+    return m_file_count >= MAX_PIPELINE || m_part_count + 2 + 2 * MAX_RANGES > MAX_PARTS ||
+           m_write_idx + 640 > m_write_buffer_size;
+}
+
+void http_conn::next_request() /* 当前请求到此结束(请求体已经被parse_content从读缓冲区中消费掉), 后面的字节属于下一个请求 */
+{
+    int end = m_checked_idx;
+    discard_upload();
+    m_request_start = end;
+    m_start_line = end;
+    m_checked_idx = end;
+
+    m_check_state = CHECK_STATE_REQUESTLINE;
+    m_linger = false;
+    m_method = GET;
+    m_url = 0;
+    m_version = 0;
+    m_host = 0;
+    m_content_length = 0;
+    m_chunked = false;
+    m_expect_continue = false;
+    m_accept_encoding = 0;
+    m_if_none_match = NULL;
+    m_if_modified_since = -1;
+    m_range = NULL;
+    m_if_range = NULL;
+    m_range_count = 0;
+    m_line_len = 0;
+    m_line_colon = NULL;
+}
+
+/*
+    一批响应发送完后重置写状态, 并把还没有处理的字节(下一个请求的全部或者一部分)移到读缓冲区开头,
+    正在解析的请求已经记录的位置和指针一起平移, 解析状态保持不变。没有剩余数据时归还缓冲区
+*/
+void http_conn::finish_batch()
+{
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    m_write_idx = 0;
+    m_part_count = 0;
+    m_part_idx = 0;
+    m_keep_alive = false;
+    m_batch_requests = 0;
+
+    int delta = m_request_start;
+    if (delta > 0)
+    {
+        memmove(m_read_buf, m_read_buf + delta, m_read_idx - delta);
+        move_read_ptrs(m_read_buf + delta, m_read_buf);
+        m_read_idx -= delta;
+        m_checked_idx -= delta;
+        m_start_line -= delta;
+        m_request_start = 0;
+    }
+    release_buffers();
+}
+
+/*
+    HTTP/1.1流水线: 客户端可以不等响应就连续发送多个请求。依次解析读缓冲区中所有完整的请求,
+    把它们的响应按顺序追加到同一批数据块中一起发送, 不完整的请求留在缓冲区中等待更多数据。
+    返回false表示需要关闭连接
+*/
+bool http_conn::process_batch()
+{
+    while (!batch_full())
+    {
+        uint64_t start = latency_stats::now_ns();
+        HTTP_CODE read_ret = process_read(); /* 解析HTTP请求 */
+        m_parse_ns += latency_stats::now_ns() - start - m_lookup_ns; /* 请求分几次到达时解析时间累加 */
+        m_lookup_ns = 0;
+        if (read_ret == NO_REQUEST)
+        {
+            break;
+        }
+        latency_stats::record(latency_stats::LAT_PARSE, m_parse_ns);
+        m_parse_ns = 0;
+        if (m_batch_requests++ == 0) /* 这一批的第一个响应, 响应时间从读到它的那次recv算起 */
+        {
+            m_batch_start = m_read_at;
+        }
+        if (read_ret == BAD_REQUEST || io_loop::draining()) /* 语法错误之后无法确定下一个请求从哪里开始; 服务器正在退出。回复后关闭连接 */
+        {
+            m_linger = false;
+        }
+        off_t before = bytes_to_send;
+        if (!process_write(read_ret)) /* 生成响应 */
+        {
+            return false;
+        }
+        if (logger::access_enabled())
+        {
+            logger::access(m_address, method_names[m_method], m_url ? m_url : "-", status_of(read_ret), bytes_to_send - before);
+        }
+        syscall_stats::count_request();
+        m_keep_alive = m_linger;
+        if (!m_linger) /* 这个响应之后关闭连接, 后面的请求不再处理 */
+        {
+            break;
+        }
+        next_request();
+    }
+    if (m_read_stalled) /* 上次read因为读缓冲区满提前返回 */
+    {
+        if (m_read_idx < m_read_size)
+        {
+            resume_read();
+        }
+        else if (bytes_to_send == 0) /* 一个请求的头部就占满了读缓冲区 */
+        {
+            return false;
+        }
     }
+    return true;
+}
 
-    bool write_ret = process_write(read_ret); /* 生成响应 */
-    if (!write_ret)
+/*
+    由线程池中的工作线程调用这是处理HTTP请求的入口函数。
+    生成响应后直接在工作线程中发送, 大多数响应一次就能写完, 发完后只需要重新注册一次EPOLLIN;
+    只有TCP写缓冲满时才注册EPOLLOUT交回reactor, 省去每个请求一次EPOLLOUT的epoll_ctl和epoll_wait
+*/
+void http_conn::process()
+{
+    uint64_t delay = latency_stats::now_ns() - m_queued_at;
+    overload_control::record_delay(delay);
+    latency_stats::record(latency_stats::LAT_QUEUE_WAIT, delay);
+    while (true)
     {
-        close_conn();
+        if (!process_batch())
+        {
+            close_conn();
+            break;
+        }
+        if (bytes_to_send == 0) /* 请求不完整 */
+        {
+            rearm(EPOLLIN);
+            break;
+        }
+        bool rearmed;
+        if (!send_batch(rearmed))
+        {
+            close_conn();
+            break;
+        }
+        if (rearmed) /* 已经注册了EPOLLIN或EPOLLOUT, 连接可能已经交给了别的线程 */
+        {
+            break;
+        }
+    }
+    m_pending--; /* 与reactor投递任务时的自增配对 */
+}
+
+bool http_conn::feed(const char *data, size_t len) /* 异步后端把内核放在公共缓冲区中的数据拷贝到读缓冲区 */
+{
+    while (m_read_size - m_read_idx < (int)len)
+    {
+        if (!grow_read_buf())
+        {
+            return false;
+        }
     }
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
-}
\ No newline at end of file
+    memcpy(m_read_buf + m_read_idx, data, len);
+    m_read_idx += len;
+    m_read_at = latency_stats::now_ns();
+    return true;
+}
+
+bool http_conn::process_inline() /* 多reactor模式下由连接所属的reactor线程直接调用,生成响应后立即尝试发送 */
+{
+    if (bytes_to_send > 0) /* 上一批响应还没有发完, 新读到的请求等它发完后再处理 */
+    {
+        return true;
+    }
+    if (!process_batch())
+    {
+        return false;
+    }
+    if (bytes_to_send == 0) /* 请求不完整,连接仍然注册着EPOLLIN事件 */
+    {
+        return true;
+    }
+    return write(); /* 只有TCP写缓冲满时才需要等待EPOLLOUT事件 */
+}
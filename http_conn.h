@@ -19,18 +19,34 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <sys/uio.h>
+#include <atomic>
+#include <string>
 #include "locker.h"
+#include "timer_wheel.h"
+#include "file_cache.h"
+#include "response.h"
+#include "http_parser.h"
+#include "buffer_pool.h"
+
+template <typename T>
+class threadpool;
 
 class http_conn
 {
 public:
     static const int FILENAME_LEN = 200;       // 文件名的最大长度
-    static const int READ_BUFFER_SIZE = 2048;  // 读缓冲区的大小
-    static const int WRITE_BUFFER_SIZE = 1024; // 写缓冲区的大小
+    static const int MAX_PIPELINE = 16;        // 一批最多合并发送的流水线请求的响应数
+    static const int MAX_RANGES = 8;           // 一个Range请求最多回应的范围数, 超过时发送整个文件
+    static const int MAX_PARTS = 2 * MAX_PIPELINE + 2 * MAX_RANGES; // 一批响应最多包含的数据块数(每个响应为头部加文件, 多段范围响应每段两块)
+    static const int AUX_BUFFER_SIZE = 4096;   // 统计页面或者多段范围响应的分段头部所用缓冲区的大小
+    static const int MAX_CHUNK_LINE = 1024;    // 分块编码的块大小行(包括块扩展)和尾部字段的最大长度
 
-    enum METHOD // HTTP请求方法这里只支持GET
+    enum METHOD // 支持的HTTP请求方法, POST和PUT把请求体上传到上传目录
     {
-        GET = 0
+        GET = 0,
+        HEAD,
+        POST,
+        PUT
     };
 
     enum CHECK_STATE // 解析客户端请求时主状态机的状态
@@ -40,6 +56,14 @@ public:
         CHECK_STATE_CONTENT          // 当前正在解析请求体
     };
 
+    enum CHUNK_STATE // 分块编码的请求体解析到的位置
+    {
+        CHUNK_SIZE = 0, // 等待块大小行
+        CHUNK_DATA,     // 块数据, 还剩m_body_left字节
+        CHUNK_DATA_END, // 块数据之后的CRLF
+        CHUNK_TRAILER   // 大小为0的最后一块之后的尾部字段, 空行结束
+    };
+
     enum HTTP_CODE // 服务器处理HTTP请求的可能结果(报文解析的结果)
     {
         NO_REQUEST,        // 请求不完整需要继续读取客户数据
@@ -48,6 +72,14 @@ public:
         NO_RESOURCE,       // 表示服务器没有资源
         FORBIDDEN_REQUEST, // 表示客户对资源没有足够的访问权限
         FILE_REQUEST,      // 文件请求获取文件成功
+        PARTIAL_CONTENT,   // 获取文件成功, 按Range只发送其中的一段或几段
+        NOT_MODIFIED,      // 客户端缓存的副本仍然有效(If-None-Match/If-Modified-Since), 没有打开文件
+        RANGE_NOT_SATISFIABLE, // Range中没有一个范围落在文件之内, 没有打开文件
+        UPLOAD_CREATED,    // 上传的文件已经保存, 之前不存在
+        UPLOAD_REPLACED,   // 上传的文件已经保存, 替换了原来的文件
+        METHOD_NOT_ALLOWED, // 没有配置上传目录时的POST/PUT
+        BODY_TOO_LARGE,    // 请求体超过了m_max_body
+        STATS_REQUEST,     // 请求内置的统计页面(STATS_PATH)
         INTERNAL_ERROR,    // 表示服务器内部错误
         CLOSED_CONNECTION  // 表示客户端已经关闭连接
     };
@@ -59,73 +91,215 @@ public:
         LINE_OPEN    // 行数据尚且不完整
     };
 
+    enum TIMER_PHASE // 连接所处的阶段, 不同阶段使用不同的超时时间
+    {
+        PHASE_IDLE = 0, // 空闲的长连接, 等待下一个请求
+        PHASE_HEADER,   // 正在接收请求行和头部
+        PHASE_BODY,     // 正在接收请求体
+        PHASE_WRITE     // 正在发送响应
+    };
+
+    struct out_part // 待发送的一块数据, 一批响应按顺序由若干数据块组成
+    {
+        const char *addr; // 文件映射中的数据, 为NULL时表示写缓冲区中的数据或者sendfile发送的文件
+        off_t off;        // 在写缓冲区、文件映射或文件中下一个要发送的字节的偏移
+        size_t len;       // 还没有发送的字节数
+        int fd;           // sendfile发送的文件描述符, -1表示内存中的数据
+    };
+
+    struct file_ref // 一批响应中引用的文件, 整批发送完后才释放
+    {
+        char *address;      // mmap的起始位置
+        off_t size;         // 映射的长度
+        int fd;             // sendfile模式下打开的文件
+        file_entry *entry;  // 缓存的文件, 不为空时只需要释放引用
+        char *aux;          // 从缓冲池中取得的统计页面或分段头部(AUX_BUFFER_SIZE字节), 与文件分开释放
+    };
+
+    struct write_block // 一批响应的发送状态, 只在有响应待发送时从缓冲池中取得, 写缓冲区(m_write_buffer_size字节)紧跟在后面
+    {
+        out_part parts[MAX_PARTS];
+        file_ref files[MAX_PIPELINE];
+        byte_range ranges[MAX_RANGES]; // 当前请求解析出的范围, 生成它的响应后就不再使用
+    };
+
 public:
-    http_conn() {}
+    http_conn() : m_pending(0), m_queued_at(0), m_read_buf(NULL), m_read_size(0), m_wblock(NULL) {}
     ~http_conn() {}
 
 public:
-    void init(int sockfd, const sockaddr_in &addr); // 初始化新接受的连接
-    void close_conn();                              // 关闭连接
-    void process();                                 // 处理客户端请求
-    bool read();                                    // 非阻塞读
-    bool write();                                   // 非阻塞写
+    void init(int sockfd, const sockaddr_in &addr, int epollfd, bool inline_mode); // 初始化新接受的连接
+    void close_conn();                                                              // 关闭连接
+    void process();                                                                 // 处理客户端请求(线程池模式)
+    bool process_inline();                                                          // 处理客户端请求(多reactor模式)返回false表示需要关闭连接
+    bool read();                                                                    // 非阻塞读
+    bool write();                                                                   // 非阻塞写
+    bool flush(bool &blocked);                                                      // 发送这一批响应, TCP写缓冲满时blocked为true, 返回false表示需要关闭连接
+    int timer_timeout();                                                            // 根据连接所处阶段计算需要重新设置的超时时间
+    bool has_buffered_request() const { return bytes_to_send == 0 && m_read_idx > 0; } // 响应已经发完而读缓冲区中还有流水线请求(或者正在接收的请求体)
+    int sockfd() const { return m_sockfd; }
+    bool is_idle() const { return m_pending == 0 && bytes_to_send == 0 && m_read_idx == 0; } // 没有正在处理的请求(已经关闭的连接也算)
+
+//  下面这一组函数供自己完成I/O的异步后端(io_uring)使用: 收到的数据由feed放入读缓冲区,
+//  process_batch生成响应后按gather_parts/current_part提交发送, 完成后用advance推进, 整批发完调用end_batch
+    bool feed(const char *data, size_t len);                         // 追加收到的数据, 超过读缓冲区上限时返回false
+    bool process_batch();                                            // 解析缓冲区中所有完整的请求并按顺序生成响应
+    bool has_output() const { return bytes_to_send > 0; }            // 是否有响应等待发送
+    int gather_parts(struct iovec *iv, int max, bool &file_follows); // 从当前数据块开始连续的内存块, 当前块是文件时返回0
+    const out_part &current_part() const { return m_wblock->parts[m_part_idx]; }
+    bool advance(size_t n);                                          // 发送了n字节, 整批发完时返回true
+    bool end_batch();                                                // 整批发完后释放文件并准备下一批, 返回false表示需要关闭连接
+    wheel_timer *timer() { return &m_timer; }
 
 private:
     void init();                       // 初始化连接
+    void rearm(int ev);                // 重新设置连接关注的epoll事件
+    bool send_batch(bool &rearmed);    // write的实现, rearmed返回是否已经重新注册了事件
     HTTP_CODE process_read();          // 解析HTTP请求
     bool process_write(HTTP_CODE ret); // 填充HTTP应答
+    void next_request();               // 跳过已经处理的请求, 准备解析下一个流水线请求
+    bool batch_full() const;           // 这一批响应是否已经放不下下一个响应
+    void finish_batch();               // 一批响应发送完后重置写状态并把未处理的数据移到读缓冲区开头
+    bool grow_read_buf();              // 读缓冲区满时换成两倍大小的缓冲区
+    void move_read_ptrs(char *from, char *to); // 读缓冲区中的数据从from移到to后平移指向它们的指针
+    void resume_read();                // read因为读缓冲区满提前返回后, 腾出了空间时让epoll再报告一次可读
+    bool acquire_write_block();        // 取得一批响应的发送状态
+    char *write_buf() const { return (char *)(m_wblock + 1); }
+    static size_t write_block_size() { return sizeof(write_block) + m_write_buffer_size; }
+    void release_buffers();            // 归还空闲的读缓冲区和发送状态
 
 //  下面这一组函数被process_read调用以分析HTTP请求
     HTTP_CODE parse_request_line(char *text);
     HTTP_CODE parse_headers(char *text);
-    HTTP_CODE parse_content(char *text);
+    HTTP_CODE begin_body();   // 请求头解析完毕, 准备接收请求体
+    HTTP_CODE parse_content(); // 消费读缓冲区中已经收到的请求体
+    HTTP_CODE parse_chunk_line(const char *line, const char *eol); // 分块编码中以'\n'结束的一行
+    bool store_body(const char *data, size_t len);                  // 上传的请求体写入临时文件, 其他请求的丢弃
+    bool upload_target(char *path) const;                           // 上传的目标路径, URL中的文件名不合法时返回false
+    HTTP_CODE commit_upload();                                      // 请求体收完后把临时文件改名为目标文件
+    void discard_upload();                                          // 关闭还没有保存的临时文件(随之删除)
     HTTP_CODE do_request();
+    HTTP_CODE open_file();
+    HTTP_CODE open_path(const char *path, time_t min_mtime); // 打开一个文件, 比min_mtime旧时当作不存在
+    bool not_modified() const; // 按条件请求头部判断客户端缓存的副本是否仍然有效
+    bool if_range_matches() const; // 没有If-Range, 或者它的验证器与当前文件一致
+    bool select_ranges();      // 按Range和If-Range确定要发送的范围, 所有范围都不能满足时返回false
+    HTTP_CODE attach_cache_entry(file_entry *entry);
     char *get_line() { return m_read_buf + m_start_line; }
     LINE_STATUS parse_line();
 
 //  这一组函数被process_write调用以填充HTTP应答
+    void hold_file();
+    void release_file(const file_ref &file);
     void unmap();
+    void add_part(const char *addr, off_t off, size_t len, int fd);
+    void add_file_part(off_t off, off_t len); // 当前文件中的一段
+    bool add_partial_response(int header_start); // 206响应: 一个范围直接发送, 多个范围按multipart/byteranges分段
+    bool add_continue(); // 在这一批响应中放入临时响应100 Continue
+    ssize_t send_parts();
     bool add_response(const char *format, ...);
+    bool add_span(const byte_span &span);
     bool add_content(const char *content);
     bool add_content_type();
-    bool add_status_line(int status, const char *title);
-    bool add_headers(int content_length);
-    bool add_content_length(int content_length);
+    bool add_stats_response(); // 生成统计页面, 响应体放在从缓冲池取得的缓冲区中
+    static int status_of(HTTP_CODE ret);
+    bool add_status_line(const byte_span &line);
+    bool add_headers(off_t content_length);
+    bool add_validators();   // Last-Modified和ETag
+    bool add_etag();         // ETag, 弱标签还是强标签取决于当前时间, 不能缓存
+    bool add_file_headers(const byte_span *type); // Content-Type(304为空, 没有)、Cache-Control、内容协商相关的头部、Connection和空行
+    bool add_content_length(off_t content_length);
+    bool add_content_range(const byte_range *range); // range为空时范围部分写成"*"(416响应)
     bool add_linger();
     bool add_blank_line();
+    template <int STATUS>
+    bool add_canned_response(const byte_span *extra = NULL); // extra是额外的一行头部(405的Allow)
 
 public:
-    static int m_user_count; // 统计用户的数量
-    static int m_epollfd;    // 所有socket上的事件都被注册到同一个epoll内核事件中
+    static std::atomic<int> m_user_count; // 统计用户的数量(多个reactor线程和工作线程会同时修改)
+    static int m_read_buffer_size;        // 读缓冲区的初始大小
+    static int m_max_read_buffer_size;    // 读缓冲区最多增长到的大小, 一个请求超过它时关闭连接
+    static int m_write_buffer_size;       // 写缓冲区的大小
+    static int m_idle_timeout;            // 空闲长连接的超时时间(秒)
+    static int m_header_timeout;          // 从请求的第一个字节开始接收完请求头的超时时间(秒)
+    static int m_body_timeout;            // 接收请求体或发送响应时两次进展之间的超时时间(秒)
+    static bool m_use_sendfile;           // 是否使用sendfile代替mmap+writev发送文件
+    static off_t m_mmap_max;              // 大于它的文件不整个映射, 用sendfile按偏移分段发送
+    static bool m_precompressed;          // 客户端接受压缩时是否发送预先压缩好的.br/.gz文件
+    static std::string m_cache_control;   // 文件响应的Cache-Control头部(整行), 为空时不发送
+    static std::string m_upload_dir;      // POST/PUT上传文件保存的目录, 为空时不接受上传
+    static off_t m_max_body;              // 请求体的最大长度
+    static file_cache *m_file_cache;      // 热点文件缓存, 为空时不使用缓存
+    static buffer_pool m_buffers;         // 所有连接共享的读写缓冲区池
+    static threadpool<http_conn> *m_pool; // 线程池模式下的线程池, 统计页面用它读取队列长度
+
+    std::atomic<int> m_pending; // 线程池模式下已经交给线程池但还没有处理完的次数, 不为0时定时器不能关闭连接
+    uint64_t m_queued_at;       // 线程池模式下最近一次交给线程池的时间(纳秒), 用来统计排队时间
 
 private:
     int m_sockfd;          // 该HTTP连接的socket
     sockaddr_in m_address; // 对方的socket地址
+    int m_epollfd;         // 该连接所属reactor的epoll文件描述符
+    bool m_inline;         // 是否由所属reactor线程直接处理(不使用EPOLLONESHOT和线程池)
+    wheel_timer m_timer;       // 超时定时器, 只由所属的reactor线程操作
+    TIMER_PHASE m_timer_phase; // 定时器上次设置时连接所处的阶段
 
-    char m_read_buf[READ_BUFFER_SIZE]; // 读缓冲区
+    char *m_read_buf;                  // 读缓冲区, 有数据要读时才从缓冲池中取得, 读入的请求都处理完后归还
+    int m_read_size;                   // 读缓冲区的容量
     int m_read_idx;                    // 标识读缓冲区中已经读入的客户端数据的最后一个字节的下一个位置
     int m_checked_idx;                 // 当前正在分析的字符在读缓冲区中的位置
     int m_start_line;                  // 当前正在解析的行的起始位置
+    int m_request_start;               // 当前正在解析的请求的起始位置, 之前的请求都已经生成了响应
+    int m_line_len;                    // 最近一个完整行的长度(不含行尾)
+    char *m_line_colon;                // 当前行中第一个':'的位置, 用于切分头部的名字和值
 
     CHECK_STATE m_check_state; // 主状态机当前所处的状态
     METHOD m_method;           // 请求方法
 
-    char m_real_file[FILENAME_LEN]; // 客户请求的目标文件的完整路径录
     char *m_url;                    // 客户请求的目标文件的文件名
     char *m_version;                // HTTP协议版本号(HTTP1.1)
     char *m_host;                   // 主机名
-    int m_content_length;           // HTTP请求的消息总长度
+    off_t m_content_length;         // Content-Length给出的请求体长度
+    bool m_chunked;                 // 请求体使用分块编码(Transfer-Encoding: chunked)
+    bool m_expect_continue;         // 客户端发送了Expect: 100-continue, 等收到100 Continue再发送请求体
     bool m_linger;                  // HTTP请求是否要求保持连接
+    bool m_keep_alive;              // 这一批响应发送完后是否保持连接(最后一个响应的m_linger)
+    int m_accept_encoding;          // 请求的Accept-Encoding接受的编码(CONTENT_ENCODING的位掩码)
+    char *m_if_none_match;          // If-None-Match的值, 没有时为NULL
+    time_t m_if_modified_since;     // If-Modified-Since的时间, 没有或者格式不对时为-1
+    char *m_range;                  // Range的值, 没有时为NULL
+    char *m_if_range;               // If-Range的值(实体标签或HTTP日期), 没有时为NULL
+    int m_range_count;              // 要发送的范围数(放在m_wblock->ranges中), 0表示整个文件
+    int m_encoding;                 // 响应使用的内容编码, 0表示原文件
+    const mime_type *m_mime;        // 按请求的文件名确定的类型
+    CHUNK_STATE m_chunk_state;      // 分块编码的解析位置
+    off_t m_body_left;              // 当前请求体(或者当前块)还没有收到的字节数
+    off_t m_body_received;          // 分块编码的请求体已经声明的总长度, 用来检查m_max_body
+    int m_body_fd;                  // 上传的请求体写入的匿名临时文件, -1表示请求体直接丢弃
+    bool m_read_stalled;            // 上一次read因为读缓冲区满提前返回, socket中可能还有数据
 
-    char m_write_buf[WRITE_BUFFER_SIZE]; // 写缓冲区
+    write_block *m_wblock;               // 这一批响应的数据块、引用的文件和写缓冲区, 整批发送完后归还
     int m_write_idx;                     // 写缓冲区中待发送的字节数
     char *m_file_address;                // 客户请求的目标文件被mmap到内存中的起始位置
-    struct stat m_file_stat;             // 目标文件的状态(我们可以判断文件是否存在/为目录/可读并获取文件大小等信息)
-    struct iovec m_iv[2];                // 我们将采用writev来执行写操作所以定义下面两个成员其中m_iv_count表示被写内存块的数量
-    int m_iv_count;
+    int m_file_fd;                       // sendfile模式下客户请求的目标文件的文件描述符
+    file_entry *m_cache_entry;           // 当前请求命中的缓存文件
+    off_t m_file_size;                   // 目标文件的大小
+    ino_t m_file_ino;                    // 目标文件的inode, 与大小和修改时间一起生成ETag
+    time_t m_file_mtime;                 // 目标文件的修改时间
+    char *m_aux_buffer;                  // 当前响应从缓冲池中取得的统计页面或分段头部
+    int m_part_count;                    // 这一批响应的数据块数量, 连续的内存块合并成一次writev
+    int m_part_idx;                      // 下一个要发送的数据块
+    int m_file_count;                    // 这一批响应引用的文件数量
+
+    off_t bytes_to_send;   // 这一批响应还没有发送的字节数(文件可能超过2GB)
+    off_t bytes_have_send; // 这一批响应已经发送的字节数
 
-    int bytes_to_send;   // 将要发送的数据的位置
-    int bytes_have_send; // 已经发送的数据的位置
+    //  延迟统计(纳秒)
+    uint64_t m_read_at;     // 最近一次读到数据的时间
+    uint64_t m_batch_start; // 这一批第一个请求读完的时间
+    uint64_t m_parse_ns;    // 当前请求已经花在解析上的时间
+    uint64_t m_lookup_ns;   // 当前请求查找文件的时间, 从解析时间中扣除
+    int m_batch_requests;   // 这一批响应包含的请求数
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,373 @@
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "http_parser.h"
+
+/*
+    对每个块分别得到'\r'、'\n'、':'三个位掩码, 行尾掩码的最低位就是行尾位置,
+    ':'只有在行尾之前才算数, 所以用(行尾最低位 - 1)截掉行尾之后的部分
+*/
+const char *find_line_end(const char *p, const char *end, const char **colon)
+{
+    const char *first_colon = NULL;
+#if defined(__AVX2__)
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i co = _mm256_set1_epi8(':');
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i *)p);
+        unsigned eol = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, cr), _mm256_cmpeq_epi8(block, lf)));
+        if (colon && !first_colon)
+        {
+            unsigned c = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, co));
+            if (eol)
+            {
+                c &= (eol & -eol) - 1;
+            }
+            if (c)
+            {
+                first_colon = p + __builtin_ctz(c);
+            }
+        }
+        if (eol)
+        {
+            if (colon)
+            {
+                *colon = first_colon;
+            }
+            return p + __builtin_ctz(eol);
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i co = _mm_set1_epi8(':');
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)p);
+        unsigned eol = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, cr), _mm_cmpeq_epi8(block, lf)));
+        if (colon && !first_colon)
+        {
+            unsigned c = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, co));
+            if (eol)
+            {
+                c &= (eol & -eol) - 1;
+            }
+            if (c)
+            {
+                first_colon = p + __builtin_ctz(c);
+            }
+        }
+        if (eol)
+        {
+            if (colon)
+            {
+                *colon = first_colon;
+            }
+            return p + __builtin_ctz(eol);
+        }
+    }
+#endif
+    for (; p < end; ++p) // 不足一个块的尾部以及没有SIMD的平台逐字节扫描
+    {
+        if (*p == '\r' || *p == '\n')
+        {
+            break;
+        }
+        if (*p == ':' && !first_colon)
+        {
+            first_colon = p;
+        }
+    }
+    if (colon)
+    {
+        *colon = first_colon;
+    }
+    return p;
+}
+
+static const char *skip_blank(const char *p, const char *end) // 跳过空格和制表符
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+        ++p;
+    }
+    return p;
+}
+
+static const char *find_blank(const char *p, const char *end) // 查找下一个空格或制表符
+{
+    while (p < end && *p != ' ' && *p != '\t')
+    {
+        ++p;
+    }
+    return p;
+}
+
+bool split_request_line(const char *line, size_t len, request_line &out)
+{
+    const char *end = line + len;
+    const char *p = find_blank(line, end);
+    if (p == end || p == line)
+    {
+        return false;
+    }
+    out.method = byte_span{line, (size_t)(p - line)};
+
+    const char *url = skip_blank(p, end);
+    p = find_blank(url, end);
+    if (p == end || p == url)
+    {
+        return false;
+    }
+    out.url = byte_span{url, (size_t)(p - url)};
+
+    const char *version = skip_blank(p, end);
+    if (version == end)
+    {
+        return false;
+    }
+    out.version = byte_span{version, (size_t)(end - version)};
+    return true;
+}
+
+bool split_header(const char *line, size_t len, const char *colon, byte_span &name, byte_span &value)
+{
+    if (!colon || colon == line)
+    {
+        return false;
+    }
+    const char *end = line + len;
+    name = byte_span{line, (size_t)(colon - line)};
+    const char *v = skip_blank(colon + 1, end);
+    while (end > v && (end[-1] == ' ' || end[-1] == '\t'))
+    {
+        --end;
+    }
+    value = byte_span{v, (size_t)(end - v)};
+    return true;
+}
+
+static bool zero_quality(const char *p, const char *end) // 编码后面的参数中是否有q=0(0、0.0、0.000等)
+{
+    while (p < end)
+    {
+        p = skip_blank(p + 1, end); // 跳过';'
+        if (end - p >= 2 && (*p == 'q' || *p == 'Q') && p[1] == '=')
+        {
+            p += 2;
+            if (p == end || *p != '0')
+            {
+                return false;
+            }
+            for (++p; p < end && (*p == '.' || *p == '0'); ++p)
+            {
+            }
+            return p == end || *p == ' ' || *p == '\t' || *p == ';';
+        }
+        while (p < end && *p != ';')
+        {
+            ++p;
+        }
+    }
+    return false;
+}
+
+int parse_accept_encoding(const byte_span &value)
+{
+    int accepted = 0, refused = 0, wildcard = 0;
+    const char *p = value.data;
+    const char *end = value.data + value.len;
+    while (p < end)
+    {
+        const char *item_end = (const char *)memchr(p, ',', end - p);
+        if (!item_end)
+        {
+            item_end = end;
+        }
+        const char *name = skip_blank(p, item_end);
+        const char *name_end = name;
+        while (name_end < item_end && *name_end != ';' && *name_end != ' ' && *name_end != '\t')
+        {
+            ++name_end;
+        }
+        const char *params = (const char *)memchr(name_end, ';', item_end - name_end);
+        int mask = (params && zero_quality(params, item_end)) ? 0 : -1; // -1表示接受
+        byte_span token{name, (size_t)(name_end - name)};
+        int encoding = 0;
+        if (span_iequals(token, "gzip") || span_iequals(token, "x-gzip"))
+        {
+            encoding = ENCODING_GZIP;
+        }
+        else if (span_iequals(token, "br"))
+        {
+            encoding = ENCODING_BR;
+        }
+        else if (span_iequals(token, "*"))
+        {
+            wildcard = mask ? (ENCODING_GZIP | ENCODING_BR) : 0;
+        }
+        if (mask)
+        {
+            accepted |= encoding;
+        }
+        else
+        {
+            refused |= encoding;
+        }
+        p = item_end + 1;
+    }
+    return (accepted | wildcard) & ~refused;
+}
+
+time_t parse_http_date(const char *text)
+{
+    static const char *const formats[] = {"%a, %d %b %Y %H:%M:%S GMT", "%A, %d-%b-%y %H:%M:%S GMT", "%a %b %e %H:%M:%S %Y"};
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i)
+    {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char *end = strptime(text, formats[i], &tm);
+        if (end && *end == '\0')
+        {
+            return timegm(&tm);
+        }
+    }
+    return -1;
+}
+
+static byte_span opaque_tag(const char *p, const char *end) // 去掉首尾空白和W/前缀
+{
+    p = skip_blank(p, end);
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+    {
+        --end;
+    }
+    if (end - p >= 2 && p[0] == 'W' && p[1] == '/')
+    {
+        p += 2;
+    }
+    return byte_span{p, (size_t)(end - p)};
+}
+
+bool etag_list_matches(const byte_span &list, const byte_span &etag)
+{
+    byte_span want = opaque_tag(etag.data, etag.data + etag.len);
+    const char *p = list.data;
+    const char *end = list.data + list.len;
+    while (p < end)
+    {
+        const char *item_end = (const char *)memchr(p, ',', end - p);
+        if (!item_end)
+        {
+            item_end = end;
+        }
+        byte_span tag = opaque_tag(p, item_end);
+        if ((tag.len == 1 && tag.data[0] == '*') || (tag.len == want.len && memcmp(tag.data, want.data, want.len) == 0))
+        {
+            return true;
+        }
+        p = item_end + 1;
+    }
+    return false;
+}
+
+static bool parse_offset(const char *&p, const char *end, off_t &out) // 非负的十进制数, 最多18位, 不会溢出
+{
+    const char *start = p;
+    off_t value = 0;
+    while (p < end && *p >= '0' && *p <= '9' && p - start < 18)
+    {
+        value = value * 10 + (*p++ - '0');
+    }
+    out = value;
+    return p > start && (p == end || *p < '0' || *p > '9');
+}
+
+int parse_range(const byte_span &value, off_t size, byte_range *ranges, int max)
+{
+    if (!span_istarts_with(value, "bytes="))
+    {
+        return 0;
+    }
+    const char *p = value.data + 6;
+    const char *end = value.data + value.len;
+    int count = 0;
+    bool parsed = false;
+    off_t total = 0;
+    while (true)
+    {
+        p = skip_blank(p, end);
+        if (p < end && *p == ',') /* 列表中允许有空元素 */
+        {
+            ++p;
+            continue;
+        }
+        if (p == end)
+        {
+            break;
+        }
+        off_t first, last;
+        bool satisfiable;
+        if (*p == '-') /* 最后N个字节 */
+        {
+            off_t suffix;
+            ++p;
+            if (!parse_offset(p, end, suffix))
+            {
+                return 0;
+            }
+            first = suffix < size ? size - suffix : 0;
+            last = size - 1;
+            satisfiable = suffix > 0 && size > 0;
+        }
+        else
+        {
+            if (!parse_offset(p, end, first) || p == end || *p != '-')
+            {
+                return 0;
+            }
+            ++p;
+            last = size - 1;
+            if (p < end && *p >= '0' && *p <= '9')
+            {
+                if (!parse_offset(p, end, last) || last < first)
+                {
+                    return 0;
+                }
+                last = last < size ? last : size - 1;
+            }
+            satisfiable = first < size;
+        }
+        p = skip_blank(p, end);
+        if (p < end && *p != ',')
+        {
+            return 0;
+        }
+        parsed = true;
+        if (satisfiable)
+        {
+            if (count == max)
+            {
+                return 0;
+            }
+            ranges[count].first = first;
+            ranges[count].last = last;
+            total += last - first + 1;
+            ++count;
+        }
+    }
+    if (!parsed)
+    {
+        return 0;
+    }
+    if (count == 0)
+    {
+        return -1;
+    }
+    return count > 1 && total > size ? 0 : count;
+}
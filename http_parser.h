@@ -0,0 +1,78 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stddef.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <time.h>
+#include "response.h"
+
+/*
+    向量化的HTTP报文扫描函数。
+    find_line_end一次扫描同时找出行尾('\r'或'\n')和行内第一个':'的位置,
+    AVX2可用时每次比较32字节, 否则使用x86-64都支持的SSE2每次比较16字节, 其他平台逐字节扫描。
+    解析结果都是指向读缓冲区的byte_span, 不拷贝任何数据。
+*/
+
+// 返回[p, end)中第一个'\r'或'\n'的位置, 找不到时返回end; 若colon不为空, 同时返回该位置之前第一个':'(没有则为NULL)
+const char *find_line_end(const char *p, const char *end, const char **colon);
+
+// 请求行 "GET /index.html HTTP/1.1" 的三个部分
+struct request_line
+{
+    byte_span method;
+    byte_span url;
+    byte_span version;
+};
+
+// 把一个不含行尾的请求行切分成方法、URL和版本, 格式错误时返回false
+bool split_request_line(const char *line, size_t len, request_line &out);
+
+// 按扫描时找到的':'把头部行切分成名字和去掉首尾空白的值, 格式错误时返回false
+bool split_header(const char *line, size_t len, const char *colon, byte_span &name, byte_span &value);
+
+// 服务器能够发送的内容编码(预先压缩的文件), 用作位掩码
+enum CONTENT_ENCODING
+{
+    ENCODING_GZIP = 1,
+    ENCODING_BR = 2
+};
+
+// 解析HTTP日期(IMF-fixdate, 以及必须兼容的RFC 850和asctime格式), 格式不对时返回-1
+time_t parse_http_date(const char *text);
+
+// If-None-Match的值(逗号分隔的实体标签列表或"*")中是否有与etag弱比较相等的标签(忽略W/前缀)
+bool etag_list_matches(const byte_span &list, const byte_span &etag);
+
+// 文件中的一段字节[first, last], 两端都包含在内
+struct byte_range
+{
+    off_t first;
+    off_t last;
+};
+
+/*
+    按文件大小size解析Range的值("bytes=0-99,200-,-500"), 能满足的范围按请求的顺序写入ranges, 超出文件末尾的部分截掉。
+    返回范围个数; 单位不是bytes、格式错误、超过max个, 或者多个范围加起来比文件还大(重叠范围放大响应)时返回0,
+    表示忽略Range发送整个文件; 所有范围都不能满足时返回-1
+*/
+int parse_range(const byte_span &value, off_t size, byte_range *ranges, int max);
+
+// 解析Accept-Encoding的值, 返回客户端接受的CONTENT_ENCODING位掩码。q=0表示不接受, "*"代表没有单独列出的编码
+int parse_accept_encoding(const byte_span &value);
+
+// 不区分大小写地比较span和字符串常量
+template <size_t N>
+inline bool span_iequals(const byte_span &span, const char (&lit)[N])
+{
+    return span.len == N - 1 && strncasecmp(span.data, lit, N - 1) == 0;
+}
+
+// 不区分大小写地判断span是否以字符串常量开头
+template <size_t N>
+inline bool span_istarts_with(const byte_span &span, const char (&lit)[N])
+{
+    return span.len >= N - 1 && strncasecmp(span.data, lit, N - 1) == 0;
+}
+
+#endif
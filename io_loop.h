@@ -0,0 +1,91 @@
+#ifndef IO_LOOP_H
+#define IO_LOOP_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <exception>
+#include "locker.h"
+
+/*
+    I/O后端的公共接口。epoll(reactor)和io_uring(uring_reactor)两种后端都实现loop,
+    启动时选定其中一种, 每个事件循环可以在当前线程运行, 也可以各自占用一个线程。
+    优雅退出: drain之后每个事件循环在下一个tick关闭自己的监听套接字不再接受新连接,
+    空闲的长连接直接关闭, 正在处理的请求回复"Connection: close"后关闭,
+    所有连接都关闭后loop返回; 超过期限时剩下的连接被强制关闭
+*/
+class io_loop
+{
+public:
+    io_loop() : m_thread(0), m_cpu(-1) {}
+    virtual ~io_loop() {}
+
+    virtual void loop() = 0; // 在当前线程中运行事件循环, 优雅退出完成后返回
+
+    static void drain(int timeout_sec) // 所有事件循环开始优雅退出, 再次调用只能提前期限
+    {
+        uint64_t deadline = now_ns() + (uint64_t)timeout_sec * 1000000000ull;
+        uint64_t cur = deadline_ns().load();
+        while ((cur == 0 || deadline < cur) && !deadline_ns().compare_exchange_weak(cur, deadline))
+        {
+        }
+    }
+
+    static bool draining() { return deadline_ns().load(std::memory_order_relaxed) != 0; }
+
+    static bool drain_expired() // 优雅退出的期限是否已经到了
+    {
+        uint64_t deadline = deadline_ns().load(std::memory_order_relaxed);
+        return deadline != 0 && now_ns() >= deadline;
+    }
+
+    void start(int cpu = -1) // 创建新线程运行事件循环, cpu不小于0时线程在开始运行前绑定到该CPU上
+    {
+        m_cpu = cpu;
+        if (pthread_create(&m_thread, NULL, worker, this) != 0)
+        {
+            throw std::exception();
+        }
+    }
+
+    void join() // 等待事件循环线程结束
+    {
+        if (m_thread)
+        {
+            pthread_join(m_thread, NULL);
+            m_thread = 0;
+        }
+    }
+
+private:
+    static std::atomic<uint64_t> &deadline_ns() // 优雅退出的期限(CLOCK_MONOTONIC纳秒), 0表示正常运行
+    {
+        static std::atomic<uint64_t> deadline(0);
+        return deadline;
+    }
+
+    static uint64_t now_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+    static void *worker(void *arg) // 事件循环线程的回调函数
+    {
+        io_loop *l = (io_loop *)arg;
+        if (l->m_cpu >= 0) // 在第一次从缓冲池取缓冲区之前绑定, 线程缓存才会对应本地节点
+        {
+            bind_cpu(pthread_self(), l->m_cpu);
+        }
+        l->loop();
+        return NULL;
+    }
+
+private:
+    pthread_t m_thread; // 事件循环线程
+    int m_cpu;          // 事件循环线程绑定的CPU, -1表示不绑定
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include <string.h>
+#include "latency_stats.h"
+
+std::atomic<latency_stats::counters *> latency_stats::s_head(NULL);
+
+static const char *stage_names[latency_stats::LAT_STAGE_COUNT] = {"queue_wait", "parse", "file_lookup", "ttlb"};
+
+latency_stats::counters *latency_stats::attach()
+{
+    counters *c = new counters;
+    for (int s = 0; s < LAT_STAGE_COUNT; ++s)
+    {
+        for (int i = 0; i < BUCKETS; ++i)
+        {
+            c->stages[s].counts[i].store(0, std::memory_order_relaxed);
+        }
+        c->stages[s].max.store(0, std::memory_order_relaxed);
+    }
+    c->next = s_head.load(std::memory_order_relaxed);
+    while (!s_head.compare_exchange_weak(c->next, c, std::memory_order_release, std::memory_order_relaxed))
+    {
+    }
+    return c;
+}
+
+uint64_t latency_stats::bucket_value(int idx)
+{
+    if (idx < SUB_COUNT)
+    {
+        return idx;
+    }
+    int shift = idx / SUB_COUNT - 1; // 桶宽为2^shift
+    uint64_t low = (uint64_t)(SUB_COUNT + idx % SUB_COUNT) << shift;
+    return low + ((uint64_t)1 << shift) / 2;
+}
+
+void latency_stats::dump(FILE *out)
+{
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    static const char *labels[] = {"p50", "p90", "p99", "p99.9"};
+    static unsigned long merged[BUCKETS]; // 只由统计线程使用
+    for (int s = 0; s < LAT_STAGE_COUNT; ++s)
+    {
+        memset(merged, 0, sizeof(merged));
+        unsigned long total = 0;
+        uint64_t max = 0;
+        for (counters *c = s_head.load(std::memory_order_acquire); c; c = c->next)
+        {
+            const histogram &h = c->stages[s];
+            for (int i = 0; i < BUCKETS; ++i)
+            {
+                unsigned long n = h.counts[i].load(std::memory_order_relaxed);
+                merged[i] += n;
+                total += n;
+            }
+            uint64_t m = h.max.load(std::memory_order_relaxed);
+            max = m > max ? m : max;
+        }
+        fprintf(out, "latency %s: n=%lu", stage_names[s], total);
+        if (total == 0)
+        {
+            fprintf(out, "\n");
+            continue;
+        }
+        unsigned long seen = 0;
+        int i = 0;
+        for (int q = 0; q < 4; ++q)
+        {
+            unsigned long rank = (unsigned long)(quantiles[q] * total);
+            rank = rank < 1 ? 1 : rank;
+            while (seen + merged[i] < rank)
+            {
+                seen += merged[i++];
+            }
+            fprintf(out, " %s=%.1fus", labels[q], bucket_value(i) / 1e3);
+        }
+        fprintf(out, " max=%.1fus\n", max / 1e3);
+    }
+    fflush(out);
+}
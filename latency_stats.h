@@ -0,0 +1,100 @@
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include <stdint.h>
+#include <time.h>
+#include <cstdio>
+#include <atomic>
+
+/*
+    每个线程一组HDR风格的延迟直方图: 数值按2的幂分段, 每段再线性分成SUB_COUNT个桶,
+    相对误差不超过1/SUB_COUNT。记录一个样本只需要算出桶号并给该线程自己的计数器加一,
+    不加锁也不输出任何东西; 输出时才把所有线程的直方图合并起来计算分位数。
+    计数器挂在全局链表上的方式和syscall_stats相同
+*/
+class latency_stats
+{
+public:
+    enum STAGE
+    {
+        LAT_QUEUE_WAIT = 0, // 线程池模式下从交给线程池到工作线程开始处理
+        LAT_PARSE,          // 解析请求行和头部(不含查找文件)
+        LAT_FILE_LOOKUP,    // 查找缓存或者stat/open/mmap文件
+        LAT_TTLB,           // 从读到请求的最后一次recv到发出响应的最后一个字节
+        LAT_STAGE_COUNT
+    };
+
+    static const int SUB_BITS = 5;
+    static const int SUB_COUNT = 1 << SUB_BITS;                         // 每个2的幂区间内的桶数
+    static const int MAX_BITS = 40;                                     // 超过2^40纳秒(约18分钟)的样本记在最后一个桶
+    static const int BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT; // 每个直方图的桶数
+
+    static uint64_t now_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+    static void record(STAGE stage, uint64_t ns, unsigned long count = 1) // 记录count个值为ns的样本
+    {
+        histogram &h = local().stages[stage];
+        bump(h.counts[bucket(ns)], count);
+        if (ns > h.max.load(std::memory_order_relaxed))
+        {
+            h.max.store(ns, std::memory_order_relaxed);
+        }
+    }
+
+    static void dump(FILE *out); // 合并所有线程的直方图, 输出每个阶段的样本数、分位数和最大值(微秒)
+
+private:
+    struct histogram
+    {
+        std::atomic<unsigned long> counts[BUCKETS];
+        std::atomic<uint64_t> max;
+    };
+
+    struct counters
+    {
+        histogram stages[LAT_STAGE_COUNT];
+        counters *next;
+    };
+
+    static int bucket(uint64_t ns)
+    {
+        if (ns < (uint64_t)SUB_COUNT)
+        {
+            return (int)ns;
+        }
+        int msb = 63 - __builtin_clzll(ns);
+        if (msb >= MAX_BITS)
+        {
+            return BUCKETS - 1;
+        }
+        return (msb - SUB_BITS + 1) * SUB_COUNT + (int)((ns >> (msb - SUB_BITS)) & (SUB_COUNT - 1));
+    }
+
+    static uint64_t bucket_value(int idx); // 桶所代表区间的中点
+
+    static void bump(std::atomic<unsigned long> &counter, unsigned long n) // 单写者计数器
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static counters &local()
+    {
+        static thread_local counters *c = NULL;
+        if (!c)
+        {
+            c = attach();
+        }
+        return *c;
+    }
+
+    static counters *attach();
+
+    static std::atomic<counters *> s_head;
+};
+
+#endif
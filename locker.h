@@ -4,8 +4,21 @@
 #include <exception>
 #include <pthread.h>
 #include <semaphore.h>
+#include <sched.h>
 using namespace std;
 
+static inline bool bind_cpu(pthread_t thread, int cpu) // 把线程绑定到编号为cpu的CPU上
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+    {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
 class locker // 互斥锁类
 {
 public:
@@ -76,6 +89,37 @@ private:
     pthread_cond_t m_cond;
 };
 
+class rwlocker // 读写锁类
+{
+public:
+    rwlocker()
+    {
+        if (pthread_rwlock_init(&m_rwlock, NULL) != 0)
+        {
+            throw exception();
+        }
+    }
+    ~rwlocker()
+    {
+        pthread_rwlock_destroy(&m_rwlock);
+    }
+    bool rdlock()
+    {
+        return pthread_rwlock_rdlock(&m_rwlock) == 0;
+    }
+    bool wrlock()
+    {
+        return pthread_rwlock_wrlock(&m_rwlock) == 0;
+    }
+    bool unlock()
+    {
+        return pthread_rwlock_unlock(&m_rwlock) == 0;
+    }
+
+private:
+    pthread_rwlock_t m_rwlock;
+};
+
 class sem // 信号量类
 {
 public:
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include "logger.h"
+
+std::atomic<logger::ring *> logger::s_head(NULL);
+std::atomic<bool> logger::s_running(false);
+int logger::s_access_fd = -1;
+pthread_t logger::s_thread;
+
+static const char *level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+static uint64_t realtime_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+namespace
+{
+    struct output // 后台线程的输出缓冲区, 攒满或者一轮取完后一次write
+    {
+        int fd;
+        size_t len;
+        char buf[64 * 1024];
+
+        void flush()
+        {
+            size_t done = 0;
+            while (done < len)
+            {
+                ssize_t n = ::write(fd, buf + done, len - done);
+                if (n <= 0)
+                {
+                    break; // 日志写不出去时丢弃, 不能让后台线程卡住
+                }
+                done += n;
+            }
+            len = 0;
+        }
+
+        char *reserve(size_t n) // 保证有n字节的空间
+        {
+            if (len + n > sizeof(buf))
+            {
+                flush();
+            }
+            return buf + len;
+        }
+    };
+
+    struct time_cache // 同一秒内的记录复用格式化好的时间
+    {
+        time_t sec;
+        char error_time[32];  // 2026-10-17 08:00:00
+        char access_time[32]; // 17/Oct/2026:08:00:00 +0000
+
+        void update(time_t now)
+        {
+            if (now == sec)
+            {
+                return;
+            }
+            sec = now;
+            struct tm tm;
+            gmtime_r(&now, &tm);
+            strftime(error_time, sizeof(error_time), "%Y-%m-%d %H:%M:%S", &tm);
+            strftime(access_time, sizeof(access_time), "%d/%b/%Y:%H:%M:%S +0000", &tm);
+        }
+    };
+
+    output error_out = {STDERR_FILENO, 0, {0}};
+    output access_out = {-1, 0, {0}};
+    time_cache clock_cache = {-1, {0}, {0}};
+}
+
+logger::ring *logger::attach()
+{
+    ring *r = new ring;
+    r->head.store(0, std::memory_order_relaxed);
+    r->tail.store(0, std::memory_order_relaxed);
+    r->dropped.store(0, std::memory_order_relaxed);
+    r->next = s_head.load(std::memory_order_relaxed);
+    while (!s_head.compare_exchange_weak(r->next, r, std::memory_order_release, std::memory_order_relaxed))
+    {
+    }
+    return r;
+}
+
+logger::record *logger::reserve(ring &r)
+{
+    unsigned tail = r.tail.load(std::memory_order_relaxed);
+    if (tail - r.head.load(std::memory_order_acquire) >= (unsigned)RING_RECORDS)
+    {
+        r.dropped.store(r.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return NULL;
+    }
+    return &r.slots[tail & (RING_RECORDS - 1)];
+}
+
+void logger::log(int level, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    if (!s_running.load(std::memory_order_acquire)) // 后台线程还没有启动或者已经结束
+    {
+        fprintf(stderr, "%-5s ", level_names[level]);
+        vfprintf(stderr, format, args);
+        fputc('\n', stderr);
+        va_end(args);
+        return;
+    }
+    ring &r = local();
+    record *rec = reserve(r);
+    if (rec)
+    {
+        rec->time_ns = realtime_ns();
+        rec->type = level;
+        vsnprintf(rec->text, sizeof(rec->text), format, args);
+        r.tail.store(r.tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    va_end(args);
+}
+
+void logger::access(const sockaddr_in &addr, const char *method, const char *url, int status, size_t bytes)
+{
+    if (!s_running.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    ring &r = local();
+    record *rec = reserve(r);
+    if (!rec)
+    {
+        return;
+    }
+    rec->time_ns = realtime_ns();
+    rec->type = TYPE_ACCESS;
+    rec->status = status;
+    rec->bytes = bytes;
+    rec->addr = addr.sin_addr.s_addr;
+    snprintf(rec->text, sizeof(rec->text), "%s %s", method, url);
+    r.tail.store(r.tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+unsigned long logger::dropped()
+{
+    unsigned long total = 0;
+    for (ring *r = s_head.load(std::memory_order_acquire); r; r = r->next)
+    {
+        total += r->dropped.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+bool logger::drain()
+{
+    bool any = false;
+    for (ring *r = s_head.load(std::memory_order_acquire); r; r = r->next)
+    {
+        unsigned head = r->head.load(std::memory_order_relaxed);
+        unsigned tail = r->tail.load(std::memory_order_acquire);
+        for (; head != tail; ++head)
+        {
+            const record &rec = r->slots[head & (RING_RECORDS - 1)];
+            clock_cache.update((time_t)(rec.time_ns / 1000000000ull));
+            if (rec.type == TYPE_ACCESS)
+            {
+                char ip[INET_ADDRSTRLEN];
+                inet_ntop(AF_INET, &rec.addr, ip, sizeof(ip));
+                char *p = access_out.reserve(RECORD_SIZE + 128);
+                access_out.len += sprintf(p, "%s - - [%s] \"%s HTTP/1.1\" %d %llu\n", ip, clock_cache.access_time,
+                                          rec.text, rec.status, (unsigned long long)rec.bytes);
+            }
+            else
+            {
+                char *p = error_out.reserve(RECORD_SIZE + 64);
+                error_out.len += sprintf(p, "%s.%06u %-5s %s\n", clock_cache.error_time,
+                                         (unsigned)(rec.time_ns % 1000000000ull / 1000), level_names[rec.type],
+                                         rec.text);
+            }
+        }
+        if (head != r->head.load(std::memory_order_relaxed))
+        {
+            r->head.store(head, std::memory_order_release); // 格式化完后才把槽还给生产者
+            any = true;
+        }
+    }
+    error_out.flush();
+    if (access_out.fd != -1)
+    {
+        access_out.flush();
+    }
+    return any;
+}
+
+void *logger::flusher(void *)
+{
+    struct timespec idle = {0, 10 * 1000 * 1000}; // 没有日志时每10毫秒检查一次
+    while (s_running.load(std::memory_order_acquire))
+    {
+        if (!drain())
+        {
+            nanosleep(&idle, NULL);
+        }
+    }
+    while (drain()) // 退出前写出剩余的记录
+    {
+    }
+    return NULL;
+}
+
+bool logger::start(const char *access_path)
+{
+    if (access_path)
+    {
+        s_access_fd = open(access_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (s_access_fd < 0)
+        {
+            return false;
+        }
+        access_out.fd = s_access_fd;
+    }
+    s_running.store(true, std::memory_order_release);
+    if (pthread_create(&s_thread, NULL, flusher, NULL) != 0)
+    {
+        s_running.store(false, std::memory_order_release);
+        return false;
+    }
+    return true;
+}
+
+void logger::stop()
+{
+    if (!s_running.exchange(false))
+    {
+        return;
+    }
+    pthread_join(s_thread, NULL);
+}
@@ -0,0 +1,100 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <atomic>
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+//  低于LOG_LEVEL的日志在编译期就被去掉, 参数也不会被求值; 编译时加-DLOG_LEVEL=0可以打开调试日志
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_AT(level, format, ...)                          \
+    do                                                      \
+    {                                                       \
+        if ((level) >= LOG_LEVEL)                           \
+        {                                                   \
+            logger::log((level), format, ##__VA_ARGS__);    \
+        }                                                   \
+    } while (0)
+
+#define LOG_DEBUG(format, ...) LOG_AT(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_AT(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_AT(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_AT(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+
+/*
+    异步日志: 每个线程有自己的单生产者单消费者环形缓冲区, 写日志只是把时间戳和格式化好的文本
+    (访问日志则是各个字段)放进缓冲区, 不加锁也不做系统调用; 后台线程轮流取出所有线程的记录,
+    格式化后成批写到错误日志(stderr)和访问日志文件。缓冲区满时丢弃新记录并计数, 不会阻塞请求处理。
+    不同线程的记录之间不保证严格的时间顺序。后台线程启动之前的日志直接写到stderr
+*/
+class logger
+{
+public:
+    static const int RECORD_SIZE = 256;  // 每条记录占用的字节数, 过长的消息被截断
+    static const int RING_RECORDS = 1024; // 每个线程的环形缓冲区能容纳的记录数(2的幂)
+
+    static bool start(const char *access_path); // 启动后台线程, access_path为空时不记录访问日志
+    static void stop();                         // 写出所有剩余的记录并结束后台线程
+
+    static void log(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+    static bool access_enabled() { return s_access_fd != -1; }
+    //  记录一条访问日志: 客户端地址、请求行、状态码和响应的字节数
+    static void access(const sockaddr_in &addr, const char *method, const char *url, int status, size_t bytes);
+
+    static unsigned long dropped(); // 因为缓冲区满而丢弃的记录数
+
+private:
+    static const int TYPE_ACCESS = -1;
+
+    struct record
+    {
+        uint64_t time_ns; // CLOCK_REALTIME
+        int type;         // 日志级别, 或者TYPE_ACCESS
+        int status;
+        uint64_t bytes;
+        uint32_t addr;
+        char text[RECORD_SIZE - 28]; // 消息, 访问日志中是"方法 URL"
+    };
+
+    struct ring
+    {
+        record slots[RING_RECORDS];
+        std::atomic<unsigned> head; // 由后台线程推进
+        std::atomic<unsigned> tail; // 由所属线程推进
+        std::atomic<unsigned long> dropped;
+        ring *next;
+    };
+
+    static ring &local()
+    {
+        static thread_local ring *r = NULL;
+        if (!r)
+        {
+            r = attach();
+        }
+        return *r;
+    }
+
+    static ring *attach();
+    static record *reserve(ring &r); // 取一个空闲的槽, 缓冲区满时返回NULL
+    static void *flusher(void *arg);
+    static bool drain(); // 写出所有线程缓冲区中的记录, 没有任何记录时返回false
+
+    static std::atomic<ring *> s_head;
+    static std::atomic<bool> s_running;
+    static int s_access_fd;
+    static pthread_t s_thread;
+};
+
+#endif
@@ -8,15 +8,39 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <limits.h>
+#include <vector>
+#include <string>
+#include <new>
 #include "locker.h"
 #include "threadpool.h"
 #include "http_conn.h"
+#include "reactor.h"
+#include "uring_reactor.h"
+#include "coro_reactor.h"
+#include "syscall_stats.h"
+#include "overload.h"
+#include "latency_stats.h"
+#include "logger.h"
+#include "config.h"
+#include "cpu_topology.h"
+#include "handoff.h"
 
-#define MAX_FD 65536           // 最大的文件描述符个数
-#define MAX_EVENT_NUMBER 10000 // 监听的最大的事件数量
+#define OPTSTRING "r:t:wsc:ub:m:q:d:a:f:o:"
 
-extern void addfd(int epollfd, int fd, bool one_shot); // 添加文件描述符到epoll实例中
-extern void removefd(int epollfd, int fd);             // 从epoll实例中删除文件描述符
+struct short_option // 原有的短选项, 都是某个配置项的简写
+{
+    int opt;
+    const char *key;
+    const char *value; // 不带参数的选项设置的值, 为NULL时取选项的参数
+};
+
+static const short_option short_options[] = {
+    {'r', "reactors", NULL}, {'t', "threads", NULL}, {'w', "work_stealing", "on"}, {'s', "sendfile", "on"},
+    {'c', "cache_mb", NULL}, {'u', "backend", "io_uring"}, {'b', "backlog", NULL}, {'m', "max_conn", NULL},
+    {'q', "max_queue", NULL}, {'d', "max_delay_ms", NULL}, {'a', "access_log", NULL},
+};
 
 void addsig(int sig, void(handler)(int)) // 注册信号捕捉
 {
@@ -27,111 +51,348 @@ void addsig(int sig, void(handler)(int)) // 注册信号捕捉
     assert(sigaction(sig, &sa, NULL) != -1);
 }
 
-int main(int argc, char *argv[])
+void usage(const char *prog)
 {
-    if (argc <= 1) // 参数检查
+    printf("%s [-f config_file] [-o key=value] [-r reactor_number] [-t thread_number] [-w] [-s] [-c cache_mb] [-u]\n"
+           "    [-b backlog] [-m max_conn] [-q max_queue] [-d max_delay_ms] [-a access_log] [port]\n", prog);
+    printf("    -f  从配置文件读取设置(每行一个key = value), 命令行上的其他选项覆盖其中的设置\n");
+    printf("    -o  设置任意一个配置项, 可以多次使用\n");
+    printf("    -r  启用多reactor模式并指定事件循环线程数, 默认为0即单epoll+线程池模式\n");
+    printf("    -t  线程池的工作线程数, 默认为在线CPU个数\n");
+    printf("    -w  线程池使用工作窃取模式(每个工作线程一个队列)\n");
+    printf("    -s  使用sendfile零拷贝发送文件, 默认使用mmap+writev\n");
+    printf("    -c  启用热点文件缓存并指定缓存大小(MB), 默认为0即不缓存\n");
+    printf("    -u  使用io_uring后端(多reactor模式), 内核不支持时退回epoll\n");
+    printf("    -b  监听套接字的连接等待队列长度, 默认为SOMAXCONN(实际不超过net.core.somaxconn)\n");
+    printf("    -m  最大连接数, 超过时新连接收到503后被关闭, 默认为最大文件描述符数\n");
+    printf("    -q  线程池中等待处理的最大请求数, 超过时新请求收到503, 默认为10000\n");
+    printf("    -d  请求在线程池队列中的平均等待时间上限(毫秒), 超过时新请求收到503, 默认为0即不限制\n");
+    printf("    -a  访问日志文件, 默认不记录访问日志\n");
+    printf("配置项:\n");
+    server_config::usage(stdout);
+}
+
+struct control_context // 信号线程需要的状态
+{
+    sigset_t signals;                 // 由信号线程通过signalfd接收的信号
+    threadpool<http_conn> *pool;      // 多reactor模式下为空
+    std::vector<int> listenfds;       // 升级时交给新进程的监听套接字
+    std::string exe;                  // 启动时可执行文件的路径, 升级时执行这个路径上的新文件
+    char **argv;                      // 新进程使用同样的命令行参数
+    int drain_timeout;                // 优雅退出的期限(秒)
+};
+
+/*
+    信号线程: 所有线程都屏蔽了下面这些信号, 只有这里通过signalfd同步地读取, 处理时可以调用任何函数。
+    SIGUSR1 输出线程池中每个工作线程的统计信息、系统调用计数和延迟分布
+    SIGTERM/SIGINT 优雅退出, 再收到一次时立即关闭剩余的连接
+    SIGUSR2 启动新的可执行文件并交出监听套接字, 新进程就绪后本进程优雅退出
+*/
+void *control_thread(void *arg)
+{
+    control_context *ctx = (control_context *)arg;
+    int sfd = signalfd(-1, &ctx->signals, SFD_CLOEXEC);
+    if (sfd < 0)
     {
-        printf("%s <port>\n", argv[0]);
-        return 1;
+        LOG_ERROR("signalfd failure: %s", strerror(errno));
+        return NULL;
     }
+    struct signalfd_siginfo info;
+    while (read(sfd, &info, sizeof(info)) == sizeof(info))
+    {
+        switch (info.ssi_signo)
+        {
+        case SIGUSR1:
+            if (ctx->pool)
+            {
+                ctx->pool->dump_stats(stdout);
+            }
+            syscall_stats::dump(stdout);
+            overload_control::dump(stdout);
+            latency_stats::dump(stdout);
+            printf("log: dropped %lu records\n", logger::dropped());
+            fflush(stdout);
+            break;
+        case SIGUSR2:
+            if (io_loop::draining()) // 监听套接字可能已经关闭了
+            {
+                LOG_WARN("already shutting down, upgrade ignored");
+                break;
+            }
+            LOG_INFO("upgrading to %s", ctx->exe.c_str());
+            if (handoff::spawn(ctx->exe.c_str(), ctx->argv, ctx->listenfds))
+            {
+                io_loop::drain(ctx->drain_timeout);
+            }
+            break;
+        default: // SIGTERM/SIGINT
+            if (io_loop::draining())
+            {
+                LOG_INFO("closing remaining connections");
+                io_loop::drain(0);
+            }
+            else
+            {
+                LOG_INFO("shutting down, draining connections for up to %d seconds", ctx->drain_timeout);
+                io_loop::drain(ctx->drain_timeout);
+            }
+            break;
+        }
+    }
+    close(sfd);
+    return NULL;
+}
 
-    int port = atoi(argv[1]); // 获取用户输入的服务器端口号
+static http_conn *create_users(int count) // 连接数组以文件描述符为下标, 所有线程都会访问, 页面在NUMA节点之间交错分配
+{
+    http_conn *users = (http_conn *)cpu_topology::alloc_interleaved(sizeof(http_conn) * count);
+    if (!users)
+    {
+        throw std::bad_alloc();
+    }
+    for (int i = 0; i < count; ++i)
+    {
+        new (users + i) http_conn();
+    }
+    return users;
+}
 
-    addsig(SIGPIPE, SIG_IGN); // 将SIGPIPE信号设置为忽略处理
+static void destroy_users(http_conn *users, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        users[i].~http_conn();
+    }
+    cpu_topology::release(users, sizeof(http_conn) * count);
+}
 
-    threadpool<http_conn> *pool = nullptr;
-    try
+int main(int argc, char *argv[])
+{
+    cpu_topology::init(); // 检查cpu_affinity之前读取拓扑
+    server_config cfg;
+    int opt;
+    while ((opt = getopt(argc, argv, OPTSTRING)) != -1) // 先读取配置文件, 命令行上的其他选项覆盖其中的设置
+    {
+        if (opt == 'f' && !cfg.load(optarg))
+        {
+            return 1;
+        }
+        if (opt == '?')
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    optind = 1;
+    while ((opt = getopt(argc, argv, OPTSTRING)) != -1)
+    {
+        bool ok = true;
+        if (opt == 'o')
+        {
+            char *eq = strchr(optarg, '=');
+            if (!eq)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            std::string key(optarg, eq - optarg); // 不修改argv, 升级时原样传给新进程
+            ok = cfg.set(key.c_str(), eq + 1);
+        }
+        else
+        {
+            for (size_t i = 0; i < sizeof(short_options) / sizeof(short_options[0]); ++i)
+            {
+                if (short_options[i].opt == opt)
+                {
+                    ok = cfg.set(short_options[i].key, short_options[i].value ? short_options[i].value : optarg);
+                }
+            }
+        }
+        if (!ok)
+        {
+            return 1;
+        }
+    }
+    if (optind < argc && !cfg.set("port", argv[optind])) // 端口号也可以在配置文件中给出
+    {
+        return 1;
+    }
+    if (optind + 1 < argc)
     {
-        pool = new threadpool<http_conn>; // 创建线程池对象
+        usage(argv[0]);
+        return 1;
     }
-    catch (...)
+    if (!cfg.validate()) // 参数检查, 并解析需要自动检测的参数
     {
         return 1;
     }
 
-    http_conn *users = new http_conn[MAX_FD]; // 创建任务对象数组
+    if (cfg.backend == server_config::BACKEND_URING && !uring_reactor::supported())
+    {
+        LOG_WARN("io_uring is not supported, falling back to epoll");
+        cfg.backend = server_config::BACKEND_EPOLL;
+    }
+    if (cfg.backend == server_config::BACKEND_CORO && !coro_reactor::supported())
+    {
+        LOG_WARN("coroutines are not supported by this build (needs -std=c++20), falling back to epoll");
+        cfg.backend = server_config::BACKEND_EPOLL;
+    }
+    //  io_uring和协程后端由事件循环线程直接处理连接, 没有线程池模式
+    if (cfg.backend != server_config::BACKEND_EPOLL && cfg.reactors == 0)
+    {
+        cfg.reactors = cfg.threads;
+    }
+    cfg.apply();
+    //  线程池模式下主线程(reactor)用第0个CPU, 工作线程依次用后面的CPU
+    std::vector<int> cpus = cpu_topology::plan(cfg.cpu_affinity, cfg.reactors ? cfg.reactors : cfg.threads + 1);
 
-    int listenfd = socket(PF_INET, SOCK_STREAM, 0); // 创建监听套接字
+    addsig(SIGPIPE, SIG_IGN); // 将SIGPIPE信号设置为忽略处理
+    overload_control::render();
 
-    int ret = 0;
+    //  这些信号只由信号线程通过signalfd接收, 在创建其他线程(包括文件缓存的监视线程)之前屏蔽它们以便被所有线程继承
+    control_context ctx;
+    sigemptyset(&ctx.signals);
+    sigaddset(&ctx.signals, SIGUSR1);
+    sigaddset(&ctx.signals, SIGUSR2);
+    sigaddset(&ctx.signals, SIGTERM);
+    sigaddset(&ctx.signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &ctx.signals, NULL);
+    ctx.pool = NULL;
+    ctx.argv = argv;
+    ctx.drain_timeout = cfg.drain_timeout;
+    char exe[PATH_MAX];
+    ssize_t exe_len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    ctx.exe = exe_len > 0 ? std::string(exe, exe_len) : argv[0];
+    //  部署新版本通常会替换掉原来的文件, 这时内核在路径后面加上" (deleted)"
+    const std::string deleted = " (deleted)";
+    if (ctx.exe.size() > deleted.size() && ctx.exe.compare(ctx.exe.size() - deleted.size(), deleted.size(), deleted) == 0)
+    {
+        ctx.exe.erase(ctx.exe.size() - deleted.size());
+    }
 
-    //  给定服务端地址信息
-    struct sockaddr_in address;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_family = AF_INET;
-    address.sin_port = htons(port);
+    if (!logger::start(cfg.access_log.empty() ? NULL : cfg.access_log.c_str()))
+    {
+        printf("logger failure: %s\n", strerror(errno));
+        return 1;
+    }
+    atexit(logger::stop); // 从main返回时写出剩余的日志
+    LOG_INFO("port %d, doc_root %s, %s mode with %d %s, backend %s, max_fd %d, max_conn %d", cfg.port,
+             cfg.doc_root.c_str(), cfg.reactors ? "multi-reactor" : "thread pool",
+             cfg.reactors ? cfg.reactors : cfg.threads, cfg.reactors ? "event loops" : "workers",
+             server_config::backend_names[cfg.backend], cfg.max_fd, cfg.max_conn);
+    if (cpus[0] >= 0)
+    {
+        std::string list;
+        for (size_t i = 0; i < cpus.size(); ++i)
+        {
+            list += (i ? "," : "") + std::to_string(cpus[i]);
+        }
+        LOG_INFO("cpu affinity %s across %d NUMA node(s): %s", cfg.cpu_affinity.c_str(), cpu_topology::node_count(),
+                 list.c_str());
+    }
 
-    //  设置重用关闭后的socket文件描述符
-    int reuse = 1;
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (cfg.cache_mb > 0) // 单个文件最多占用缓存的1/8, 避免一个大文件把热点文件都挤出去
+    {
+        size_t capacity = (size_t)cfg.cache_mb << 20;
+        try
+        {
+            http_conn::m_file_cache = new file_cache(capacity, capacity / 8);
+        }
+        catch (...)
+        {
+            return 1;
+        }
+    }
 
-    ret = bind(listenfd, (struct sockaddr *)&address, sizeof(address)); // 绑定
-    ret = listen(listenfd, 5);                                          // 监听
+    //  监听套接字: 由旧进程启动时优先使用它交来的套接字, 不够时再创建。
+    //  线程池模式只有一个监听套接字, 多reactor模式每个事件循环一个(SO_REUSEPORT)
+    std::vector<int> inherited = handoff::inherit(cfg.port);
+    int listeners = cfg.reactors ? cfg.reactors : 1;
+    for (int i = 0; i < listeners; ++i)
+    {
+        int listenfd = i < (int)inherited.size() ? inherited[i]
+                                                  : open_listenfd(cfg.port, cfg.reactors > 0, cfg.backlog,
+                                                                  cfg.reactors ? cpus[i] : -1);
+        if (listenfd < 0)
+        {
+            LOG_ERROR("listen failure: %s", strerror(errno));
+            return 1;
+        }
+        ctx.listenfds.push_back(listenfd);
+    }
+    for (size_t i = listeners; i < inherited.size(); ++i) // 多出来的套接字等待队列中的连接会被重置
+    {
+        LOG_WARN("closing surplus inherited listening socket %d", inherited[i]);
+        close(inherited[i]);
+    }
 
-    epoll_event events[MAX_EVENT_NUMBER]; // 创建事件数组
-    int epollfd = epoll_create(5);        // 创建epoll对象
-    addfd(epollfd, listenfd, false);      // 将监听文件描述符添加到epoll对象中
-    http_conn::m_epollfd = epollfd;       // 确定epoll文件描述符
+    http_conn *users = create_users(cfg.max_fd); // 创建任务对象数组
+    pthread_t control_tid;
 
-    while (true) // 服务器循环运行
+    if (cfg.reactors == 0) // 单epoll+线程池模式
     {
-        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1); // 获取检测到的有变化文件描述符的数量
-
-        if (number < 0 && errno != EINTR)
+        threadpool<http_conn> *pool = nullptr;
+        try
         {
-            printf("epoll failure\n");
-            break;
+            pool = new threadpool<http_conn>(cfg.threads, cfg.max_queue, cfg.work_stealing, &cpus[1]);
+            http_conn::m_pool = pool;
+        }
+        catch (...)
+        {
+            return 1;
         }
 
-        for (int i = 0; i < number; i++) // 遍历获取有数据到来的文件描述符
+        bind_cpu(pthread_self(), cpus[0]);
+        reactor *main_reactor = new reactor(ctx.listenfds[0], users, cfg.max_fd, pool);
+        ctx.pool = pool;
+        if (pthread_create(&control_tid, NULL, control_thread, &ctx) == 0)
         {
-            int sockfd = events[i].data.fd;
-            if (sockfd == listenfd) // 如果是监听文件描述符的数据代表有新客户端连接
-            {
-                struct sockaddr_in client_address;
-                socklen_t client_addrlength = sizeof(client_address);
-                int connfd = accept(listenfd, (struct sockaddr *)&client_address, &client_addrlength); // 连接
-                if (connfd < 0)
-                {
-                    printf("errno is: %d\n", errno);
-                    continue;
-                }
-                if (http_conn::m_user_count >= MAX_FD)
-                {
-                    close(connfd);
-                    continue;
-                }
-                users[connfd].init(connfd, client_address); // 分配并初始化一个任务类
-            }
-            else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
-            {
-                users[sockfd].close_conn();
-            }
-            else if (events[i].events & EPOLLIN)
-            {
-                if (users[sockfd].read())
-                {
-                    pool->append(users + sockfd);
-                }
-                else
-                {
-                    users[sockfd].close_conn();
-                }
-            }
-            else if (events[i].events & EPOLLOUT)
-            {
-                if (!users[sockfd].write())
-                {
-                    users[sockfd].close_conn();
-                }
-            }
+            pthread_detach(control_tid);
         }
+        handoff::ready();
+        main_reactor->loop(); // 服务器循环运行, 优雅退出完成后返回
+
+        delete main_reactor;
+        delete pool; // 等待工作线程退出
+        http_conn::m_pool = NULL;
+        destroy_users(users, cfg.max_fd);
+        LOG_INFO("shutdown complete");
+        return 0;
     }
 
-    close(epollfd);
-    close(listenfd);
-    delete[] users;
-    delete pool;
+    //  多reactor模式: 每个事件循环线程拥有自己的epoll实例或io_uring实例和SO_REUSEPORT监听套接字
+    std::vector<io_loop *> reactors;
+    for (int i = 0; i < cfg.reactors; ++i)
+    {
+        if (cfg.backend == server_config::BACKEND_URING)
+        {
+            reactors.push_back(new uring_reactor(ctx.listenfds[i], users, cfg.max_fd));
+        }
+        else if (cfg.backend == server_config::BACKEND_CORO)
+        {
+            reactors.push_back(new coro_reactor(ctx.listenfds[i], users, cfg.max_fd));
+        }
+        else
+        {
+            reactors.push_back(new reactor(ctx.listenfds[i], users, cfg.max_fd));
+        }
+    }
+    if (pthread_create(&control_tid, NULL, control_thread, &ctx) == 0)
+    {
+        pthread_detach(control_tid);
+    }
+    for (size_t i = 0; i < reactors.size(); ++i)
+    {
+        reactors[i]->start(cpus[i]);
+    }
+    handoff::ready();
+    for (size_t i = 0; i < reactors.size(); ++i)
+    {
+        reactors[i]->join();
+        delete reactors[i];
+    }
 
+    destroy_users(users, cfg.max_fd);
+    LOG_INFO("shutdown complete");
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,156 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <new>
+#include <cstddef>
+#include <stdlib.h>
+#include "locker.h"
+
+#define CACHELINE_SIZE 64 // 缓存行大小
+
+static inline void cpu_relax() // 自旋等待时降低功耗并让出流水线给超线程
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+/*
+    有界无锁多生产者多消费者环形队列(Dmitry Vyukov的算法)。
+    每个槽位带一个序号, 生产者和消费者各自用CAS抢占位置, 然后通过槽位序号交接数据,
+    入队和出队都不需要加锁也不需要分配内存。槽位按缓存行对齐, 两个位置计数器
+    用填充字节隔开, 避免生产者和消费者之间的伪共享。容量会被向上取整为2的幂。
+*/
+template <typename T>
+class mpmc_queue
+{
+public:
+    explicit mpmc_queue(size_t capacity) : m_buffer(nullptr), m_mask(0)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        void *mem = nullptr;
+        if (posix_memalign(&mem, CACHELINE_SIZE, sizeof(cell) * size) != 0)
+        {
+            throw exception();
+        }
+        m_buffer = (cell *)mem;
+        m_mask = size - 1;
+        for (size_t i = 0; i < size; ++i)
+        {
+            new (&m_buffer[i]) cell;
+            m_buffer[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        m_enqueue_pos.store(0, std::memory_order_relaxed);
+        m_dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+
+    ~mpmc_queue()
+    {
+        for (size_t i = 0; i <= m_mask; ++i)
+        {
+            m_buffer[i].~cell();
+        }
+        free(m_buffer);
+    }
+
+    bool push(const T &data) // 入队, 队列已满时返回false
+    {
+        cell *c;
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            c = &m_buffer[pos & m_mask];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) // 槽位空闲, 尝试占用
+            {
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (dif < 0) // 槽位中的数据还没有被取走, 队列已满
+            {
+                return false;
+            }
+            else // 被其他生产者抢先, 重新读取位置
+            {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        c->data = data;
+        c->sequence.store(pos + 1, std::memory_order_release); // 交给消费者
+        return true;
+    }
+
+    bool pop(T &data) // 出队, 队列为空时返回false
+    {
+        cell *c;
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            c = &m_buffer[pos & m_mask];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0) // 槽位已写入数据, 尝试取出
+            {
+                if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (dif < 0) // 队列为空
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        data = c->data;
+        c->sequence.store(pos + m_mask + 1, std::memory_order_release); // 槽位交还给下一轮的生产者
+        return true;
+    }
+
+    size_t size() const // 队列中元素的近似数量
+    {
+        size_t tail = m_enqueue_pos.load(std::memory_order_relaxed);
+        size_t head = m_dequeue_pos.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+
+private:
+    mpmc_queue(const mpmc_queue &);
+    mpmc_queue &operator=(const mpmc_queue &);
+
+    struct alignas(CACHELINE_SIZE) cell // 每个槽位独占一个缓存行
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    //  用填充字节把只读字段和两个位置计数器隔开在不同的缓存行里(对象本身不要求按缓存行对齐)
+    char m_pad0[CACHELINE_SIZE];
+    cell *m_buffer;
+    size_t m_mask;
+    char m_pad1[CACHELINE_SIZE - sizeof(cell *) - sizeof(size_t)];
+    std::atomic<size_t> m_enqueue_pos; // 生产者位置
+    char m_pad2[CACHELINE_SIZE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_dequeue_pos; // 消费者位置
+    char m_pad3[CACHELINE_SIZE - sizeof(std::atomic<size_t>)];
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include <sys/socket.h>
+#include "overload.h"
+#include "response.h"
+#include "syscall_stats.h"
+#include "server_stats.h"
+
+int overload_control::m_max_conn = 65536;
+int overload_control::m_max_queue = 10000;
+int overload_control::m_max_delay_ms = 0;
+int overload_control::m_retry_after = 1;
+
+char overload_control::s_response[256];
+size_t overload_control::s_response_len = 0;
+std::atomic<uint64_t> overload_control::s_delay_ewma(0);
+std::atomic<unsigned long> overload_control::s_shed_conns(0);
+std::atomic<unsigned long> overload_control::s_shed_reqs(0);
+
+static char *put(char *p, const byte_span &span)
+{
+    memcpy(p, span.data, span.len);
+    return p + span.len;
+}
+
+void overload_control::render()
+{
+    char *p = s_response;
+    p = put(p, http_status<503>::line());
+    p = put(p, header_span::content_length());
+    p = put(p, http_status<503>::body_length());
+    p = put(p, header_span::crlf());
+    p = put(p, header_span::content_type_html());
+    p = put(p, header_span::retry_after());
+    p += u64_to_dec(p, (unsigned long long)m_retry_after);
+    p = put(p, header_span::crlf());
+    p = put(p, header_span::close());
+    p = put(p, header_span::crlf());
+    p = put(p, http_status<503>::body());
+    s_response_len = p - s_response;
+}
+
+bool overload_control::overloaded(size_t queue_depth)
+{
+    if (queue_depth >= (size_t)m_max_queue)
+    {
+        return true;
+    }
+    return m_max_delay_ms > 0 && queue_depth > 0 &&
+           s_delay_ewma.load(std::memory_order_relaxed) > (uint64_t)m_max_delay_ms * 1000000;
+}
+
+/*
+    新值占1/8权重。多个工作线程同时更新时可能丢掉其中一次, 对估计值的影响可以忽略,
+    换来的是不需要CAS循环
+*/
+void overload_control::record_delay(uint64_t delay_ns)
+{
+    uint64_t old = s_delay_ewma.load(std::memory_order_relaxed);
+    s_delay_ewma.store(old - old / 8 + delay_ns / 8, std::memory_order_relaxed);
+}
+
+void overload_control::reject(int sockfd, bool request)
+{
+    //  尽力而为: 发送缓冲区肯定有空间容纳这么短的响应, 失败了也只是少一个错误页面
+    send(sockfd, s_response, s_response_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    syscall_stats::count(syscall_stats::SC_WRITE);
+    server_stats::count_status(503);
+    (request ? s_shed_reqs : s_shed_conns).fetch_add(1, std::memory_order_relaxed);
+}
+
+void overload_control::dump(FILE *out)
+{
+    fprintf(out, "overload: shed %lu connections %lu requests, queue delay avg %.3f ms\n",
+            s_shed_conns.load(std::memory_order_relaxed), s_shed_reqs.load(std::memory_order_relaxed),
+            s_delay_ewma.load(std::memory_order_relaxed) / 1e6);
+    fflush(out);
+}
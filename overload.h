@@ -0,0 +1,40 @@
+#ifndef OVERLOAD_H
+#define OVERLOAD_H
+
+#include <stdint.h>
+#include <cstdio>
+#include <atomic>
+
+/*
+    过载控制: 连接数超过上限时新连接直接回复503后关闭; 线程池模式下请求队列过长,
+    或者请求在队列中的平均等待时间超过上限时, 新读到的请求也直接在事件循环中回复503并关闭连接,
+    不再进入线程池。503响应(带Retry-After)在启动时生成一次, 拒绝时只需要一次send。
+    排队时间用指数加权移动平均估计, 只在队列非空时才据此拒绝, 队列排空后自然恢复接收请求
+*/
+class overload_control
+{
+public:
+    static int m_max_conn;     // 同时处理的最大连接数
+    static int m_max_queue;    // 线程池中等待处理的最大请求数
+    static int m_max_delay_ms; // 请求在队列中的平均等待时间上限(毫秒), 0表示不限制
+    static int m_retry_after;  // 503响应中建议客户端重试的秒数
+
+    static void render(); // 按照当前的m_retry_after生成503响应, 启动时调用一次
+
+    static bool overloaded(size_t queue_depth);   // 线程池模式下是否应该拒绝新的请求
+    static void record_delay(uint64_t delay_ns); // 工作线程取到请求时记录它的排队时间
+    static void reject(int sockfd, bool request); // 回复503, request为false表示拒绝的是新连接, 由调用者关闭连接
+    static void dump(FILE *out);
+
+    static unsigned long shed_connections() { return s_shed_conns.load(std::memory_order_relaxed); }
+    static unsigned long shed_requests() { return s_shed_reqs.load(std::memory_order_relaxed); }
+
+private:
+    static char s_response[256];
+    static size_t s_response_len;
+    static std::atomic<uint64_t> s_delay_ewma;      // 排队时间的移动平均(纳秒)
+    static std::atomic<unsigned long> s_shed_conns; // 拒绝的连接数
+    static std::atomic<unsigned long> s_shed_reqs;  // 拒绝的请求数
+};
+
+#endif
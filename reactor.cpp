@@ -0,0 +1,305 @@
+#include <sys/timerfd.h>
+#include "reactor.h"
+#include "syscall_stats.h"
+#include "overload.h"
+#include "latency_stats.h"
+#include "logger.h"
+
+extern void addfd(int epollfd, int fd, bool one_shot); // 添加文件描述符到epoll实例中
+
+int reactor::m_max_events = 10000;
+
+int open_listenfd(int port, bool reuse_port, int backlog, int incoming_cpu) // 创建并监听服务端套接字
+{
+    int listenfd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenfd < 0)
+    {
+        return -1;
+    }
+
+    //  设置重用关闭后的socket文件描述符
+    int reuse = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (reuse_port) // 多个监听套接字绑定同一端口, 由内核把新连接分摊到各个reactor
+    {
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+    }
+    if (incoming_cpu >= 0) // 网卡队列的中断绑定到同一组CPU时, 连接从收包到处理都不离开这个CPU
+    {
+        setsockopt(listenfd, SOL_SOCKET, SO_INCOMING_CPU, &incoming_cpu, sizeof(incoming_cpu));
+    }
+
+    //  给定服务端地址信息
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+
+    if (bind(listenfd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(listenfd, backlog) < 0)
+    {
+        close(listenfd);
+        return -1;
+    }
+    return listenfd;
+}
+
+reactor::reactor(int listenfd, http_conn *users, int max_fd, threadpool<http_conn> *pool)
+    : m_listenfd(listenfd), m_users(users), m_max_fd(max_fd), m_pool(pool), m_events(nullptr), m_drain_due(false),
+      m_drain_all(false)
+{
+    m_epollfd = epoll_create(5); // 创建epoll对象
+    if (m_epollfd < 0)
+    {
+        throw exception();
+    }
+    m_events = new epoll_event[m_max_events]; // 创建事件数组
+
+    //  监听文件描述符以边沿触发方式添加到epoll对象中, 每次事件把等待队列中的连接全部接受
+    epoll_event event;
+    event.data.fd = m_listenfd;
+    event.events = EPOLLIN | EPOLLET;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_listenfd, &event);
+
+    //  用timerfd代替SIGALRM, 定时事件和I/O事件一起由epoll_wait返回
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerfd < 0)
+    {
+        close(m_epollfd);
+        delete[] m_events;
+        throw exception();
+    }
+    struct itimerspec its;
+    bzero(&its, sizeof(its));
+    its.it_value.tv_sec = TIMESLOT;
+    its.it_interval.tv_sec = TIMESLOT;
+    timerfd_settime(m_timerfd, 0, &its, NULL);
+    addfd(m_epollfd, m_timerfd, false);
+}
+
+reactor::~reactor()
+{
+    if (m_listenfd != -1)
+    {
+        close(m_listenfd);
+    }
+    close(m_timerfd);
+    close(m_epollfd);
+    delete[] m_events;
+}
+
+void reactor::loop()
+{
+    while (!io_loop::draining() || m_listenfd != -1 || m_timers.size() > 0) // 优雅退出时等所有连接关闭
+    {
+        int number = epoll_wait(m_epollfd, m_events, m_max_events, -1); // 获取检测到的有变化文件描述符的数量
+        syscall_stats::count(syscall_stats::SC_EPOLL_WAIT);
+
+        if (number < 0 && errno != EINTR)
+        {
+            LOG_ERROR("epoll failure: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < number; i++) // 遍历获取有数据到来的文件描述符
+        {
+            int sockfd = m_events[i].data.fd;
+            if (sockfd == m_listenfd) // 如果是监听文件描述符的数据代表有新客户端连接
+            {
+                handle_accept();
+            }
+            else if (sockfd == m_timerfd)
+            {
+                handle_timer();
+            }
+            else if (m_events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                close_conn(m_users + sockfd);
+            }
+            else if (m_pool) // 线程池模式下EPOLLONESHOT每次只注册EPOLLIN和EPOLLOUT中的一个
+            {
+                if (m_events[i].events & EPOLLIN)
+                {
+                    handle_read(sockfd);
+                }
+                else if (m_events[i].events & EPOLLOUT)
+                {
+                    handle_write(sockfd);
+                }
+            }
+            else // 多reactor模式下两个事件都以边沿触发方式注册, 可能同时到达
+            {
+                if (m_events[i].events & EPOLLIN)
+                {
+                    handle_read(sockfd);
+                }
+                if ((m_events[i].events & EPOLLOUT) && m_users[sockfd].has_output()) // 没有等待发送的响应时忽略
+                {
+                    handle_write(sockfd);
+                }
+            }
+        }
+        if (m_drain_due)
+        {
+            m_drain_due = false;
+            drain();
+        }
+    }
+}
+
+/*
+    监听套接字是边沿触发的, 必须一直accept到EAGAIN, 否则剩下的连接要等到下一个新连接到来才会被处理。
+    accept4直接返回非阻塞、close-on-exec的连接, 每个新连接只需要accept4和epoll_ctl两次系统调用
+*/
+void reactor::handle_accept()
+{
+    while (true)
+    {
+        struct sockaddr_in client_address;
+        socklen_t client_addrlength = sizeof(client_address);
+        int connfd = accept4(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
+        syscall_stats::count(syscall_stats::SC_ACCEPT);
+        if (connfd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED) // 连接在接受前被对方重置, 继续接受下一个
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) // 文件描述符耗尽等错误, 等下一个事件再试
+            {
+                LOG_WARN("accept failure: %s", strerror(errno));
+            }
+            return;
+        }
+        if (http_conn::m_user_count >= overload_control::m_max_conn || connfd >= m_max_fd) // 连接数达到上限
+        {
+            overload_control::reject(connfd, false);
+            close(connfd);
+            continue;
+        }
+        http_conn *conn = m_users + connfd;
+        m_timers.del_timer(conn->timer()); // 线程池中关闭的连接来不及删除定时器, 在这里补上
+        conn->init(connfd, client_address, m_epollfd, m_pool == nullptr); // 分配并初始化一个任务类
+        refresh_timer(conn);
+    }
+}
+
+void reactor::handle_read(int sockfd)
+{
+    http_conn *conn = m_users + sockfd;
+    if (!conn->read())
+    {
+        close_conn(conn);
+        return;
+    }
+    refresh_timer(conn);
+    if (m_pool)
+    {
+        dispatch(conn);
+    }
+    else if (!conn->process_inline()) // 多reactor模式下直接在本线程解析并发送响应
+    {
+        close_conn(conn);
+    }
+    else
+    {
+        refresh_timer(conn);
+    }
+}
+
+void reactor::handle_write(int sockfd)
+{
+    http_conn *conn = m_users + sockfd;
+    if (!conn->write())
+    {
+        close_conn(conn);
+        return;
+    }
+    refresh_timer(conn);
+    if (m_pool && conn->has_buffered_request()) // 一批响应发完后缓冲区中还有流水线请求, 直接交给线程池
+    {
+        dispatch(conn);
+    }
+}
+
+void reactor::dispatch(http_conn *conn)
+{
+    if (!overload_control::overloaded(m_pool->queue_size()))
+    {
+        conn->m_queued_at = latency_stats::now_ns();
+        conn->m_pending++;
+        if (m_pool->append(conn))
+        {
+            return;
+        }
+        conn->m_pending--; // 队列已满, 连接没有交出去
+    }
+    overload_control::reject(conn->sockfd(), true);
+    close_conn(conn);
+}
+
+void reactor::handle_timer()
+{
+    uint64_t expirations = 0;
+    syscall_stats::count(syscall_stats::SC_OTHER);
+    if (::read(m_timerfd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    {
+        return;
+    }
+    while (expirations--) // 事件循环繁忙时可能错过几个tick, 一并补上
+    {
+        m_timers.tick(cb_func, this);
+    }
+    m_drain_due = io_loop::draining(); // 这一批后面可能还有监听套接字的事件, 处理完再关闭它
+}
+
+void reactor::refresh_timer(http_conn *conn)
+{
+    int timeout = conn->timer_timeout();
+    if (timeout > 0)
+    {
+        m_timers.adjust_timer(conn->timer(), (timeout + TIMESLOT - 1) / TIMESLOT);
+    }
+}
+
+void reactor::close_conn(http_conn *conn)
+{
+    m_timers.del_timer(conn->timer());
+    conn->close_conn();
+}
+
+void reactor::drain()
+{
+    if (m_listenfd != -1) // 交接给新进程的监听套接字在新进程中继续接受连接
+    {
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, NULL);
+        close(m_listenfd);
+        syscall_stats::count(syscall_stats::SC_CLOSE);
+        m_listenfd = -1;
+    }
+    m_drain_all = io_loop::drain_expired();
+    m_timers.for_each(drain_func, this);
+}
+
+void reactor::drain_func(wheel_timer *timer, void *arg)
+{
+    reactor *r = (reactor *)arg;
+    http_conn *conn = (http_conn *)timer->user_data;
+    if (conn->m_pending == 0 && (r->m_drain_all || conn->is_idle())) // 线程池中的请求处理完后再关闭
+    {
+        r->close_conn(conn);
+    }
+}
+
+void reactor::cb_func(wheel_timer *timer, void *arg) // 定时器回调函数, 关闭超时的连接
+{
+    reactor *r = (reactor *)arg;
+    http_conn *conn = (http_conn *)timer->user_data;
+    if (conn->m_pending > 0) // 请求还在线程池中处理, 稍后再检查
+    {
+        r->m_timers.add_timer(timer, 1);
+        return;
+    }
+    conn->close_conn();
+}
@@ -0,0 +1,58 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <pthread.h>
+#include <sys/epoll.h>
+#include "threadpool.h"
+#include "http_conn.h"
+#include "timer_wheel.h"
+#include "io_loop.h"
+
+//  创建非阻塞的监听套接字, reuse_port为true时设置SO_REUSEPORT;
+//  incoming_cpu不小于0时设置SO_INCOMING_CPU, 内核优先把在该CPU上收到的连接交给这个套接字
+int open_listenfd(int port, bool reuse_port, int backlog, int incoming_cpu = -1);
+
+/*
+    事件循环类, 每个reactor拥有自己的epoll实例和监听套接字。
+    线程池模式: 只有一个reactor, 读完数据后把连接交给线程池处理(EPOLLONESHOT)。
+    多reactor模式: 每个线程一个reactor, 各自通过SO_REUSEPORT监听同一端口,
+    连接始终由接受它的reactor线程读取、解析和发送, 不再经过线程池。
+    每个reactor用一个timerfd驱动自己的时间轮, 关闭超时的连接。
+*/
+class reactor : public io_loop
+{
+public:
+    static const int TIMESLOT = 1; // 时间轮一个tick的长度(秒)
+    static int m_max_events;       // 每次epoll_wait最多返回的事件数量
+
+    reactor(int listenfd, http_conn *users, int max_fd, threadpool<http_conn> *pool = nullptr);
+    ~reactor();
+
+    void loop(); // 在当前线程中运行事件循环, 优雅退出完成后返回
+
+private:
+    void handle_accept();           // 接受等待队列中的所有新连接
+    void handle_read(int sockfd);   // 处理可读事件
+    void handle_write(int sockfd);  // 处理可写事件
+    void handle_timer();            // 处理timerfd的到期事件
+    void dispatch(http_conn *conn); // 把连接交给线程池, 过载时直接回复503并关闭连接
+    void refresh_timer(http_conn *conn);
+    void close_conn(http_conn *conn); // 删除连接的定时器并关闭连接
+    void drain();                     // 优雅退出: 关闭监听套接字和空闲的连接, 期限到了关闭所有连接
+    static void cb_func(wheel_timer *timer, void *arg);    // 定时器回调函数
+    static void drain_func(wheel_timer *timer, void *arg); // 优雅退出时对每个连接调用
+
+private:
+    int m_epollfd;                 // 该reactor独占的epoll文件描述符
+    int m_listenfd;                // 该reactor的监听文件描述符, 由reactor关闭, 优雅退出开始后为-1
+    int m_timerfd;                 // 驱动时间轮的timerfd
+    timer_wheel m_timers;          // 该reactor上所有连接的超时定时器
+    http_conn *m_users;            // 任务对象数组(以文件描述符为下标, 所有reactor共享)
+    int m_max_fd;                  // 最大的文件描述符个数
+    threadpool<http_conn> *m_pool; // 线程池, 为空时连接由本reactor线程直接处理
+    epoll_event *m_events;         // 事件数组
+    bool m_drain_due;              // 优雅退出期间每个tick在处理完这一批事件后检查一次连接
+    bool m_drain_all;              // 优雅退出的期限已到, 不论是否空闲都关闭
+};
+
+#endif
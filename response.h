@@ -0,0 +1,303 @@
+#ifndef RESPONSE_H
+#define RESPONSE_H
+
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+// 一段只读的字节, 指向编译期就确定的字符串常量, 长度也在编译期算好
+struct byte_span
+{
+    const char *data;
+    size_t len;
+};
+
+#define SPAN(s) byte_span{s, sizeof(s) - 1}
+
+//  编译期把整数N转换成十进制字符串: to_chars<49>::value == "49"
+template <char... C>
+struct char_seq
+{
+    static const char value[sizeof...(C) + 1];
+    static const size_t len = sizeof...(C);
+};
+template <char... C>
+const char char_seq<C...>::value[sizeof...(C) + 1] = {C..., '\0'};
+
+template <size_t N, char... C>
+struct to_chars : to_chars<N / 10, (char)('0' + N % 10), C...>
+{
+};
+template <char... C>
+struct to_chars<0, C...> : char_seq<C...>
+{
+};
+template <>
+struct to_chars<0> : char_seq<'0'>
+{
+};
+
+/*
+    常见状态码的编译期特化, 提供完整的状态行、错误页面以及错误页面的长度,
+    Content-Length的数字也在编译期生成, 拼装响应时只需要几次定长的memcpy
+*/
+template <int STATUS>
+struct http_status;
+
+#define DEFINE_HTTP_STATUS(code, title, form)                                                      \
+    template <>                                                                                    \
+    struct http_status<code>                                                                       \
+    {                                                                                              \
+        static byte_span line() { return SPAN("HTTP/1.1 " #code " " title "\r\n"); }               \
+        static byte_span body() { return SPAN(form); }                                             \
+        static byte_span body_length() { return byte_span{to_chars<sizeof(form) - 1>::value,      \
+                                                          to_chars<sizeof(form) - 1>::len}; }      \
+    };
+
+DEFINE_HTTP_STATUS(100, "Continue", "")
+DEFINE_HTTP_STATUS(200, "OK", "")
+DEFINE_HTTP_STATUS(201, "Created", "")
+DEFINE_HTTP_STATUS(204, "No Content", "")
+DEFINE_HTTP_STATUS(206, "Partial Content", "")
+DEFINE_HTTP_STATUS(304, "Not Modified", "")
+DEFINE_HTTP_STATUS(400, "Bad Request", "Your request has bad syntax or is inherently impossible to satisfy.\n")
+DEFINE_HTTP_STATUS(403, "Forbidden", "You do not have permission to get file from this server.\n")
+DEFINE_HTTP_STATUS(404, "Not Found", "The requested file was not found on this server.\n")
+DEFINE_HTTP_STATUS(405, "Method Not Allowed", "The requested method is not supported for this resource.\n")
+DEFINE_HTTP_STATUS(413, "Content Too Large", "The request body is larger than the server is willing to accept.\n")
+DEFINE_HTTP_STATUS(416, "Range Not Satisfiable", "")
+DEFINE_HTTP_STATUS(500, "Internal Error", "There was an unusual problem serving the requested file.\n")
+DEFINE_HTTP_STATUS(503, "Service Unavailable", "The server is temporarily overloaded, please try again later.\n")
+
+#undef DEFINE_HTTP_STATUS
+
+//  响应中固定不变的头部片段
+namespace header_span
+{
+    inline byte_span content_length() { return SPAN("Content-Length: "); }
+    inline byte_span content_type_html() { return SPAN("Content-Type:text/html\r\n"); }
+    inline byte_span content_type_json() { return SPAN("Content-Type: application/json\r\n"); }
+    inline byte_span content_type_prometheus() { return SPAN("Content-Type: text/plain; version=0.0.4\r\n"); }
+    inline byte_span no_store() { return SPAN("Cache-Control: no-store\r\n"); }
+    inline byte_span keep_alive() { return SPAN("Connection: keep-alive\r\n"); }
+    inline byte_span close() { return SPAN("Connection: close\r\n"); }
+    inline byte_span retry_after() { return SPAN("Retry-After: "); }
+    inline byte_span encoding_gzip() { return SPAN("Content-Encoding: gzip\r\n"); }
+    inline byte_span encoding_br() { return SPAN("Content-Encoding: br\r\n"); }
+    inline byte_span vary_encoding() { return SPAN("Vary: Accept-Encoding\r\n"); }
+    inline byte_span last_modified() { return SPAN("Last-Modified: "); }
+    inline byte_span etag() { return SPAN("ETag: "); }
+    inline byte_span accept_ranges() { return SPAN("Accept-Ranges: bytes\r\n"); }
+    inline byte_span content_range() { return SPAN("Content-Range: bytes "); }
+    inline byte_span multipart_byteranges() { return SPAN("Content-Type: multipart/byteranges; boundary="); }
+    inline byte_span allow() { return SPAN("Allow: GET, HEAD\r\n"); }
+    inline byte_span crlf() { return SPAN("\r\n"); }
+}
+
+inline int append_span(char *buf, const byte_span &span) // 调用者保证buf放得下
+{
+    memcpy(buf, span.data, span.len);
+    return span.len;
+}
+
+//  按扩展名确定的Content-Type头部, compressible表示文本类型, 可能有预先压缩的版本
+struct mime_type
+{
+    const char *ext;
+    byte_span header;
+    bool compressible;
+};
+
+#define MIME(ext, type, compressible) {ext, SPAN("Content-Type: " type "\r\n"), compressible}
+
+inline const mime_type &mime_of(const char *path) // 取path最后一个'/'之后的扩展名查表, 不认识的按二进制数据处理
+{
+    static const mime_type types[] = {
+        MIME("html", "text/html; charset=utf-8", true),
+        MIME("htm", "text/html; charset=utf-8", true),
+        MIME("css", "text/css; charset=utf-8", true),
+        MIME("js", "text/javascript; charset=utf-8", true),
+        MIME("mjs", "text/javascript; charset=utf-8", true),
+        MIME("json", "application/json", true),
+        MIME("map", "application/json", true),
+        MIME("xml", "application/xml", true),
+        MIME("txt", "text/plain; charset=utf-8", true),
+        MIME("csv", "text/csv; charset=utf-8", true),
+        MIME("md", "text/markdown; charset=utf-8", true),
+        MIME("svg", "image/svg+xml", true),
+        MIME("ico", "image/x-icon", true),
+        MIME("wasm", "application/wasm", true),
+        MIME("ttf", "font/ttf", true),
+        MIME("otf", "font/otf", true),
+        MIME("jpg", "image/jpeg", false),
+        MIME("jpeg", "image/jpeg", false),
+        MIME("png", "image/png", false),
+        MIME("gif", "image/gif", false),
+        MIME("webp", "image/webp", false),
+        MIME("avif", "image/avif", false),
+        MIME("woff", "font/woff", false),
+        MIME("woff2", "font/woff2", false),
+        MIME("mp4", "video/mp4", false),
+        MIME("webm", "video/webm", false),
+        MIME("mp3", "audio/mpeg", false),
+        MIME("pdf", "application/pdf", false),
+        MIME("zip", "application/zip", false),
+        MIME("gz", "application/gzip", false),
+        MIME("br", "application/octet-stream", false),
+    };
+    static const mime_type unknown = MIME("", "application/octet-stream", false);
+
+    const char *slash = strrchr(path, '/');
+    const char *dot = strrchr(slash ? slash : path, '.');
+    if (dot)
+    {
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i)
+        {
+            if (strcasecmp(dot + 1, types[i].ext) == 0)
+            {
+                return types[i];
+            }
+        }
+    }
+    return unknown;
+}
+
+#undef MIME
+
+/*
+    把无符号整数转换成十进制写入buf, 返回写入的字节数(不写'\0')。
+    先算出位数, 再从低位往高位每次查表写两位, 比vsnprintf解析格式串快得多
+*/
+inline int u64_to_dec(char *buf, unsigned long long value)
+{
+    static const char digits[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    int len = 1;
+    for (unsigned long long v = value; v >= 10; v /= 10)
+    {
+        ++len;
+    }
+    char *p = buf + len;
+    while (value >= 100)
+    {
+        unsigned idx = (unsigned)(value % 100) * 2;
+        value /= 100;
+        *--p = digits[idx + 1];
+        *--p = digits[idx];
+    }
+    if (value >= 10)
+    {
+        unsigned idx = (unsigned)value * 2;
+        *--p = digits[idx + 1];
+        *--p = digits[idx];
+    }
+    else
+    {
+        *--p = (char)('0' + value);
+    }
+    return len;
+}
+
+/*
+    按IMF-fixdate格式("Sun, 06 Nov 1994 08:49:37 GMT", 固定29字节)把时间写入buf, 返回写入的字节数。
+    不使用strftime, 不受locale影响
+*/
+inline int render_http_date(char *buf, time_t t)
+{
+    static const char days[] = "SunMonTueWedThuFriSat";
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char *p = buf;
+    memcpy(p, days + tm.tm_wday * 3, 3);
+    p[3] = ',';
+    p[4] = ' ';
+    p[5] = (char)('0' + tm.tm_mday / 10);
+    p[6] = (char)('0' + tm.tm_mday % 10);
+    p[7] = ' ';
+    memcpy(p + 8, months + tm.tm_mon * 3, 3);
+    p[11] = ' ';
+    int year = tm.tm_year + 1900;
+    p[12] = (char)('0' + year / 1000 % 10);
+    p[13] = (char)('0' + year / 100 % 10);
+    p[14] = (char)('0' + year / 10 % 10);
+    p[15] = (char)('0' + year % 10);
+    p[16] = ' ';
+    p[17] = (char)('0' + tm.tm_hour / 10);
+    p[18] = (char)('0' + tm.tm_hour % 10);
+    p[19] = ':';
+    p[20] = (char)('0' + tm.tm_min / 10);
+    p[21] = (char)('0' + tm.tm_min % 10);
+    p[22] = ':';
+    p[23] = (char)('0' + tm.tm_sec / 10);
+    p[24] = (char)('0' + tm.tm_sec % 10);
+    memcpy(p + 25, " GMT", 4);
+    return 29;
+}
+
+inline int u64_to_hex(char *buf, unsigned long long value) // 小写十六进制, 不写'\0'
+{
+    static const char digits[] = "0123456789abcdef";
+    int len = 1;
+    for (unsigned long long v = value; v >= 16; v >>= 4)
+    {
+        ++len;
+    }
+    for (int i = len - 1; i >= 0; --i, value >>= 4)
+    {
+        buf[i] = digits[value & 15];
+    }
+    return len;
+}
+
+/*
+    由inode、大小和修改时间生成实体标签"ino-size-mtime"(十六进制, 带引号), 最长60字节。
+    文件在最近一秒内被修改过时同一秒内可能再次修改而mtime不变, 这时生成弱标签(W/前缀)
+*/
+inline int render_etag(char *buf, unsigned long long ino, unsigned long long size, time_t mtime, time_t now)
+{
+    char *p = buf;
+    if (mtime >= now)
+    {
+        memcpy(p, "W/", 2);
+        p += 2;
+    }
+    *p++ = '"';
+    p += u64_to_hex(p, ino);
+    *p++ = '-';
+    p += u64_to_hex(p, size);
+    *p++ = '-';
+    p += u64_to_hex(p, (unsigned long long)mtime);
+    *p++ = '"';
+    return p - buf;
+}
+
+/*
+    写入整行"Content-Range: bytes first-last/size\r\n", first为负数时范围部分写成"*"(416响应),
+    返回写入的字节数, 最长85字节
+*/
+inline int render_content_range(char *buf, long long first, long long last, unsigned long long size)
+{
+    char *p = buf;
+    p += append_span(p, header_span::content_range());
+    if (first < 0)
+    {
+        *p++ = '*';
+    }
+    else
+    {
+        p += u64_to_dec(p, first);
+        *p++ = '-';
+        p += u64_to_dec(p, last);
+    }
+    *p++ = '/';
+    p += u64_to_dec(p, size);
+    *p++ = '\r';
+    *p++ = '\n';
+    return p - buf;
+}
+
+#endif
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include "server_stats.h"
+#include "http_conn.h"
+#include "threadpool.h"
+#include "overload.h"
+
+std::atomic<server_stats::counters *> server_stats::s_head(NULL);
+
+static const int status_codes[] = {200, 201, 204, 206, 304, 400, 403, 404, 405, 413, 416, 500, 503};
+static const int status_count = sizeof(status_codes) / sizeof(status_codes[0]);
+
+server_stats::counters *server_stats::attach()
+{
+    counters *c = new counters;
+    for (int i = 0; i < ST_COUNTER_COUNT; ++i)
+    {
+        c->values[i].store(0, std::memory_order_relaxed);
+    }
+    c->next = s_head.load(std::memory_order_relaxed);
+    while (!s_head.compare_exchange_weak(c->next, c, std::memory_order_release, std::memory_order_relaxed))
+    {
+    }
+    return c;
+}
+
+void server_stats::count_status(int status)
+{
+    for (int i = 0; i < status_count; ++i)
+    {
+        if (status_codes[i] == status)
+        {
+            add((COUNTER)(ST_STATUS_200 + i));
+            return;
+        }
+    }
+}
+
+void server_stats::totals(unsigned long values[ST_COUNTER_COUNT])
+{
+    for (int i = 0; i < ST_COUNTER_COUNT; ++i)
+    {
+        values[i] = 0;
+    }
+    for (counters *c = s_head.load(std::memory_order_acquire); c; c = c->next)
+    {
+        for (int i = 0; i < ST_COUNTER_COUNT; ++i)
+        {
+            values[i] += c->values[i].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+namespace
+{
+    struct writer // 顺序写入定长缓冲区, 空间不够时记录溢出
+    {
+        char *buf;
+        size_t size;
+        size_t len;
+        bool overflow;
+
+        void put(const char *format, ...)
+        {
+            if (overflow)
+            {
+                return;
+            }
+            va_list args;
+            va_start(args, format);
+            int n = vsnprintf(buf + len, size - len, format, args);
+            va_end(args);
+            if (n < 0 || (size_t)n >= size - len)
+            {
+                overflow = true;
+                return;
+            }
+            len += n;
+        }
+    };
+}
+
+int server_stats::render(char *buf, size_t size, bool prometheus)
+{
+    unsigned long values[ST_COUNTER_COUNT];
+    totals(values);
+    int active = http_conn::m_user_count.load(std::memory_order_relaxed);
+    size_t queue_depth = http_conn::m_pool ? http_conn::m_pool->queue_size() : 0; // 只读队列的两个位置, 不加锁
+    file_cache *cache = http_conn::m_file_cache;
+    unsigned long hits = cache ? cache->hits() : 0;
+    unsigned long misses = cache ? cache->misses() : 0;
+    size_t cache_bytes = cache ? cache->bytes() : 0;
+    double hit_rate = hits + misses ? (double)hits / (hits + misses) : 0.0;
+
+    writer w = {buf, size, 0, false};
+    if (prometheus)
+    {
+        w.put("# TYPE webserver_connections_active gauge\nwebserver_connections_active %d\n", active);
+        w.put("# TYPE webserver_connections_accepted_total counter\nwebserver_connections_accepted_total %lu\n",
+              values[ST_ACCEPTED]);
+        w.put("# TYPE webserver_connections_closed_total counter\nwebserver_connections_closed_total %lu\n",
+              values[ST_CLOSED]);
+        w.put("# TYPE webserver_queue_depth gauge\nwebserver_queue_depth %zu\n", queue_depth);
+        w.put("# TYPE webserver_sent_bytes_total counter\nwebserver_sent_bytes_total %lu\n", values[ST_BYTES_SENT]);
+        w.put("# TYPE webserver_responses_total counter\n");
+        for (int i = 0; i < status_count; ++i)
+        {
+            w.put("webserver_responses_total{code=\"%d\"} %lu\n", status_codes[i], values[ST_STATUS_200 + i]);
+        }
+        w.put("# TYPE webserver_cache_hits_total counter\nwebserver_cache_hits_total %lu\n", hits);
+        w.put("# TYPE webserver_cache_misses_total counter\nwebserver_cache_misses_total %lu\n", misses);
+        w.put("# TYPE webserver_cache_bytes gauge\nwebserver_cache_bytes %zu\n", cache_bytes);
+        w.put("# TYPE webserver_shed_connections_total counter\nwebserver_shed_connections_total %lu\n",
+              overload_control::shed_connections());
+        w.put("# TYPE webserver_shed_requests_total counter\nwebserver_shed_requests_total %lu\n",
+              overload_control::shed_requests());
+    }
+    else
+    {
+        w.put("{\"connections\":{\"active\":%d,\"accepted\":%lu,\"closed\":%lu},", active, values[ST_ACCEPTED],
+              values[ST_CLOSED]);
+        w.put("\"queue_depth\":%zu,\"bytes_sent\":%lu,\"responses\":{", queue_depth, values[ST_BYTES_SENT]);
+        for (int i = 0; i < status_count; ++i)
+        {
+            w.put("%s\"%d\":%lu", i ? "," : "", status_codes[i], values[ST_STATUS_200 + i]);
+        }
+        w.put("},\"cache\":{\"hits\":%lu,\"misses\":%lu,\"hit_rate\":%.4f,\"bytes\":%zu},", hits, misses, hit_rate,
+              cache_bytes);
+        w.put("\"shed\":{\"connections\":%lu,\"requests\":%lu}}\n", overload_control::shed_connections(),
+              overload_control::shed_requests());
+    }
+    return w.overflow ? -1 : (int)w.len;
+}
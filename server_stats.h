@@ -0,0 +1,70 @@
+#ifndef SERVER_STATS_H
+#define SERVER_STATS_H
+
+#include <stddef.h>
+#include <atomic>
+
+/*
+    服务器的运行计数器(接受/关闭的连接数、发送的字节数、各状态码的响应数),
+    和syscall_stats一样每个线程写自己的计数器, 读取时遍历所有线程求和。
+    render把这些计数器和连接数、队列长度、缓存命中率等即时值生成为JSON或Prometheus文本格式,
+    供内置的统计页面(STATS_PATH)使用, 整个过程不加任何锁
+*/
+class server_stats
+{
+public:
+    enum COUNTER
+    {
+        ST_ACCEPTED = 0,
+        ST_CLOSED,
+        ST_BYTES_SENT,
+        ST_STATUS_200,
+        ST_STATUS_201,
+        ST_STATUS_204,
+        ST_STATUS_206,
+        ST_STATUS_304,
+        ST_STATUS_400,
+        ST_STATUS_403,
+        ST_STATUS_404,
+        ST_STATUS_405,
+        ST_STATUS_413,
+        ST_STATUS_416,
+        ST_STATUS_500,
+        ST_STATUS_503,
+        ST_COUNTER_COUNT
+    };
+
+    static void add(COUNTER counter, unsigned long n = 1)
+    {
+        std::atomic<unsigned long> &c = local().values[counter];
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static void count_status(int status);
+    static void totals(unsigned long values[ST_COUNTER_COUNT]); // 所有线程的合计
+
+    static int render(char *buf, size_t size, bool prometheus); // 返回写入的字节数, 超过size时返回-1
+
+private:
+    struct counters
+    {
+        std::atomic<unsigned long> values[ST_COUNTER_COUNT];
+        counters *next;
+    };
+
+    static counters &local()
+    {
+        static thread_local counters *c = NULL;
+        if (!c)
+        {
+            c = attach();
+        }
+        return *c;
+    }
+
+    static counters *attach();
+
+    static std::atomic<counters *> s_head;
+};
+
+#endif
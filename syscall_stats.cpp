@@ -0,0 +1,48 @@
+#include "syscall_stats.h"
+
+std::atomic<syscall_stats::counters *> syscall_stats::s_head(NULL);
+
+static const char *kind_names[syscall_stats::SC_KIND_COUNT] = {
+    "epoll_wait", "epoll_ctl", "accept", "read", "write", "close", "io_uring_enter", "other"};
+
+syscall_stats::counters *syscall_stats::attach()
+{
+    counters *c = new counters;
+    for (int i = 0; i < SC_KIND_COUNT; ++i)
+    {
+        c->calls[i].store(0, std::memory_order_relaxed);
+    }
+    c->requests.store(0, std::memory_order_relaxed);
+    c->next = s_head.load(std::memory_order_relaxed);
+    while (!s_head.compare_exchange_weak(c->next, c, std::memory_order_release, std::memory_order_relaxed))
+    {
+    }
+    return c;
+}
+
+void syscall_stats::dump(FILE *out)
+{
+    unsigned long calls[SC_KIND_COUNT] = {0};
+    unsigned long requests = 0;
+    for (counters *c = s_head.load(std::memory_order_acquire); c; c = c->next)
+    {
+        for (int i = 0; i < SC_KIND_COUNT; ++i)
+        {
+            calls[i] += c->calls[i].load(std::memory_order_relaxed);
+        }
+        requests += c->requests.load(std::memory_order_relaxed);
+    }
+
+    unsigned long total = 0;
+    fprintf(out, "syscalls (%lu requests):", requests);
+    for (int i = 0; i < SC_KIND_COUNT; ++i)
+    {
+        total += calls[i];
+        if (calls[i] > 0)
+        {
+            fprintf(out, " %s %lu (%.2f/req)", kind_names[i], calls[i], requests ? (double)calls[i] / requests : 0.0);
+        }
+    }
+    fprintf(out, " total %lu (%.2f/req)\n", total, requests ? (double)total / requests : 0.0);
+    fflush(out);
+}
@@ -0,0 +1,60 @@
+#ifndef SYSCALL_STATS_H
+#define SYSCALL_STATS_H
+
+#include <cstdio>
+#include <atomic>
+
+/*
+    按线程统计I/O路径上的系统调用次数和处理的请求数, 用来观察每个请求平均需要几次系统调用。
+    每个线程第一次计数时分配自己的计数器并挂到全局链表上, 之后只由该线程写,
+    计数不需要加锁也不需要原子的读-改-写指令; 输出时遍历链表把所有线程的计数加起来
+*/
+class syscall_stats
+{
+public:
+    enum KIND
+    {
+        SC_EPOLL_WAIT = 0,
+        SC_EPOLL_CTL,
+        SC_ACCEPT,
+        SC_READ,        // 从socket读取数据
+        SC_WRITE,       // writev/sendmsg/sendfile
+        SC_CLOSE,
+        SC_URING_ENTER, // io_uring_enter
+        SC_OTHER,       // fcntl/setsockopt/getpeername/读timerfd等
+        SC_KIND_COUNT
+    };
+
+    static void count(KIND kind) { bump(local().calls[kind]); }
+    static void count_request() { bump(local().requests); }
+    static void dump(FILE *out); // 输出所有线程的合计以及平均每个请求的次数
+
+private:
+    struct counters
+    {
+        std::atomic<unsigned long> calls[SC_KIND_COUNT];
+        std::atomic<unsigned long> requests;
+        counters *next;
+    };
+
+    static void bump(std::atomic<unsigned long> &counter) // 单写者计数器
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static counters &local()
+    {
+        static thread_local counters *c = NULL;
+        if (!c)
+        {
+            c = attach();
+        }
+        return *c;
+    }
+
+    static counters *attach(); // 为当前线程分配计数器并挂到全局链表上, 线程退出后也不释放
+
+    static std::atomic<counters *> s_head;
+};
+
+#endif
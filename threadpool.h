@@ -1,101 +1,264 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
-#include <list>
 #include <cstdio>
+#include <atomic>
 #include "locker.h"
+#include "mpmc_queue.h"
 
 template <typename T>
 class threadpool // 线程池类
 {
 public:
-    threadpool(int thread_number = 8, int max_requests = 10000) : m_threads(nullptr)
+    static const int SPIN_COUNT = 128; // 工作线程在睡眠前自旋检查队列的次数
+
+    /*
+        work_stealing为false时所有线程共享一个全局FIFO队列;
+        为true时每个工作线程拥有自己的队列, 同一个连接的请求总是优先投递给同一个线程
+        (缓存更热), 线程自己的队列为空时再依次从其他线程的队列中窃取任务。
+        cpus不为空时第i个工作线程在开始运行前绑定到cpus[i]上(-1表示不绑定)
+    */
+    threadpool(int thread_number = 8, int max_requests = 10000, bool work_stealing = false, const int *cpus = nullptr)
+        : m_threads(nullptr), m_slots(nullptr), m_work_stealing(work_stealing),
+          m_workqueue(work_stealing || max_requests <= 0 ? 1 : max_requests), m_idle(0), m_stop(false)
     {
         if ((thread_number <= 0) || (max_requests <= 0)) // 检查参数正确性
         {
             throw exception();
         }
         m_thread_number = thread_number;            // 设置预分配线程数量
-        m_max_requests = max_requests;              // 设置请求数量上限
+        m_max_requests = max_requests;              // 设置请求数量上限(无锁队列的容量会向上取整为2的幂)
         m_threads = new pthread_t[m_thread_number]; // 堆区开辟线程池数组
-        if (!m_threads)
+        m_slots = new worker_slot[m_thread_number];
+        for (int i = 0; i < thread_number; ++i)
         {
-            throw exception();
-        }
-        for (int i = 0; i < thread_number; ++i) // 创建多线程并将他们设置为脱离线程
-        {
-            if (pthread_create(m_threads + i, NULL, worker, this) != 0) // 创建线程失败
+            m_slots[i].pool = this;
+            m_slots[i].index = i;
+            m_slots[i].queue = nullptr;
+            m_slots[i].cpu = cpus ? cpus[i] : -1;
+            m_slots[i].executed.store(0, std::memory_order_relaxed);
+            m_slots[i].stolen.store(0, std::memory_order_relaxed);
+            if (m_work_stealing) // 总容量仍为max_requests, 平均分给每个线程
             {
-                delete[] m_threads;
-                throw exception();
+                int capacity = (max_requests + thread_number - 1) / thread_number;
+                m_slots[i].queue = new mpmc_queue<T *>(capacity);
             }
-            if (pthread_detach(m_threads[i]) != 0) // 线程分离失败
+        }
+        for (int i = 0; i < thread_number; ++i) // 创建工作线程, 析构时等待它们退出
+        {
+            if (pthread_create(m_threads + i, NULL, worker, m_slots + i) != 0) // 创建线程失败
             {
-                delete[] m_threads;
+                join_workers(i);
+                release();
                 throw exception();
             }
         }
-        m_stop = false; // 设置线程处于运行状态
     }
 
-    ~threadpool() // 线程池析构函数
+    ~threadpool() // 通知所有工作线程结束并等待它们退出, 队列中剩下的任务不再执行
     {
-        delete[] m_threads; // 回收堆区线程数组
-        m_stop = true;      // 线程停止运行
+        join_workers(m_thread_number);
+        release();
     }
 
     bool append(T *request) // 向请求队列添加任务
     {
-        m_queuelocker.lock();                     // 操作请求队列时一定要加锁因为它被所有线程共享
-        if (m_workqueue.size() >= m_max_requests) // 请求队列最大请求数已满无法加入新请求
+        if (!push(request)) // 请求队列已满无法加入新请求
         {
-            m_queuelocker.unlock();
             return false;
         }
-        m_workqueue.push_back(request); // 加入新的请求
-        m_queuelocker.unlock();         // 给请求队列解锁
-        m_queuestat.post();             // 信号量数量增加则请求可被子线程处理
+        /*
+            与run()中m_idle自增后的屏障配对: 要么工作线程睡眠前能看到这个请求,
+            要么这里能看到有线程在睡眠并唤醒它, 没有线程睡眠时不需要任何系统调用
+        */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_idle.load(std::memory_order_relaxed) > 0)
+        {
+            m_queuestat.post();
+        }
         return true;
     }
 
+    size_t queue_size() const // 当前等待处理的请求数量(近似值)
+    {
+        if (!m_work_stealing)
+        {
+            return m_workqueue.size();
+        }
+        size_t size = 0;
+        for (int i = 0; i < m_thread_number; ++i)
+        {
+            size += m_slots[i].queue->size();
+        }
+        return size;
+    }
+
+    int thread_number() const
+    {
+        return m_thread_number;
+    }
+
+    void worker_stat(int i, unsigned long &executed, unsigned long &stolen) const // 获取第i个工作线程执行和窃取的任务数
+    {
+        executed = m_slots[i].executed.load(std::memory_order_relaxed);
+        stolen = m_slots[i].stolen.load(std::memory_order_relaxed);
+    }
+
+    void dump_stats(FILE *out) const // 输出每个工作线程的统计信息, 用于确认各队列负载是否均衡
+    {
+        for (int i = 0; i < m_thread_number; ++i)
+        {
+            unsigned long executed, stolen;
+            worker_stat(i, executed, stolen);
+            fprintf(out, "worker %d: executed %lu stolen %lu queued %zu\n", i, executed, stolen,
+                    m_work_stealing ? m_slots[i].queue->size() : (size_t)0);
+        }
+        fflush(out);
+    }
+
 private:
+    struct worker_slot // 每个工作线程的私有数据, 按缓存行分开避免计数器之间的伪共享
+    {
+        threadpool *pool;
+        int index;
+        int cpu;                             // 绑定的CPU, -1表示不绑定
+        mpmc_queue<T *> *queue;              // 工作窃取模式下该线程自己的队列
+        std::atomic<unsigned long> executed; // 执行的任务数(只由本线程写)
+        std::atomic<unsigned long> stolen;   // 从其他线程队列中窃取的任务数(只由本线程写)
+        char pad[CACHELINE_SIZE];
+    };
+
     static void *worker(void *arg) // 工作线程的回调函数从工作队列中取出任务并执行
     {
-        threadpool *pool = (threadpool *)arg; // 获取线程池类的对象
-        pool->run();                          // 这才是线程的真正运行方法
-        return NULL;                          // 返回什么应该没关系
+        worker_slot *slot = (worker_slot *)arg; // 获取线程池类的对象
+        if (slot->cpu >= 0)
+        {
+            bind_cpu(pthread_self(), slot->cpu);
+        }
+        slot->pool->run(slot);                  // 这才是线程的真正运行方法
+        return NULL;                            // 返回什么应该没关系
     }
 
-    void run() // 为什么不直接在worker里面进行线程运行工作
+    static void bump(std::atomic<unsigned long> &counter) // 单写者计数器, 不需要原子的读-改-写指令
     {
-        while (!m_stop) // 检查线程是否停止工作
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    bool push(T *request)
+    {
+        if (!m_work_stealing)
         {
-            m_queuestat.wait();   // 检查是否有可提取的请求
-            m_queuelocker.lock(); // 给工作队列上锁
-            if (m_workqueue.empty())
+            return m_workqueue.push(request);
+        }
+        //  根据任务对象在数组中的位置(即连接的文件描述符)选择线程, 队列满时依次尝试其他线程
+        int home = (int)(((uintptr_t)request / sizeof(T)) % m_thread_number);
+        for (int i = 0; i < m_thread_number; ++i)
+        {
+            if (m_slots[(home + i) % m_thread_number].queue->push(request))
             {
-                m_queuelocker.unlock();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool pop(worker_slot *self, T *&request)
+    {
+        if (!m_work_stealing)
+        {
+            return m_workqueue.pop(request);
+        }
+        if (self->queue->pop(request)) // 优先处理自己队列中的任务
+        {
+            return true;
+        }
+        for (int i = 1; i < m_thread_number; ++i) // 自己的队列为空则从其他线程窃取
+        {
+            if (m_slots[(self->index + i) % m_thread_number].queue->pop(request))
+            {
+                bump(self->stolen);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    T *take(worker_slot *self) // 取出一个任务, 先自旋一段时间, 仍然没有任务时才在信号量上睡眠
+    {
+        T *request = nullptr;
+        int spin = 0;
+        while (!m_stop)
+        {
+            if (pop(self, request))
+            {
+                return request;
+            }
+            if (++spin < SPIN_COUNT)
+            {
+                cpu_relax();
                 continue;
             }
-            T *request = m_workqueue.front(); // 获取并移除最先装入的任务对象
-            m_workqueue.pop_front();
-            m_queuelocker.unlock(); // 给工作队列解锁
+            m_idle.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (pop(self, request)) // 登记睡眠后再检查一次, 避免错过append()的唤醒
+            {
+                m_idle.fetch_sub(1);
+                return request;
+            }
+            m_queuestat.wait();
+            m_idle.fetch_sub(1);
+            spin = 0;
+        }
+        return nullptr;
+    }
+
+    void join_workers(int count) // 唤醒所有睡眠的工作线程, 等前count个线程执行完手上的任务后退出
+    {
+        m_stop = true;
+        for (int i = 0; i < count; ++i)
+        {
+            m_queuestat.post();
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            pthread_join(m_threads[i], NULL);
+        }
+    }
+
+    void release()
+    {
+        for (int i = 0; i < m_thread_number; ++i)
+        {
+            delete m_slots[i].queue;
+        }
+        delete[] m_slots;
+        delete[] m_threads;
+    }
+
+    void run(worker_slot *self) // 为什么不直接在worker里面进行线程运行工作
+    {
+        while (!m_stop) // 检查线程是否停止工作
+        {
+            T *request = take(self); // 获取并移除最先装入的任务对象
             if (!request)
             {
                 continue;
             }
             request->process(); // 任务执行进入任务类的成员方法
+            bump(self->executed);
         }
     }
 
 private:
-    int m_thread_number;   // 线程的数量
-    int m_max_requests;    // 请求队列中最多允许的等待处理的请求的数量
-    pthread_t *m_threads;  // 指向堆区线程数组的指针
-    list<T *> m_workqueue; // 请求队列
-    locker m_queuelocker;  // 保护请求队列的互斥锁
-    sem m_queuestat;       // 请求队列中任务的信号量
-    bool m_stop;           // 是否结束线程
+    int m_thread_number;         // 线程的数量
+    int m_max_requests;          // 请求队列中最多允许的等待处理的请求的数量
+    pthread_t *m_threads;        // 指向堆区线程数组的指针
+    worker_slot *m_slots;        // 每个工作线程的私有数据
+    bool m_work_stealing;        // 是否启用工作窃取模式
+    mpmc_queue<T *> m_workqueue; // 无锁请求队列(全局FIFO模式)
+    std::atomic<int> m_idle;     // 正在信号量上睡眠的工作线程数量
+    sem m_queuestat;             // 用于唤醒睡眠的工作线程
+    std::atomic<bool> m_stop;    // 是否结束线程
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,133 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+
+// 时间轮上的定时器节点, 嵌入在用户对象中, 添加和删除都不需要分配内存
+class wheel_timer
+{
+public:
+    wheel_timer() : expire(0), user_data(NULL), prev(NULL), next(NULL), linked(false) {}
+
+public:
+    unsigned long expire; // 到期的tick, 使用绝对值
+    void *user_data;      // 定时器所属的用户对象
+    wheel_timer *prev;    // 指向同一个槽中的前一个定时器
+    wheel_timer *next;    // 指向同一个槽中的后一个定时器
+    bool linked;          // 是否已经挂在时间轮上
+};
+
+/*
+    哈希时间轮。每个槽是一个无序的双向链表, 定时器按到期tick对槽数取模放入对应的槽,
+    添加、删除、调整都是O(1)。每次tick只检查当前槽, 其中到期tick不大于当前tick的定时器被触发,
+    超过一圈的定时器留在槽中等下一圈。
+*/
+class timer_wheel
+{
+public:
+    static const int SLOTS = 64; // 槽的数量
+
+    timer_wheel() : m_cur_tick(0), m_count(0)
+    {
+        for (int i = 0; i < SLOTS; ++i)
+        {
+            m_slots[i] = NULL;
+        }
+    }
+
+    // 添加定时器, ticks个tick之后到期
+    void add_timer(wheel_timer *timer, unsigned long ticks)
+    {
+        if (!timer)
+        {
+            return;
+        }
+        if (ticks == 0)
+        {
+            ticks = 1;
+        }
+        timer->expire = m_cur_tick + ticks;
+        wheel_timer *&head = m_slots[timer->expire % SLOTS];
+        timer->prev = NULL;
+        timer->next = head;
+        if (head)
+        {
+            head->prev = timer;
+        }
+        head = timer;
+        timer->linked = true;
+        ++m_count;
+    }
+
+    // 重新设置定时器的到期时间
+    void adjust_timer(wheel_timer *timer, unsigned long ticks)
+    {
+        del_timer(timer);
+        add_timer(timer, ticks);
+    }
+
+    // 将定时器从时间轮上摘下, 定时器不在时间轮上时什么也不做
+    void del_timer(wheel_timer *timer)
+    {
+        if (!timer || !timer->linked)
+        {
+            return;
+        }
+        if (timer->prev)
+        {
+            timer->prev->next = timer->next;
+        }
+        else
+        {
+            m_slots[timer->expire % SLOTS] = timer->next;
+        }
+        if (timer->next)
+        {
+            timer->next->prev = timer->prev;
+        }
+        timer->prev = timer->next = NULL;
+        timer->linked = false;
+        --m_count;
+    }
+
+    // 时间轮前进一格, 对到期的定时器先摘下再调用cb_func(回调中可以重新添加定时器)
+    void tick(void (*cb_func)(wheel_timer *, void *), void *arg)
+    {
+        ++m_cur_tick;
+        wheel_timer *tmp = m_slots[m_cur_tick % SLOTS];
+        while (tmp)
+        {
+            wheel_timer *next = tmp->next;
+            if (tmp->expire <= m_cur_tick)
+            {
+                del_timer(tmp);
+                cb_func(tmp, arg);
+            }
+            tmp = next;
+        }
+    }
+
+    // 对时间轮上的每个定时器调用cb_func, 回调中可以删除当前的定时器
+    void for_each(void (*cb_func)(wheel_timer *, void *), void *arg)
+    {
+        for (int i = 0; i < SLOTS; ++i)
+        {
+            wheel_timer *tmp = m_slots[i];
+            while (tmp)
+            {
+                wheel_timer *next = tmp->next;
+                cb_func(tmp, arg);
+                tmp = next;
+            }
+        }
+    }
+
+    size_t size() const { return m_count; } // 时间轮上的定时器数量
+
+private:
+    wheel_timer *m_slots[SLOTS]; // 时间轮的槽
+    unsigned long m_cur_tick;    // 当前的tick
+    size_t m_count;              // 定时器数量
+};
+
+#endif
@@ -0,0 +1,771 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include "uring_reactor.h"
+#include "syscall_stats.h"
+#include "overload.h"
+#include "logger.h"
+
+static int io_uring_setup(unsigned entries, io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static uint64_t make_data(int op, int fd)
+{
+    return ((uint64_t)op << 32) | (uint32_t)fd;
+}
+
+bool uring_reactor::supported()
+{
+    struct utsname un;
+    int major = 0, minor = 0;
+    if (uname(&un) != 0 || sscanf(un.release, "%d.%d", &major, &minor) != 2 || major < 6)
+    {
+        return false;
+    }
+
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = io_uring_setup(4, &p);
+    if (fd < 0)
+    {
+        return false;
+    }
+    alignas(io_uring_probe) char buf[sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op)];
+    memset(buf, 0, sizeof(buf));
+    io_uring_probe *probe = (io_uring_probe *)buf;
+    bool ok = io_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    const int needed[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_SPLICE, IORING_OP_READ, IORING_OP_ASYNC_CANCEL};
+    for (size_t i = 0; ok && i < sizeof(needed) / sizeof(needed[0]); ++i)
+    {
+        ok = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    close(fd);
+    return ok;
+}
+
+uring_reactor::uring_reactor(int listenfd, http_conn *users, int max_fd)
+    : m_listenfd(listenfd), m_accept_stopping(false), m_drain_all(false), m_conns(0), m_expirations(0), m_users(users), m_max_fd(max_fd), m_sq_local_tail(0), m_buf_tail(0)
+{
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    m_ringfd = io_uring_setup(RING_ENTRIES, &p);
+    if (m_ringfd < 0)
+    {
+        throw exception();
+    }
+
+    //  映射提交队列、完成队列和提交队列项, 支持IORING_FEAT_SINGLE_MMAP时前两者共用一次映射
+    m_sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && m_cq_len > m_sq_len)
+    {
+        m_sq_len = m_cq_len;
+    }
+    m_sq_ptr = mmap(NULL, m_sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQ_RING);
+    m_cq_ptr = single ? m_sq_ptr : mmap(NULL, m_cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_CQ_RING);
+    m_sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe *)mmap(NULL, m_sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQES);
+    if (m_sq_ptr == MAP_FAILED || m_cq_ptr == MAP_FAILED || m_sqes == MAP_FAILED)
+    {
+        close(m_ringfd);
+        throw exception();
+    }
+    char *sq = (char *)m_sq_ptr;
+    m_sq_head = (unsigned *)(sq + p.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    m_sq_array = (unsigned *)(sq + p.sq_off.array);
+    m_sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    m_sq_entries = p.sq_entries;
+    m_sq_local_tail = *m_sq_tail;
+    char *cq = (char *)m_cq_ptr;
+    m_cq_head = (unsigned *)(cq + p.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    m_cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    //  注册接收缓冲区环, 所有缓冲区一开始都交给内核
+    m_buf_ring_len = BUF_COUNT * sizeof(io_uring_buf);
+    m_buf_ring = (io_uring_buf_ring *)mmap(NULL, m_buf_ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    m_buf_base = (char *)mmap(NULL, (size_t)BUF_COUNT * BUF_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)m_buf_ring;
+    reg.ring_entries = BUF_COUNT;
+    reg.bgid = BUF_GROUP;
+    if (m_buf_ring == MAP_FAILED || m_buf_base == MAP_FAILED || io_uring_register(m_ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+    {
+        close(m_ringfd);
+        throw exception();
+    }
+    for (int i = 0; i < BUF_COUNT; ++i)
+    {
+        recycle_buffer(i);
+    }
+
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (m_timerfd < 0)
+    {
+        close(m_ringfd);
+        throw exception();
+    }
+    struct itimerspec its;
+    bzero(&its, sizeof(its));
+    its.it_value.tv_sec = TIMESLOT;
+    its.it_interval.tv_sec = TIMESLOT;
+    timerfd_settime(m_timerfd, 0, &its, NULL);
+
+    m_states = new conn_state[m_max_fd];
+    memset(m_states, 0, sizeof(conn_state) * m_max_fd);
+}
+
+uring_reactor::~uring_reactor()
+{
+    if (m_listenfd != -1)
+    {
+        close(m_listenfd);
+    }
+    delete[] m_states;
+    close(m_timerfd);
+    munmap(m_buf_base, (size_t)BUF_COUNT * BUF_SIZE);
+    munmap(m_buf_ring, m_buf_ring_len);
+    munmap(m_sqes, m_sqes_len);
+    if (m_cq_ptr != m_sq_ptr)
+    {
+        munmap(m_cq_ptr, m_cq_len);
+    }
+    munmap(m_sq_ptr, m_sq_len);
+    close(m_ringfd);
+}
+
+io_uring_sqe *uring_reactor::get_sqe(int op, int fd)
+{
+    while (m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries) // 提交队列满了先提交一次
+    {
+        submit(0);
+    }
+    unsigned idx = m_sq_local_tail & m_sq_mask;
+    io_uring_sqe *sqe = &m_sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = make_data(op, fd);
+    m_sq_array[idx] = idx;
+    m_sq_local_tail++;
+    return sqe;
+}
+
+int uring_reactor::submit(unsigned wait_nr)
+{
+    __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    syscall_stats::count(syscall_stats::SC_URING_ENTER);
+    return io_uring_enter(m_ringfd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+}
+
+void uring_reactor::recycle_buffer(int bid)
+{
+    // 不用bufs成员: 内核头文件中的柔性数组在C++下前面会多出一个空结构体, 偏移不对
+    io_uring_buf *buf = (io_uring_buf *)m_buf_ring + (m_buf_tail & (BUF_COUNT - 1));
+    buf->addr = (uint64_t)(uintptr_t)(m_buf_base + (size_t)bid * BUF_SIZE);
+    buf->len = BUF_SIZE;
+    buf->bid = bid;
+    m_buf_tail++;
+    __atomic_store_n(&m_buf_ring->tail, m_buf_tail, __ATOMIC_RELEASE);
+}
+
+void uring_reactor::arm_accept()
+{
+    io_uring_sqe *sqe = get_sqe(OP_ACCEPT, m_listenfd);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+}
+
+void uring_reactor::arm_recv(int fd)
+{
+    io_uring_sqe *sqe = get_sqe(OP_RECV, fd);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    m_states[fd].recv_armed = true;
+    m_states[fd].inflight++;
+}
+
+void uring_reactor::arm_timer()
+{
+    io_uring_sqe *sqe = get_sqe(OP_TIMER, m_timerfd);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_timerfd;
+    sqe->addr = (uint64_t)(uintptr_t)&m_expirations;
+    sqe->len = sizeof(m_expirations);
+}
+
+void uring_reactor::loop()
+{
+    arm_accept();
+    arm_timer();
+    while (!io_loop::draining() || m_listenfd != -1 || m_conns > 0) // 优雅退出时等所有连接关闭
+    {
+        int ret = submit(1);
+        if (ret < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+        {
+            LOG_ERROR("io_uring failure: %s", strerror(errno));
+            break;
+        }
+
+        unsigned head = *m_cq_head;
+        while (head != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+        {
+            io_uring_cqe cqe = m_cqes[head & m_cq_mask];
+            __atomic_store_n(m_cq_head, ++head, __ATOMIC_RELEASE); // 先腾出完成队列的位置, 处理时还会产生新的请求
+            handle_cqe(cqe);
+        }
+    }
+}
+
+void uring_reactor::handle_cqe(const io_uring_cqe &cqe)
+{
+    int op = (int)(cqe.user_data >> 32);
+    int fd = (int)(uint32_t)cqe.user_data;
+    switch (op)
+    {
+    case OP_ACCEPT:
+        handle_accept(cqe);
+        break;
+    case OP_RECV:
+        handle_recv(fd, cqe);
+        break;
+    case OP_SEND:
+        handle_send(fd, cqe.res);
+        break;
+    case OP_SPLICE_IN:
+        handle_splice_in(fd, cqe.res);
+        break;
+    case OP_SPLICE_OUT:
+        handle_splice_out(fd, cqe.res);
+        break;
+    case OP_TIMER:
+        handle_timer(cqe.res);
+        break;
+    default: // OP_CANCEL的结果不需要处理
+        break;
+    }
+}
+
+void uring_reactor::handle_accept(const io_uring_cqe &cqe)
+{
+    if (!(cqe.flags & IORING_CQE_F_MORE)) // 多次触发的accept被内核终止了, 重新提交; 优雅退出时是被取消了
+    {
+        if (m_accept_stopping)
+        {
+            close(m_listenfd);
+            syscall_stats::count(syscall_stats::SC_CLOSE);
+            m_listenfd = -1;
+        }
+        else
+        {
+            arm_accept();
+        }
+    }
+    int connfd = cqe.res;
+    if (connfd < 0)
+    {
+        if (connfd != -ECANCELED)
+        {
+            LOG_WARN("accept failure: %s", strerror(-connfd));
+        }
+        return;
+    }
+    if (http_conn::m_user_count >= overload_control::m_max_conn || connfd >= m_max_fd) // 连接数达到上限
+    {
+        overload_control::reject(connfd, false);
+        close(connfd);
+        return;
+    }
+    struct sockaddr_in client_address;
+    socklen_t client_addrlength = sizeof(client_address);
+    getpeername(connfd, (struct sockaddr *)&client_address, &client_addrlength);
+    syscall_stats::count(syscall_stats::SC_OTHER);
+
+    memset(&m_states[connfd], 0, sizeof(conn_state));
+    m_states[connfd].pipefd[0] = m_states[connfd].pipefd[1] = -1;
+    m_states[connfd].held_first = m_states[connfd].held_last = -1;
+    http_conn *conn = m_users + connfd;
+    conn->init(connfd, client_address, -1, true); // 不使用epoll
+    m_conns++;
+    arm_recv(connfd);
+    refresh_timer(conn);
+}
+
+/*
+    正在发送时不处理新收到的请求, 流水线中PUT/POST的请求体会一直堆在读缓冲区中。读缓冲区到了上限时
+    不再拷贝, 而是暂存内核填好的接收缓冲区并取消recv, 让TCP的流量控制挡住对方, 与epoll后端读缓冲区满时
+    暂停读一样; 这一批发完后由feed_held把暂存的数据交给连接(边交边处理请求体)再恢复接收
+*/
+void uring_reactor::handle_recv(int fd, const io_uring_cqe &cqe)
+{
+    conn_state &st = m_states[fd];
+    http_conn *conn = m_users + fd;
+    bool ok = true;
+    bool held = false;
+    if (cqe.flags & IORING_CQE_F_BUFFER) // 数据在公共缓冲区中, 拷贝后马上归还
+    {
+        int bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        if (cqe.res > 0 && !st.closing &&
+            (st.held_first != -1 || !conn->feed(m_buf_base + (size_t)bid * BUF_SIZE, cqe.res)))
+        {
+            if (st.sending) // 读缓冲区放不下, 或者前面已经有暂存的数据(保持顺序)
+            {
+                m_held_next[bid] = -1;
+                m_held_len[bid] = cqe.res;
+                if (st.held_first == -1)
+                {
+                    st.held_first = bid;
+                }
+                else
+                {
+                    m_held_next[st.held_last] = bid;
+                }
+                st.held_last = bid;
+                held = true;
+            }
+            else
+            {
+                ok = false;
+            }
+        }
+        if (!held)
+        {
+            recycle_buffer(bid);
+        }
+    }
+    bool cancelled = cqe.res == -ECANCELED && st.recv_cancelled;
+    if (!(cqe.flags & IORING_CQE_F_MORE))
+    {
+        st.recv_armed = false;
+        st.recv_cancelled = false;
+        if (op_done(fd))
+        {
+            return;
+        }
+    }
+    else if (st.closing)
+    {
+        return;
+    }
+
+    if (!cancelled && (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS) || !ok)) // 对方关闭连接、出错或者请求太大
+    {
+        close_conn(fd);
+        return;
+    }
+    if (held && st.recv_armed && !st.recv_cancelled) // 暂停接收, 已经在路上的数据继续暂存
+    {
+        io_uring_sqe *sqe = get_sqe(OP_CANCEL, fd);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = make_data(OP_RECV, fd); // 按user_data只取消recv, 发送不受影响
+        st.recv_cancelled = true;
+    }
+    if (!st.recv_armed && st.held_first == -1) // 接收缓冲区暂时用完时recv会被终止
+    {
+        arm_recv(fd);
+    }
+    refresh_timer(conn);
+    if (!st.sending) // 正在发送时收到的流水线请求等这一批发完再处理
+    {
+        process(fd);
+    }
+}
+
+void uring_reactor::process(int fd)
+{
+    http_conn *conn = m_users + fd;
+    if (!conn->process_batch())
+    {
+        close_conn(fd);
+        return;
+    }
+    if (conn->has_output())
+    {
+        start_send(fd);
+    }
+    refresh_timer(conn);
+}
+
+void uring_reactor::start_send(int fd)
+{
+    conn_state &st = m_states[fd];
+    http_conn *conn = m_users + fd;
+    st.sending = true;
+
+    const http_conn::out_part &part = conn->current_part();
+    if (part.fd != -1) // 文件数据经过管道搬运: 文件->管道, 管道->socket, 两个splice链接在一起
+    {
+        if (st.pipefd[0] == -1 && pipe2(st.pipefd, O_CLOEXEC) != 0)
+        {
+            close_conn(fd);
+            return;
+        }
+        size_t len = part.len < SPLICE_CHUNK ? part.len : SPLICE_CHUNK;
+        io_uring_sqe *sqe = get_sqe(OP_SPLICE_IN, fd);
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->fd = st.pipefd[1];
+        sqe->off = (uint64_t)-1;
+        sqe->splice_fd_in = part.fd;
+        sqe->splice_off_in = part.off;
+        sqe->len = len;
+        sqe->splice_flags = SPLICE_F_MOVE;
+        sqe->flags = IOSQE_IO_LINK;
+        st.in_busy = true;
+        st.inflight++;
+
+        sqe = get_sqe(OP_SPLICE_OUT, fd);
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->fd = fd;
+        sqe->off = (uint64_t)-1;
+        sqe->splice_fd_in = st.pipefd[0];
+        sqe->splice_off_in = (uint64_t)-1;
+        sqe->len = len;
+        sqe->splice_flags = SPLICE_F_MOVE | (part.len > len ? SPLICE_F_MORE : 0);
+        st.inflight++;
+        return;
+    }
+
+    if (!st.ctx)
+    {
+        size_t capacity = 0;
+        st.ctx = (send_ctx *)http_conn::m_buffers.alloc(sizeof(send_ctx), capacity);
+        if (!st.ctx)
+        {
+            close_conn(fd);
+            return;
+        }
+    }
+    bool file_follows = false;
+    memset(&st.ctx->msg, 0, sizeof(st.ctx->msg));
+    st.ctx->msg.msg_iov = st.ctx->iov;
+    st.ctx->msg.msg_iovlen = conn->gather_parts(st.ctx->iov, http_conn::MAX_PARTS, file_follows);
+
+    io_uring_sqe *sqe = get_sqe(OP_SEND, fd);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)&st.ctx->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL | (file_follows ? MSG_MORE : 0); // 后面是文件时让内核合并报文段
+    st.inflight++;
+}
+
+void uring_reactor::splice_out(int fd)
+{
+    conn_state &st = m_states[fd];
+    io_uring_sqe *sqe = get_sqe(OP_SPLICE_OUT, fd);
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->fd = fd;
+    sqe->off = (uint64_t)-1;
+    sqe->splice_fd_in = st.pipefd[0];
+    sqe->splice_off_in = (uint64_t)-1;
+    sqe->len = st.in_pipe;
+    sqe->splice_flags = SPLICE_F_MOVE;
+    st.inflight++;
+}
+
+void uring_reactor::handle_send(int fd, int res)
+{
+    if (op_done(fd))
+    {
+        return;
+    }
+    if (res == -EAGAIN || res == -EINTR)
+    {
+        start_send(fd);
+        return;
+    }
+    if (res <= 0)
+    {
+        close_conn(fd);
+        return;
+    }
+    if (m_users[fd].advance(res))
+    {
+        batch_done(fd);
+    }
+    else
+    {
+        start_send(fd);
+    }
+}
+
+void uring_reactor::handle_splice_in(int fd, int res)
+{
+    conn_state &st = m_states[fd];
+    st.in_busy = false;
+    if (op_done(fd))
+    {
+        return;
+    }
+    if (res <= 0) // 读文件出错或者文件被截断, 链接的splice会被取消
+    {
+        close_conn(fd);
+        return;
+    }
+    st.in_pipe += res;
+    if (st.out_waiting)
+    {
+        st.out_waiting = false;
+        splice_out(fd);
+    }
+}
+
+/*
+    文件到管道的splice不完整时内核会取消链接在后面的splice(-ECANCELED),
+    这时改为只发送管道中实际有的字节; 发送不完整时管道中剩下的数据下次继续发送
+*/
+void uring_reactor::handle_splice_out(int fd, int res)
+{
+    conn_state &st = m_states[fd];
+    if (op_done(fd))
+    {
+        return;
+    }
+    if (res == -ECANCELED || res == -EAGAIN || res == -EINTR)
+    {
+        if (st.in_pipe > 0)
+        {
+            splice_out(fd);
+        }
+        else if (st.in_busy)
+        {
+            st.out_waiting = true;
+        }
+        else
+        {
+            close_conn(fd);
+        }
+        return;
+    }
+    if (res <= 0)
+    {
+        close_conn(fd);
+        return;
+    }
+    st.in_pipe -= res;
+    if (m_users[fd].advance(res))
+    {
+        batch_done(fd);
+    }
+    else if (st.in_pipe > 0)
+    {
+        splice_out(fd);
+    }
+    else
+    {
+        start_send(fd);
+    }
+}
+
+void uring_reactor::batch_done(int fd)
+{
+    conn_state &st = m_states[fd];
+    http_conn *conn = m_users + fd;
+    st.sending = false;
+    if (st.ctx)
+    {
+        http_conn::m_buffers.free((char *)st.ctx, sizeof(send_ctx));
+        st.ctx = NULL;
+    }
+    if (!conn->end_batch())
+    {
+        close_conn(fd);
+        return;
+    }
+    if (st.held_first != -1)
+    {
+        feed_held(fd);
+        if (st.closing || st.sending)
+        {
+            return;
+        }
+    }
+    if (conn->has_buffered_request()) // 读缓冲区中还有流水线请求
+    {
+        process(fd);
+    }
+    else
+    {
+        refresh_timer(conn);
+    }
+}
+
+void uring_reactor::feed_held(int fd)
+{
+    conn_state &st = m_states[fd];
+    http_conn *conn = m_users + fd;
+    bool processed = false; // 处理过请求之后仍然放不下, 说明一个请求的头部就超过了读缓冲区的上限
+    while (st.held_first != -1)
+    {
+        int bid = st.held_first;
+        if (conn->feed(m_buf_base + (size_t)bid * BUF_SIZE, m_held_len[bid]))
+        {
+            st.held_first = m_held_next[bid];
+            recycle_buffer(bid);
+            processed = false;
+            continue;
+        }
+        if (processed)
+        {
+            close_conn(fd);
+            return;
+        }
+        process(fd); // 消费读缓冲区中的请求体, 腾出空间
+        processed = true;
+        if (st.closing || st.sending) // 又开始发送一批响应, 剩下的等它发完
+        {
+            return;
+        }
+    }
+    st.held_last = -1;
+    if (!st.recv_armed) // 被取消的recv还没有结束时由它的完成事件重新提交
+    {
+        arm_recv(fd);
+    }
+}
+
+bool uring_reactor::op_done(int fd)
+{
+    conn_state &st = m_states[fd];
+    st.inflight--;
+    if (!st.closing)
+    {
+        return false;
+    }
+    if (st.inflight == 0)
+    {
+        finish_close(fd);
+    }
+    return true;
+}
+
+void uring_reactor::handle_timer(int res)
+{
+    if (res == sizeof(m_expirations))
+    {
+        while (m_expirations--) // 事件循环繁忙时可能错过几个tick, 一并补上
+        {
+            m_timers.tick(cb_func, this);
+        }
+    }
+    arm_timer();
+    if (io_loop::draining())
+    {
+        drain();
+    }
+}
+
+void uring_reactor::refresh_timer(http_conn *conn)
+{
+    int timeout = conn->timer_timeout();
+    if (timeout > 0)
+    {
+        m_timers.adjust_timer(conn->timer(), (timeout + TIMESLOT - 1) / TIMESLOT);
+    }
+}
+
+/*
+    内核中可能还有这个连接的recv/sendmsg/splice在进行, 它们引用着连接的缓冲区和文件描述符,
+    所以先shutdown让它们尽快结束并取消所有请求, 等最后一个完成事件到达后才真正关闭
+*/
+void uring_reactor::close_conn(int fd)
+{
+    conn_state &st = m_states[fd];
+    if (st.closing)
+    {
+        return;
+    }
+    st.closing = true;
+    m_timers.del_timer(m_users[fd].timer());
+    if (st.inflight == 0)
+    {
+        finish_close(fd);
+        return;
+    }
+    shutdown(fd, SHUT_RDWR);
+    syscall_stats::count(syscall_stats::SC_OTHER);
+    io_uring_sqe *sqe = get_sqe(OP_CANCEL, fd);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+}
+
+void uring_reactor::finish_close(int fd)
+{
+    conn_state &st = m_states[fd];
+    if (st.ctx)
+    {
+        http_conn::m_buffers.free((char *)st.ctx, sizeof(send_ctx));
+        st.ctx = NULL;
+    }
+    if (st.pipefd[0] != -1)
+    {
+        close(st.pipefd[0]);
+        close(st.pipefd[1]);
+        st.pipefd[0] = st.pipefd[1] = -1;
+    }
+    while (st.held_first != -1)
+    {
+        int bid = st.held_first;
+        st.held_first = m_held_next[bid];
+        recycle_buffer(bid);
+    }
+    m_users[fd].close_conn();
+    m_conns--;
+}
+
+void uring_reactor::drain()
+{
+    if (m_listenfd != -1 && !m_accept_stopping) // 交接给新进程的监听套接字在新进程中继续接受连接
+    {
+        io_uring_sqe *sqe = get_sqe(OP_CANCEL, m_listenfd);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = m_listenfd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        m_accept_stopping = true;
+    }
+    m_drain_all = io_loop::drain_expired();
+    m_timers.for_each(drain_func, this);
+}
+
+void uring_reactor::drain_func(wheel_timer *timer, void *arg)
+{
+    uring_reactor *r = (uring_reactor *)arg;
+    http_conn *conn = (http_conn *)timer->user_data;
+    if (r->m_drain_all || conn->is_idle())
+    {
+        r->close_conn(conn - r->m_users);
+    }
+}
+
+void uring_reactor::cb_func(wheel_timer *timer, void *arg) // 定时器回调函数, 关闭超时的连接
+{
+    uring_reactor *r = (uring_reactor *)arg;
+    http_conn *conn = (http_conn *)timer->user_data;
+    r->close_conn(conn - r->m_users);
+}
@@ -0,0 +1,143 @@
+#ifndef URING_REACTOR_H
+#define URING_REACTOR_H
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "http_conn.h"
+#include "timer_wheel.h"
+#include "io_loop.h"
+
+/*
+    基于io_uring的事件循环, 与多reactor模式的reactor一样每个线程一个实例、
+    各自通过SO_REUSEPORT监听同一端口, 但不再等待就绪事件再发起系统调用, 而是直接提交I/O请求:
+    监听套接字上挂一个多次触发的accept; 每个连接挂一个多次触发的recv, 数据放在
+    预先提供给内核的公共缓冲区中, 收到后拷贝进连接自己的读缓冲区并立即归还, 空闲连接不占用缓冲区
+    (只有正在发送而读缓冲区已满时暂存, 同时暂停接收);
+    内存中的响应用sendmsg发送, sendfile模式下的文件经过管道用两个链接在一起的splice发送。
+    一次io_uring_enter同时提交所有新请求并等待完成事件。
+    没有使用liburing, 直接通过系统调用和共享内存操作提交队列和完成队列。
+    长连接下每个请求几乎不需要系统调用, 比epoll快; 每个请求一个连接时反而比epoll慢: 多次触发的accept拿不到
+    对方地址要多一次getpeername, 关闭时要shutdown并取消recv、等它的完成事件之后才能close, 内核中建立和取消
+    多次触发的recv的开销也都由这一个请求承担
+*/
+class uring_reactor : public io_loop
+{
+public:
+    static const unsigned RING_ENTRIES = 4096; // 提交队列的大小, 完成队列是它的两倍
+    static const int BUF_COUNT = 1024;         // 提供给内核的接收缓冲区数量(2的幂)
+    static const int BUF_SIZE = 4096;          // 每个接收缓冲区的大小
+    static const int BUF_GROUP = 0;            // 接收缓冲区组的编号
+    static const size_t SPLICE_CHUNK = 65536;  // 每次经过管道搬运的文件字节数(管道的默认容量)
+    static const int TIMESLOT = 1;             // 时间轮一个tick的长度(秒)
+
+    static bool supported(); // 内核是否支持需要的io_uring功能(多次触发的recv需要6.0以上)
+
+    uring_reactor(int listenfd, http_conn *users, int max_fd);
+    ~uring_reactor();
+
+    void loop(); // 在当前线程中运行事件循环, 优雅退出完成后返回
+
+private:
+    enum OP // 完成事件的user_data高32位记录请求的类型, 低32位是文件描述符
+    {
+        OP_ACCEPT = 1,
+        OP_RECV,
+        OP_SEND,
+        OP_SPLICE_IN,
+        OP_SPLICE_OUT,
+        OP_TIMER,
+        OP_CANCEL
+    };
+
+    struct send_ctx // sendmsg的参数在请求完成前必须一直有效, 发送期间从缓冲池中取得
+    {
+        struct msghdr msg;
+        struct iovec iov[http_conn::MAX_PARTS];
+    };
+
+    struct conn_state // 连接在本reactor上的I/O状态
+    {
+        int inflight;      // 还没有完成的请求数(多次触发的recv算一个)
+        bool recv_armed;   // recv是否还在触发
+        bool recv_cancelled; // 为了暂停接收取消了recv, 它的-ECANCELED不是错误
+        bool sending;      // 是否正在发送一批响应
+        bool closing;      // 正在关闭, 等所有请求完成后才真正关闭文件描述符
+        bool in_busy;      // 文件到管道的splice还没有完成
+        bool out_waiting;  // 管道到socket的splice因为前一个splice不完整而被取消, 等它完成后重新提交
+        int pipefd[2];     // sendfile模式下搬运文件数据的管道
+        size_t in_pipe;    // 管道中还没有发送的字节数
+        send_ctx *ctx;
+        int held_first;    // 发送期间读缓冲区放不下而暂存的接收缓冲区(按到达顺序链接), 不为-1时暂停接收
+        int held_last;
+    };
+
+    io_uring_sqe *get_sqe(int op, int fd); // 取一个空闲的提交队列项并填好user_data
+    int submit(unsigned wait_nr);
+    void arm_accept();
+    void arm_recv(int fd);
+    void arm_timer();
+    void recycle_buffer(int bid); // 把接收缓冲区还给内核
+
+    void handle_cqe(const io_uring_cqe &cqe);
+    void handle_accept(const io_uring_cqe &cqe);
+    void handle_recv(int fd, const io_uring_cqe &cqe);
+    void handle_send(int fd, int res);
+    void handle_splice_in(int fd, int res);
+    void handle_splice_out(int fd, int res);
+    void handle_timer(int res);
+
+    void process(int fd);    // 解析读缓冲区中的请求, 有响应时开始发送
+    void start_send(int fd); // 从当前数据块开始提交发送请求
+    void splice_out(int fd); // 把管道中的数据发送到socket
+    void batch_done(int fd); // 一批响应全部发送完毕
+    void feed_held(int fd);  // 把暂存的接收缓冲区交给连接, 全部交完后恢复接收
+    bool op_done(int fd);    // 一个请求完成, 连接正在关闭时返回true
+    void refresh_timer(http_conn *conn);
+    void close_conn(int fd);  // 取消连接上所有的请求, 全部完成后再关闭
+    void finish_close(int fd);
+    void drain(); // 优雅退出: 取消accept后关闭监听套接字, 关闭空闲的连接, 期限到了关闭所有连接
+    static void cb_func(wheel_timer *timer, void *arg);    // 定时器回调函数
+    static void drain_func(wheel_timer *timer, void *arg); // 优雅退出时对每个连接调用
+
+private:
+    int m_ringfd;     // io_uring实例
+    int m_listenfd;   // 该reactor的监听文件描述符, 由reactor关闭, 关闭后为-1
+    bool m_accept_stopping; // 已经取消了accept, 最后一个完成事件到达后关闭监听套接字
+    bool m_drain_all;       // 优雅退出的期限已到, 不论是否空闲都关闭
+    int m_conns;            // 本reactor上还没有关闭的连接数
+    int m_timerfd;    // 驱动时间轮的timerfd
+    uint64_t m_expirations; // timerfd读出的到期次数
+    timer_wheel m_timers;
+    http_conn *m_users;     // 任务对象数组(以文件描述符为下标, 所有reactor共享)
+    conn_state *m_states;   // 连接在本reactor上的I/O状态, 以文件描述符为下标
+    int m_max_fd;
+
+    //  提交队列和完成队列, 与内核共享
+    void *m_sq_ptr;
+    size_t m_sq_len;
+    void *m_cq_ptr;
+    size_t m_cq_len;
+    io_uring_sqe *m_sqes;
+    size_t m_sqes_len;
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_array;
+    unsigned m_sq_mask;
+    unsigned m_sq_entries;
+    unsigned m_sq_local_tail; // 已经填好但内核还没有看到的提交队列尾
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned m_cq_mask;
+    io_uring_cqe *m_cqes;
+
+    //  提供给内核的接收缓冲区
+    io_uring_buf_ring *m_buf_ring;
+    size_t m_buf_ring_len;
+    char *m_buf_base;
+    unsigned short m_buf_tail;
+    int m_held_next[BUF_COUNT]; // 暂存的接收缓冲区链表, 以缓冲区编号为下标
+    int m_held_len[BUF_COUNT];  // 暂存的接收缓冲区中数据的长度
+};
+
+#endif